@@ -27,6 +27,7 @@
 #include "AlsaAudioSystem.hpp"
 #include "AlsaAudioSystemPrivate.hpp"
 #include "Configuration.hpp"
+#include "SampleOps.hpp"
 #include <cassert>
 #include <cstring>
 #include <cstdlib>
@@ -35,27 +36,45 @@
 #include <alsa/asoundlib.h>
 #include <sys/time.h>
 #include <cmath>
+#include <cerrno>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 
-#include "bams_format.h"
 #include <endian.h>
 
 #include <iostream>
 using namespace std;
 
-/* Formats supported by this class, in order or preference
+/* Formats supported by this class, in order or preference: native
+ * byte order first, then the most resolution.
  */
 static const snd_pcm_format_t aas_supported_formats[] = {
 #if __BYTE_ORDER == __LITTLE_ENDIAN
     SND_PCM_FORMAT_FLOAT_LE,
+    SND_PCM_FORMAT_S32_LE,
+    SND_PCM_FORMAT_S24_LE,
+    SND_PCM_FORMAT_S24_3LE,
     SND_PCM_FORMAT_S16_LE,
     SND_PCM_FORMAT_FLOAT_BE,
+    SND_PCM_FORMAT_S32_BE,
+    SND_PCM_FORMAT_S24_BE,
+    SND_PCM_FORMAT_S24_3BE,
     SND_PCM_FORMAT_S16_BE,
     SND_PCM_FORMAT_U16_LE,
     SND_PCM_FORMAT_U16_BE,
 #elif __BYTE_ORDER == __BIG_ENDIAN
     SND_PCM_FORMAT_FLOAT_BE,
+    SND_PCM_FORMAT_S32_BE,
+    SND_PCM_FORMAT_S24_BE,
+    SND_PCM_FORMAT_S24_3BE,
     SND_PCM_FORMAT_S16_BE,
     SND_PCM_FORMAT_FLOAT_LE,
+    SND_PCM_FORMAT_S32_LE,
+    SND_PCM_FORMAT_S24_LE,
+    SND_PCM_FORMAT_S24_3LE,
     SND_PCM_FORMAT_S16_LE,
     SND_PCM_FORMAT_U16_BE,
     SND_PCM_FORMAT_U16_LE,
@@ -68,16 +87,22 @@ static const snd_pcm_format_t aas_supported_formats[] = {
 namespace StretchPlayer
 {
     inline bool not_aligned_16(void* ptr) {
-	return ((int)ptr) % 16;
+	return ((unsigned long)ptr) % 16;
+    }
+
+    static inline double monotonic_now() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
     }
 
     AlsaAudioSystem::AlsaAudioSystem() :
 	_channels(2),
-	_type(FLOAT),
-	_bits(32),
-/*	_type(INT),
-	_bits(16), */
-	_little_endian(true),
+	_format(BAMS_FLOATLE),
+	_sample_bytes(4),
+	_dither(false),
+	_interleave(0),
+	_mmap(false),
 	_sample_rate(44100),
 	_period_nframes(512),
 	_active(false),
@@ -86,8 +111,28 @@ namespace StretchPlayer
 	_right_root(0),
 	_left(0),
 	_right(0),
+	_capture_handle(0),
+	_capture_channels(0),
+	_capture_format(SND_PCM_FORMAT_UNKNOWN),
+	_capture_delay(0),
 	_callback(0),
 	_callback_arg(0),
+	_rewind_callback(0),
+	_rewind_callback_arg(0),
+	_tsched(false),
+	_buffer_nframes(0),
+	_tsched_shallow(0),
+	_tsched_watermark(0),
+	_tsched_safety(0),
+	_timer_fd(-1),
+	_event_fd(-1),
+	_rewind_requested(0),
+	_status(0),
+	_htstamp(false),
+	_frames_written(0),
+	_segment_start(0),
+	_delay(0),
+	_delay_time(0.0),
 	_dsp_load_pos(0),
 	_dsp_load(0.0f),
 	_d(0)
@@ -113,27 +158,33 @@ namespace StretchPlayer
     {
 	QString name("StretchPlayer");
 	QString emsg;
+	QString device;
 	unsigned nfrags;
 	int err;
 	snd_pcm_format_t format = SND_PCM_FORMAT_UNKNOWN;
+	snd_pcm_uframes_t period_nframes;
 	int k;
 
-	_sample_rate = config->sample_rate();
-	_period_nframes = config->period_size();
-	nfrags = config->periods_per_buffer();
-
 	if( config == 0 ) {
 	    emsg = "The AlsaAudioSystem::init() function must have a non-null config parameter.";
 	    goto init_bail;
 	}
+	device = config->audio_device();
+	_sample_rate = config->sample_rate();
+	_period_nframes = config->period_size();
+	nfrags = config->periods_per_buffer();
+	_tsched = config->alsa_tsched();
+	_dither = config->alsa_dither();
 
 	snd_pcm_hw_params_t *hw_params;
 	snd_pcm_sw_params_t *sw_params;
 	int nfds;
 	struct pollfd *pfds;
 
-	if((err = snd_pcm_open(&_playback_handle, "default", SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
-	    emsg = QString("cannot open default ALSA audio device (%1)")
+	if((err = snd_pcm_open(&_playback_handle, device.toLocal8Bit().data(),
+			       SND_PCM_STREAM_PLAYBACK, 0)) < 0) {
+	    emsg = QString("cannot open ALSA audio device '%1' (%2)")
+		.arg(device)
 		.arg(snd_strerror(err));
 	    goto init_bail;
 	}
@@ -151,8 +202,22 @@ namespace StretchPlayer
 	    goto init_bail;
 	}
 
+	/* Only take rates that the device does itself.  If it's a
+	 * plug device, this keeps its resampler out of the way.
+	 */
+	snd_pcm_hw_params_set_rate_resample(_playback_handle, hw_params, 0);
+
+	/* With mmap access the output conversion writes straight
+	 * into the DMA buffer.  Not all devices (or plugins) can do
+	 * it, so fall back to snd_pcm_writei().
+	 */
+	_mmap = config->alsa_mmap()
+	    && (snd_pcm_hw_params_test_access(_playback_handle, hw_params,
+					      SND_PCM_ACCESS_MMAP_INTERLEAVED) == 0);
+
 	if((err = snd_pcm_hw_params_set_access(_playback_handle, hw_params,
-					       SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+					       _mmap ? SND_PCM_ACCESS_MMAP_INTERLEAVED
+					       : SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
 	    emsg = QString("cannot set access type (%1)")
 		.arg( snd_strerror(err) );
 	    goto init_bail;
@@ -168,36 +233,18 @@ namespace StretchPlayer
 	}
 
 	switch(format) {
-	case SND_PCM_FORMAT_FLOAT_LE:
-	    _type = FLOAT;
-	    _bits = 32;
-	    _little_endian = true;
-	    break;
-	case SND_PCM_FORMAT_S16_LE:
-	    _type = INT;
-	    _bits = 16;
-	    _little_endian = true;
-	    break;
-	case SND_PCM_FORMAT_FLOAT_BE:
-	    _type = FLOAT;
-	    _bits = 32;
-	    _little_endian = false;
-	    break;
-	case SND_PCM_FORMAT_S16_BE:
-	    _type = INT;
-	    _bits = 16;
-	    _little_endian = false;
-	    break;
-	case SND_PCM_FORMAT_U16_LE:
-	    _type = UINT;
-	    _bits = 32;
-	    _little_endian = true;
-	    break;
-	case SND_PCM_FORMAT_U16_BE:
-	    _type = UINT;
-	    _bits = 32;
-	    _little_endian = false;
-	    break;
+	case SND_PCM_FORMAT_FLOAT_LE: _format = BAMS_FLOATLE; break;
+	case SND_PCM_FORMAT_FLOAT_BE: _format = BAMS_FLOATBE; break;
+	case SND_PCM_FORMAT_S32_LE: _format = BAMS_S32LE; break;
+	case SND_PCM_FORMAT_S32_BE: _format = BAMS_S32BE; break;
+	case SND_PCM_FORMAT_S24_LE: _format = BAMS_S24LE4; break;
+	case SND_PCM_FORMAT_S24_BE: _format = BAMS_S24BE4; break;
+	case SND_PCM_FORMAT_S24_3LE: _format = BAMS_S24LE3; break;
+	case SND_PCM_FORMAT_S24_3BE: _format = BAMS_S24BE3; break;
+	case SND_PCM_FORMAT_S16_LE: _format = BAMS_S16LE; break;
+	case SND_PCM_FORMAT_S16_BE: _format = BAMS_S16BE; break;
+	case SND_PCM_FORMAT_U16_LE: _format = BAMS_U16LE; break;
+	case SND_PCM_FORMAT_U16_BE: _format = BAMS_U16BE; break;
 	case SND_PCM_FORMAT_UNKNOWN:
 	    emsg = QString("The audio card does not support any PCM audio formats"
 			   " that StretchPlayer supports");
@@ -207,36 +254,85 @@ namespace StretchPlayer
 	    assert(false);
 	}
 
+	_sample_bytes = snd_pcm_format_physical_width(format) / 8;
+	assert( int(_sample_bytes) == bams_format_bytes(_format) );
+	// Pick the converter now, not every period in the audio thread
+	_interleave = bams_interleaver(_format, _dither);
+	bams_dither_init(&_dither_state, (uint32_t)time(0));
+
 	if((err = snd_pcm_hw_params_set_format(_playback_handle, hw_params, format)) < 0) {
 	    emsg = QString("cannot set sample format (%1)")
 		.arg( snd_strerror(err) );
 	    goto init_bail;
 	}
 
-	if((err = snd_pcm_hw_params_set_rate_near(_playback_handle, hw_params, &_sample_rate, 0)) < 0) {
+	if( snd_pcm_hw_params_test_rate(_playback_handle, hw_params, _sample_rate, 0) ) {
+	    unsigned rate = _sample_rate;
+	    if((err = snd_pcm_hw_params_set_rate_near(_playback_handle, hw_params, &_sample_rate, 0)) < 0) {
+		emsg = QString("cannot set sample rate (%1)")
+		    .arg( snd_strerror(err) );
+		goto init_bail;
+	    }
+	    cerr << "WARNING: '" << device.toLocal8Bit().data() << "' can't play at "
+		 << rate << " Hz.  Using " << _sample_rate << " Hz instead." << endl;
+	} else if((err = snd_pcm_hw_params_set_rate(_playback_handle, hw_params, _sample_rate, 0)) < 0) {
 	    emsg = QString("cannot set sample rate (%1)")
 		.arg( snd_strerror(err) );
 	    goto init_bail;
 	}
 
 	if((err = snd_pcm_hw_params_set_channels(_playback_handle, hw_params, 2)) < 0) {
-	    emsg = QString("cannot set channel count (%1)")
-		.arg( snd_strerror(err) );
+	    unsigned cmin = 0, cmax = 0;
+	    snd_pcm_hw_params_get_channels_min(hw_params, &cmin);
+	    snd_pcm_hw_params_get_channels_max(hw_params, &cmax);
+	    emsg = QString("cannot set channel count to 2 (%1).  '%2' takes %3 to %4 channels.")
+		.arg( snd_strerror(err) )
+		.arg( device )
+		.arg( cmin )
+		.arg( cmax );
 	    goto init_bail;
 	}
 
-	if((err = snd_pcm_hw_params_set_periods_near(_playback_handle, hw_params, &nfrags, 0)) < 0) {
-	    emsg = QString("cannot set the period count (%1)")
-		.arg( snd_strerror(err) );
-	    goto init_bail;
-	}
+	if( _tsched ) {
+	    /* As deep as asked for, and as few interrupts as the
+	     * hardware allows, since nothing waits for them.
+	     */
+	    _tsched_shallow = _period_nframes * nfrags;
+	    _buffer_nframes = snd_pcm_uframes_t(_sample_rate) * config->alsa_tsched_buffer() / 1000;
+	    if((err = snd_pcm_hw_params_set_buffer_size_near(_playback_handle, hw_params, &_buffer_nframes)) < 0) {
+		emsg = QString("cannot set the buffer size to %1 ms (%2)")
+		    .arg( config->alsa_tsched_buffer() )
+		    .arg( snd_strerror(err) );
+		goto init_bail;
+	    }
+	    nfrags = 2;
+	    snd_pcm_hw_params_set_periods_near(_playback_handle, hw_params, &nfrags, 0);
+	} else {
+	    /* Hardware often only does some period sizes (powers
+	     * of 2, or multiples of the DMA burst).  Take the
+	     * closest, rather than failing or having a plugin
+	     * re-block the stream.
+	     */
+	    period_nframes = _period_nframes;
+	    if((err = snd_pcm_hw_params_set_period_size_near(_playback_handle, hw_params,
+							     &period_nframes, 0)) < 0) {
+		snd_pcm_uframes_t pmin = 0, pmax = 0;
+		snd_pcm_hw_params_get_period_size_min(hw_params, &pmin, 0);
+		snd_pcm_hw_params_get_period_size_max(hw_params, &pmax, 0);
+		emsg = QString("cannot set the period size to %1 (%2).  '%3' takes %4 to %5 frames.")
+		    .arg( _period_nframes )
+		    .arg( snd_strerror(err) )
+		    .arg( device )
+		    .arg( (unsigned long)pmin )
+		    .arg( (unsigned long)pmax );
+		goto init_bail;
+	    }
 
-	if((err = snd_pcm_hw_params_set_buffer_size(_playback_handle, hw_params, _period_nframes * nfrags)) < 0) {
-	    emsg = QString("cannot set the buffer size to %1 x %2 (%3)")
-		.arg( nfrags )
-		.arg( _period_nframes )
-		.arg( snd_strerror(err) );
-	    goto init_bail;
+	    if((err = snd_pcm_hw_params_set_periods_near(_playback_handle, hw_params, &nfrags, 0)) < 0) {
+		emsg = QString("cannot set the period count (%1)")
+		    .arg( snd_strerror(err) );
+		goto init_bail;
+	    }
 	}
 
 	if((err = snd_pcm_hw_params(_playback_handle, hw_params)) < 0) {
@@ -245,8 +341,31 @@ namespace StretchPlayer
 	    goto init_bail;
 	}
 
+	snd_pcm_hw_params_get_buffer_size(hw_params, &_buffer_nframes);
+	snd_pcm_hw_params_get_periods(hw_params, &nfrags, 0);
+	if( !_tsched ) {
+	    snd_pcm_hw_params_get_period_size(hw_params, &period_nframes, 0);
+	    _period_nframes = period_nframes;
+	}
 	snd_pcm_hw_params_free(hw_params);
 
+	if( !config->quiet() ) {
+	    cout << "ALSA: '" << device.toLocal8Bit().data() << "' "
+		 << snd_pcm_format_name(format) << ", "
+		 << _sample_rate << " Hz, "
+		 << nfrags << " x " << (_buffer_nframes / nfrags) << " frames"
+		 << (_mmap ? ", mmap" : "")
+		 << (_tsched ? ", tsched" : "")
+		 << (_dither ? ", dither" : "")
+		 << endl;
+	}
+
+	if( _tsched && (_buffer_nframes < 4 * _period_nframes) ) {
+	    cerr << "WARNING: The ALSA buffer is only " << _buffer_nframes
+		 << " frames.  Not using --tsched." << endl;
+	    _tsched = false;
+	}
+
 	/* Tell ALSA to wake us up whenever _period_nframes or more frames
 	 * of playback data can be delivered.  Also, tell ALSA
 	 * that we'll start the device ourselves.
@@ -275,22 +394,68 @@ namespace StretchPlayer
 		.arg( snd_strerror(err) );
 	    goto init_bail;
 	}
+	/* Timestamp each status with the same clock as
+	 * monotonic_now(), so the playback position can be
+	 * interpolated between periods.
+	 */
+	_htstamp = (snd_pcm_sw_params_set_tstamp_mode(_playback_handle, sw_params,
+						       SND_PCM_TSTAMP_ENABLE) == 0)
+	    && (snd_pcm_sw_params_set_tstamp_type(_playback_handle, sw_params,
+						  SND_PCM_TSTAMP_TYPE_MONOTONIC) == 0);
+
 	if((err = snd_pcm_sw_params(_playback_handle, sw_params)) < 0) {
 	    emsg = QString("cannot set software parameters (%1)")
 		.arg( snd_strerror(err) );
 	    goto init_bail;
 	}
 
-	size_t data_size;
+	if( _tsched ) {
+	    _timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	    _event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	    if( _timer_fd < 0 || _event_fd < 0 ) {
+		emsg = QString("cannot create the timer for --tsched (%1)")
+		    .arg( strerror(errno) );
+		goto init_bail;
+	    }
 
-	switch(_bits) {
-	case 8:  data_size = 1; break;
-	case 16: data_size = 2; break;
-	case 24: data_size = 4; break;
-	case 32: data_size = 4; break;
-	default: assert(false);
+	    /* Refill when a quarter is left.  After a rewind, keep
+	     * enough to cover the stretcher starting over (50 ms).
+	     */
+	    if( _tsched_shallow > _buffer_nframes )
+		_tsched_shallow = _buffer_nframes;
+	    _tsched_watermark = _buffer_nframes / 4;
+	    if( _tsched_watermark < 4 * _period_nframes )
+		_tsched_watermark = 4 * _period_nframes;
+	    _tsched_safety = _sample_rate / 20;
+	    if( _tsched_safety < 2 * _period_nframes )
+		_tsched_safety = 2 * _period_nframes;
+	    if( _tsched_safety > _tsched_watermark )
+		_tsched_safety = _tsched_watermark;
 	}
 
+	if( config->inputs() ) {
+	    if( _tsched ) {
+		cerr << "WARNING: Capture does not work with --tsched."
+		     << "  Not capturing." << endl;
+	    } else if( _open_capture(device, config->inputs(), &emsg) ) {
+		goto init_bail;
+	    } else if( !config->quiet() ) {
+		cout << "ALSA: capturing " << _capture_channels << " channels, "
+		     << snd_pcm_format_name(_capture_format) << endl;
+	    }
+	}
+
+	if((err = snd_pcm_status_malloc(&_status)) < 0) {
+	    emsg = QString("cannot allocate status structure (%1)")
+		.arg( snd_strerror(err) );
+	    goto init_bail;
+	}
+	_xruns.reset();
+
+	size_t data_size;
+
+	data_size = _sample_bytes;
+
 	_buf = _buf_root = new unsigned short[_period_nframes * _channels * data_size + 16];
 	_left = _left_root = new float[_period_nframes + 4];
 	_right = _right_root = new float[_period_nframes + 4];
@@ -332,6 +497,24 @@ namespace StretchPlayer
 	    snd_pcm_close(_playback_handle);
 	    _playback_handle = 0;
 	}
+	if(_capture_handle) {
+	    snd_pcm_close(_capture_handle);
+	    _capture_handle = 0;
+	}
+	_capture_channels = 0;
+	_capture_bufs.clear();
+	if(_status) {
+	    snd_pcm_status_free(_status);
+	    _status = 0;
+	}
+	if(_timer_fd >= 0) {
+	    close(_timer_fd);
+	    _timer_fd = -1;
+	}
+	if(_event_fd >= 0) {
+	    close(_event_fd);
+	    _event_fd = -1;
+	}
     }
 
     int AlsaAudioSystem::set_process_callback(process_callback_t cb, void* arg, QString* err_msg)
@@ -342,7 +525,7 @@ namespace StretchPlayer
 	return 0;
     }
 
-    int AlsaAudioSystem::set_segment_size_callback(process_callback_t, void*, QString*)
+    int AlsaAudioSystem::set_segment_size_callback(segment_size_callback_t, void*, QString*)
     {
 	// This API never changes the segment size automatically
     }
@@ -365,10 +548,36 @@ namespace StretchPlayer
     {
 	assert(_d);
 	_active = false;
+	if(_event_fd >= 0) {
+	    // Wake up _tsched_loop()
+	    uint64_t one = 1;
+	    ssize_t r = write(_event_fd, &one, sizeof(one));
+	    (void)r;
+	}
 	_d->wait();
 	return 0;
     }
 
+    uint32_t AlsaAudioSystem::output_count()
+    {
+	// The device is opened for stereo
+	return 2;
+    }
+
+    uint32_t AlsaAudioSystem::input_count()
+    {
+	return _capture_channels;
+    }
+
+    /**
+     * What was queued in the capture buffer (including any FIFO
+     * before it) when this period's input was read.
+     */
+    uint32_t AlsaAudioSystem::input_delay()
+    {
+	return _capture_delay;
+    }
+
     AudioSystem::sample_t* AlsaAudioSystem::output_buffer(int index)
     {
 	if(index == 0) {
@@ -398,12 +607,12 @@ namespace StretchPlayer
 
     uint32_t AlsaAudioSystem::time_stamp()
     {
-	return 0;
+	return _frames_written - buffered_frames();
     }
 
     uint32_t AlsaAudioSystem::segment_start_time_stamp()
     {
-	return 0;
+	return _segment_start;
     }
 
     uint32_t AlsaAudioSystem::current_segment_size()
@@ -411,6 +620,299 @@ namespace StretchPlayer
 	return _period_nframes;
     }
 
+    int AlsaAudioSystem::realtime_priority()
+    {
+	return RT_PRIORITY;
+    }
+
+    bool AlsaAudioSystem::freewheeling()
+    {
+	return false;
+    }
+
+    int AlsaAudioSystem::set_rewind_callback(rewind_callback_t cb, void* arg, QString* /*err_msg*/)
+    {
+	_rewind_callback = cb;
+	_rewind_callback_arg = arg;
+	return 0;
+    }
+
+    void AlsaAudioSystem::request_rewind()
+    {
+	if( !_tsched || _event_fd < 0 )
+	    return;
+	_rewind_requested.fetchAndStoreOrdered(1);
+	uint64_t one = 1;
+	ssize_t r = write(_event_fd, &one, sizeof(one));
+	(void)r;
+    }
+
+    uint32_t AlsaAudioSystem::buffered_frames()
+    {
+	double f = double(_delay)
+	    - (monotonic_now() - _delay_time) * double(_sample_rate);
+	return (f > 0.0) ? uint32_t(f) : 0;
+    }
+
+    uint32_t AlsaAudioSystem::output_delay()
+    {
+	// The status delay already counts the card's FIFO
+	return buffered_frames();
+    }
+
+    uint32_t AlsaAudioSystem::xrun_count()
+    {
+	return _xruns.count();
+    }
+
+    uint32_t AlsaAudioSystem::xruns_last_minute()
+    {
+	return _xruns.within(monotonic_now(), 60.0);
+    }
+
+    int AlsaAudioSystem::set_latency_callback(latency_callback_t, void*, QString*)
+    {
+	// Nobody to report it to
+	return 0;
+    }
+
+    void AlsaAudioSystem::latency_changed()
+    {
+    }
+
+    bool AlsaAudioSystem::transport_query(bool*, uint32_t*)
+    {
+	return false;
+    }
+
+    void AlsaAudioSystem::transport_start()
+    {
+    }
+
+    void AlsaAudioSystem::transport_stop()
+    {
+    }
+
+    void AlsaAudioSystem::transport_locate(uint32_t)
+    {
+    }
+
+    /**
+     * Read how much is queued in the device (including any FIFO
+     * after the DMA buffer), and when.  buffered_frames() and
+     * time_stamp() count down from there.  Called from the audio
+     * thread after each write.
+     */
+    void AlsaAudioSystem::_update_clock()
+    {
+	snd_htimestamp_t ts;
+	double t = 0.0;
+
+	if( snd_pcm_status(_playback_handle, _status) < 0 )
+	    return;
+	if( _htstamp ) {
+	    snd_pcm_status_get_htstamp(_status, &ts);
+	    t = double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
+	}
+	if( t == 0.0 ) {
+	    t = monotonic_now();
+	}
+	_delay = snd_pcm_status_get_delay(_status);
+	_delay_time = t;
+    }
+
+    static inline bool is_xrun(int err)
+    {
+	return (err == -EPIPE) || (err == -ESTRPIPE);
+    }
+
+    /**
+     * Open the capture side of device with the playback rate and
+     * period.  Only formats that SampleOps can deinterleave are
+     * taken.
+     */
+    int AlsaAudioSystem::_open_capture(const QString& device, unsigned channels, QString *emsg)
+    {
+	static const snd_pcm_format_t formats[] = {
+	    SND_PCM_FORMAT_FLOAT,
+	    SND_PCM_FORMAT_S32,
+	    SND_PCM_FORMAT_S16,
+	    SND_PCM_FORMAT_UNKNOWN
+	};
+	snd_pcm_hw_params_t *hw_params = 0;
+	snd_pcm_uframes_t period_nframes = _period_nframes;
+	snd_pcm_uframes_t buffer_nframes = _buffer_nframes;
+	unsigned k;
+	int err;
+
+	if((err = snd_pcm_open(&_capture_handle, device.toLocal8Bit().data(),
+			       SND_PCM_STREAM_CAPTURE, 0)) < 0) {
+	    *emsg = QString("cannot open ALSA audio device '%1' for capture (%2)")
+		.arg(device)
+		.arg(snd_strerror(err));
+	    goto capture_bail;
+	}
+
+	if((err = snd_pcm_hw_params_malloc(&hw_params)) < 0
+	   || (err = snd_pcm_hw_params_any(_capture_handle, hw_params)) < 0) {
+	    *emsg = QString("cannot initialize capture hardware parameters (%1)")
+		.arg( snd_strerror(err) );
+	    goto capture_bail;
+	}
+	snd_pcm_hw_params_set_rate_resample(_capture_handle, hw_params, 0);
+
+	if((err = snd_pcm_hw_params_set_access(_capture_handle, hw_params,
+					       SND_PCM_ACCESS_RW_INTERLEAVED)) < 0) {
+	    *emsg = QString("cannot set capture access type (%1)")
+		.arg( snd_strerror(err) );
+	    goto capture_bail;
+	}
+
+	_capture_format = SND_PCM_FORMAT_UNKNOWN;
+	for( k=0 ; formats[k] != SND_PCM_FORMAT_UNKNOWN ; ++k ) {
+	    if( snd_pcm_hw_params_test_format(_capture_handle, hw_params, formats[k]) == 0 ) {
+		_capture_format = formats[k];
+		break;
+	    }
+	}
+	if( _capture_format == SND_PCM_FORMAT_UNKNOWN ) {
+	    *emsg = QString("'%1' can't capture in float, 32-bit or 16-bit")
+		.arg(device);
+	    goto capture_bail;
+	}
+	snd_pcm_hw_params_set_format(_capture_handle, hw_params, _capture_format);
+
+	// Has to match playback exactly, or the take will drift.
+	if((err = snd_pcm_hw_params_set_rate(_capture_handle, hw_params, _sample_rate, 0)) < 0) {
+	    *emsg = QString("cannot capture at %1 Hz (%2)")
+		.arg(_sample_rate)
+		.arg( snd_strerror(err) );
+	    goto capture_bail;
+	}
+
+	if((err = snd_pcm_hw_params_set_channels(_capture_handle, hw_params, channels)) < 0) {
+	    *emsg = QString("cannot set capture channel count to %1 (%2)")
+		.arg(channels)
+		.arg( snd_strerror(err) );
+	    goto capture_bail;
+	}
+
+	snd_pcm_hw_params_set_period_size_near(_capture_handle, hw_params, &period_nframes, 0);
+	snd_pcm_hw_params_set_buffer_size_near(_capture_handle, hw_params, &buffer_nframes);
+
+	if((err = snd_pcm_hw_params(_capture_handle, hw_params)) < 0) {
+	    *emsg = QString("cannot set capture parameters (%1)")
+		.arg( snd_strerror(err) );
+	    goto capture_bail;
+	}
+	snd_pcm_hw_params_free(hw_params);
+	hw_params = 0;
+
+	_capture_channels = channels;
+	_capture_raw.resize( _period_nframes * channels
+			     * (snd_pcm_format_physical_width(_capture_format) / 8) );
+	_capture_data.assign( _period_nframes * channels, 0.0f );
+	_capture_bufs.resize(channels);
+	for( k=0 ; k<channels ; ++k ) {
+	    _capture_bufs[k] = &_capture_data[k * _period_nframes];
+	}
+	_capture_delay = 0;
+	return 0;
+
+    capture_bail:
+	if(hw_params) {
+	    snd_pcm_hw_params_free(hw_params);
+	}
+	return 0xDEADBEEF;
+    }
+
+    /**
+     * Read this period's input into _capture_bufs.
+     *
+     * The capture stream is started as soon as playback is running,
+     * and is only read when a whole period is waiting, so this
+     * never blocks.  How far apart the two streams are is measured
+     * every period (_capture_delay), rather than assumed, so it's
+     * fine for them to start a little apart, or for one of them to
+     * be restarted after an xrun.
+     *
+     * \return true if there is input for this period.
+     */
+    bool AlsaAudioSystem::_read_capture(uint32_t nframes)
+    {
+	snd_pcm_sframes_t avail, delay, n;
+	char *raw = &_capture_raw[0];
+	float * const *dst = &_capture_bufs[0];
+
+	switch( snd_pcm_state(_capture_handle) ) {
+	case SND_PCM_STATE_RUNNING:
+	    break;
+	case SND_PCM_STATE_PREPARED:
+	    if( snd_pcm_state(_playback_handle) == SND_PCM_STATE_RUNNING ) {
+		snd_pcm_start(_capture_handle);
+	    }
+	    return false;
+	case SND_PCM_STATE_XRUN:
+	    _xruns.add( monotonic_now() );
+	    // Fall through
+	default:
+	    snd_pcm_prepare(_capture_handle);
+	    return false;
+	}
+
+	avail = snd_pcm_avail_update(_capture_handle);
+	if( avail < snd_pcm_sframes_t(nframes) ) {
+	    if( avail < 0 ) {
+		snd_pcm_recover(_capture_handle, avail, 1);
+	    }
+	    return false;
+	}
+
+	if( snd_pcm_delay(_capture_handle, &delay) == 0 && delay >= 0 ) {
+	    _capture_delay = delay;
+	}
+
+	n = snd_pcm_readi(_capture_handle, raw, nframes);
+	if( n != snd_pcm_sframes_t(nframes) ) {
+	    if( n < 0 ) {
+		snd_pcm_recover(_capture_handle, n, 1);
+	    }
+	    return false;
+	}
+
+	switch( _capture_format ) {
+	case SND_PCM_FORMAT_FLOAT:
+	    deinterleave(reinterpret_cast<const float*>(raw), nframes, _capture_channels, dst);
+	    break;
+	case SND_PCM_FORMAT_S32:
+	    deinterleave(reinterpret_cast<const int32_t*>(raw), nframes, _capture_channels, dst);
+	    break;
+	default:
+	    deinterleave(reinterpret_cast<const int16_t*>(raw), nframes, _capture_channels, dst);
+	}
+	return true;
+    }
+
+    /**
+     * Get the device going again after an xrun (-EPIPE) or a
+     * suspend (-ESTRPIPE).  Xruns are counted.  What was queued is
+     * lost, and the stream restarts with the next write.
+     *
+     * \return 0 if recovered, or a negative ALSA error code.
+     */
+    int AlsaAudioSystem::_recover(int err)
+    {
+	if( err == -EPIPE ) {
+	    _xruns.add( monotonic_now() );
+	}
+	if((err = snd_pcm_recover(_playback_handle, err, 1)) < 0) {
+	    return err;
+	}
+	_delay = 0;
+	_delay_time = monotonic_now();
+	return 0;
+    }
+
     static inline unsigned long calc_elapsed(const timeval& a, const timeval& b)
     {
 	unsigned long ans;
@@ -468,16 +970,27 @@ namespace StretchPlayer
 	int err;
 	snd_pcm_sframes_t frames_to_deliver;
 	uint32_t f;
+	sample_t *outs[2] = { _left, _right };
+	cycle_t cycle;
 	const char *err_msg, *str_err;
 	const int misc_msg_size = 256;
 	char misc_msg[misc_msg_size] = "";
 
 	assert(_active);
+	cycle.outputs = 2;
+	cycle.out = outs;
+	cycle.inputs = 0;
+	cycle.in = _capture_bufs.empty() ? 0 : &_capture_bufs[0];
 
 	// Set RT priority
 	sched_param thread_sched_param;
-	thread_sched_param.sched_priority = 80;
-	pthread_setschedparam( pthread_self(), SCHED_FIFO, &thread_sched_param );
+	thread_sched_param.sched_priority = RT_PRIORITY;
+	err = pthread_setschedparam( pthread_self(), SCHED_FIFO, &thread_sched_param );
+	if(err) {
+	    cerr << "WARNING: Could not set SCHED_FIFO priority " << RT_PRIORITY
+		 << " for the ALSA audio thread (" << strerror(err) << ")."
+		 << "  Running with normal priority." << endl;
+	}
 
 	err = 0;
 
@@ -491,48 +1004,68 @@ namespace StretchPlayer
 	    goto run_bail;
 	}
 
+	_frames_written = 0;
+	_segment_start = 0;
+	_delay = 0;
+	_delay_time = monotonic_now();
+
 	_stopwatch_init();
+
+	if(_tsched) {
+	    if( _tsched_loop(&err_msg, &str_err) )
+		goto run_bail;
+	    _active = false;
+	    return;
+	}
+
 	while(_active) {
 	    assert(_callback);
 
 	    _stopwatch_start_idle();
 	    if((err = snd_pcm_wait(_playback_handle, 1000)) < 0) {
+		if( is_xrun(err) && (err = _recover(err)) == 0 )
+		    continue;
 		err_msg = "Audio poll failed [snd_pcm_wait()].";
-		str_err = strerror(errno);
+		str_err = snd_strerror(err);
 		goto run_bail;
 	    }
 
 	    _stopwatch_start_work();
 	    if((frames_to_deliver = snd_pcm_avail_update(_playback_handle)) < 0) {
-		if(frames_to_deliver == -EPIPE) {
-		    /* An XRUN Occurred.  Ignoring. */
-		} else {
-		    err_msg = "Unknown ALSA snd_pcm_avail_update return value [snd_pcm_avail_update()].";
-		    snprintf(misc_msg, misc_msg_size, "%ld", frames_to_deliver);
-		    str_err = misc_msg;
-		    goto run_bail;
-		}
+		err = frames_to_deliver;
+		if( is_xrun(err) && (err = _recover(err)) == 0 )
+		    continue;
+		err_msg = "Unknown ALSA snd_pcm_avail_update return value [snd_pcm_avail_update()].";
+		snprintf(misc_msg, misc_msg_size, "%d", err);
+		str_err = misc_msg;
+		goto run_bail;
 	    }
 
 	    if(frames_to_deliver < _period_nframes) continue;
 
-	    frames_to_deliver = frames_to_deliver > _period_nframes ? _period_nframes : frames_to_deliver;
+	    frames_to_deliver = _period_nframes;
 
-	    assert( 0 == ((frames_to_deliver-1)&frames_to_deliver) );  // is power of 2.
-
-	    if( _callback(frames_to_deliver, _callback_arg) != 0 ) {
+	    _segment_start = _frames_written;
+	    cycle.nframes = frames_to_deliver;
+	    if( _capture_handle ) {
+		cycle.inputs = _read_capture(frames_to_deliver) ? _capture_channels : 0;
+	    }
+	    if( _callback(cycle, _callback_arg) != 0 ) {
 		err_msg = "Application's audio callback failed.";
 		str_err = 0;
 		goto run_bail;
 	    }
+	    _frames_written += frames_to_deliver;
 
-	    _convert_to_output(frames_to_deliver);
-
-	    if((err = snd_pcm_writei(_playback_handle, _buf, frames_to_deliver)) < 0) {
-		err_msg = "Write to audio card failed [snd_pcm_writei()].";
+	    if((err = _write(frames_to_deliver)) < 0) {
+		if( is_xrun(err) && (err = _recover(err)) == 0 )
+		    continue;
+		err_msg = _mmap ? "Write to audio card failed [snd_pcm_mmap_commit()]."
+		    : "Write to audio card failed [snd_pcm_writei()].";
 		str_err = snd_strerror(err);
 		goto run_bail;
 	    }
+	    _update_clock();
 
 	}
 
@@ -556,104 +1089,261 @@ namespace StretchPlayer
     }
 
     /**
-     * \brief Convert, copy, and interleave _left and _right to _buf;
+     * Main loop for timer-scheduled (--tsched) mode.
+     *
+     * Each pass handles a rewind request, tops the buffer up to the
+     * target fill level one period at a time, and then sleeps on a
+     * timer until the fill level should have dropped to the
+     * watermark (or until request_rewind() wakes it).
+     *
+     * It starts out shallow (periods_per_buffer periods, woken every
+     * period) until it has seen that the device can rewind.  If it
+     * can't, it stays that way, since a deep buffer that can't be
+     * rewound would make every change take seconds to be heard.
+     *
+     * \return 0 when deactivated, nonzero on error (with err_msg and
+     * str_err set).
      */
-    void AlsaAudioSystem::_convert_to_output(uint32_t nframes)
+    int AlsaAudioSystem::_tsched_loop(const char **err_msg, const char **str_err)
     {
-	switch(_type) {
-	case INT: _convert_to_output_int(nframes); break;
-	case UINT: _convert_to_output_uint(nframes); break;
-	case FLOAT: _convert_to_output_float(nframes); break;
-	default: assert(false);
+	snd_pcm_sframes_t avail, rewound;
+	snd_pcm_uframes_t fill, target, watermark;
+	bool probed = false, can_rewind = false, restart;
+	sample_t *outs[2] = { _left, _right };
+	cycle_t cycle;
+	int err;
+
+	cycle.outputs = 2;
+	cycle.out = outs;
+	cycle.inputs = 0;
+	cycle.in = 0;
+	target = _tsched_shallow;
+	watermark = target - _period_nframes;
+
+	while(_active) {
+	    _stopwatch_start_work();
+
+	    if( _rewind_requested.fetchAndStoreOrdered(0) && can_rewind ) {
+		rewound = _tsched_rewind();
+		if( rewound > 0 ) {
+		    _frames_written -= rewound;
+		    _update_clock();
+		    if( _rewind_callback ) {
+			_rewind_callback(rewound, _rewind_callback_arg);
+		    }
+		}
+	    }
+
+	    if((avail = snd_pcm_avail_update(_playback_handle)) < 0) {
+		if( !is_xrun(avail) ) {
+		    *err_msg = "Unknown ALSA snd_pcm_avail_update return value [snd_pcm_avail_update()].";
+		    *str_err = snd_strerror(avail);
+		    return avail;
+		}
+		/* An XRUN Occurred.  Start over. */
+		if((err = _recover(avail)) < 0) {
+		    *err_msg = "Cannot recover from an xrun [snd_pcm_recover()].";
+		    *str_err = snd_strerror(err);
+		    return err;
+		}
+		avail = _buffer_nframes;
+	    }
+	    fill = (snd_pcm_uframes_t(avail) < _buffer_nframes) ? _buffer_nframes - avail : 0;
+	    _update_clock();
+
+	    restart = false;
+	    while( _active && (fill + _period_nframes <= target) ) {
+		_segment_start = _frames_written;
+		cycle.nframes = _period_nframes;
+		if( _callback(cycle, _callback_arg) != 0 ) {
+		    *err_msg = "Application's audio callback failed.";
+		    *str_err = 0;
+		    return -1;
+		}
+		_frames_written += _period_nframes;
+		if((err = _write(_period_nframes)) < 0) {
+		    if( is_xrun(err) && (err = _recover(err)) == 0 ) {
+			restart = true;
+			break;
+		    }
+		    *err_msg = _mmap ? "Write to audio card failed [snd_pcm_mmap_commit()]."
+			: "Write to audio card failed [snd_pcm_writei()].";
+		    *str_err = snd_strerror(err);
+		    return err;
+		}
+		fill += _period_nframes;
+		_update_clock();
+	    }
+	    if( restart ) {
+		continue; // Start over with an empty buffer
+	    }
+
+	    if( !probed ) {
+		probed = true;
+		if( snd_pcm_rewindable(_playback_handle) > 0 ) {
+		    can_rewind = true;
+		    target = _buffer_nframes;
+		    watermark = _tsched_watermark;
+		    continue; // Fill the rest now
+		}
+		cerr << "WARNING: The ALSA device can't rewind.  Waking every"
+		     << " period instead of using --tsched." << endl;
+	    }
+
+	    _stopwatch_start_idle();
+	    _tsched_sleep( (fill > watermark) ? (fill - watermark) : 0 );
 	}
+	return 0;
     }
 
-    void AlsaAudioSystem::_convert_to_output_int(uint32_t nframes)
+    /**
+     * Throw away all but _tsched_safety frames of the unplayed
+     * audio.
+     *
+     * \return the number of frames rewound.
+     */
+    snd_pcm_sframes_t AlsaAudioSystem::_tsched_rewind()
     {
-	switch(_bits) {
-	case 16: {
-	    bams_sample_s16le_t *dst = (bams_sample_s16le_t*)_buf;
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-	    if(_little_endian) {
-		bams_copy_s16le_floatle(dst, 2, &_left[0], 1, nframes);
-		bams_copy_s16le_floatle(dst+1, 2, &_right[0], 1, nframes);
-	    } else {
-		bams_copy_s16be_floatle(dst, 2, &_left[0], 1, nframes);
-		bams_copy_s16be_floatle(dst+1, 2, &_right[0], 1, nframes);
-	    }
-#else
-	    if(_little_endian) {
-		bams_copy_s16le_floatbe(dst, 2, &_left[0], 1, nframes);
-		bams_copy_s16le_floatbe(dst+1, 2, &_right[0], 1, nframes);
-	    } else {
-		bams_copy_s16be_floatbe(dst, 2, &_left[0], 1, nframes);
-		bams_copy_s16be_floatbe(dst+1, 2, &_right[0], 1, nframes);
-	    }
-#endif
-	}   break;
-	case 8:
-	case 24:
-	case 32:
-	default:
-	    assert(false);
+	snd_pcm_sframes_t rewindable, rewound;
+
+	rewindable = snd_pcm_rewindable(_playback_handle);
+	if( rewindable <= snd_pcm_sframes_t(_tsched_safety) )
+	    return 0;
+	rewound = snd_pcm_rewind(_playback_handle, rewindable - _tsched_safety);
+	return (rewound > 0) ? rewound : 0;
+    }
+
+    /**
+     * Sleep for nframes worth of time, or until request_rewind() or
+     * deactivate() pokes the event fd.
+     */
+    void AlsaAudioSystem::_tsched_sleep(snd_pcm_uframes_t nframes)
+    {
+	itimerspec its;
+	pollfd pfds[2];
+	uint64_t junk;
+	ssize_t r;
+	long long nsecs = (long long)nframes * 1000000000LL / _sample_rate;
+
+	if( nsecs < 1000 ) nsecs = 1000; // 0 would disarm the timer
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = nsecs / 1000000000LL;
+	its.it_value.tv_nsec = nsecs % 1000000000LL;
+	timerfd_settime(_timer_fd, 0, &its, 0);
+
+	pfds[0].fd = _timer_fd;
+	pfds[0].events = POLLIN;
+	pfds[1].fd = _event_fd;
+	pfds[1].events = POLLIN;
+	poll(pfds, 2, 1000);
+
+	// Both are non-blocking.  Just clear them.
+	r = read(_timer_fd, &junk, sizeof(junk));
+	r = read(_event_fd, &junk, sizeof(junk));
+	(void)r;
+    }
+
+    /**
+     * Deliver nframes from _left/_right to the device.
+     *
+     * \return 0 on success, or a negative ALSA error code.
+     */
+    int AlsaAudioSystem::_write(uint32_t nframes)
+    {
+	snd_pcm_sframes_t err;
+
+	if(_mmap) {
+	    return _write_mmap(nframes);
+	}
+
+	_convert_to_output((char*)_buf, (char*)_buf + _sample_bytes, 2, 0, nframes);
+	if((err = snd_pcm_writei(_playback_handle, _buf, nframes)) < 0) {
+	    return err;
 	}
+	return 0;
     }
 
-    void AlsaAudioSystem::_convert_to_output_uint(uint32_t nframes)
+    /**
+     * \brief Convert nframes straight into the mmap'ed DMA buffer.
+     *
+     * The free part of the buffer may wrap around its end, so this
+     * can take more than one begin/commit.
+     *
+     * \return 0 on success, or a negative ALSA error code.
+     */
+    int AlsaAudioSystem::_write_mmap(uint32_t nframes)
     {
-	switch(_bits) {
-	case 16: {
-	    bams_sample_u16le_t *dst = (bams_sample_u16le_t*)_buf;
-#if __BYTE_ORDER == __LITTLE_ENDIAN
-	    if(_little_endian) {
-		bams_copy_u16le_floatle(dst, 2, &_left[0], 1, nframes);
-		bams_copy_u16le_floatle(dst+1, 2, &_right[0], 1, nframes);
-	    } else {
-		bams_copy_u16be_floatle(dst, 2, &_left[0], 1, nframes);
-		bams_copy_u16be_floatle(dst+1, 2, &_right[0], 1, nframes);
+	const snd_pcm_channel_area_t *areas;
+	snd_pcm_uframes_t offset, frames;
+	snd_pcm_sframes_t committed;
+	uint32_t done = 0;
+	char *dst_left, *dst_right;
+	int err;
+
+	while( done < nframes ) {
+	    frames = nframes - done;
+	    if((err = snd_pcm_mmap_begin(_playback_handle, &areas, &offset, &frames)) < 0) {
+		return err;
 	    }
-#else
-	    if(_little_endian) {
-		bams_copy_u16le_floatbe(dst, 2, &_left[0], 1, nframes);
-		bams_copy_u16le_floatbe(dst+1, 2, &_right[0], 1, nframes);
-	    } else {
-		bams_copy_u16be_floatbe(dst, 2, &_left[0], 1, nframes);
-		bams_copy_u16be_floatbe(dst+1, 2, &_right[0], 1, nframes);
+	    if(frames == 0) {
+		return -EPIPE;
 	    }
-#endif
-	}   break;
-	case 8:
-	case 24:
-	case 32:
-	default:
-	    assert(false);
+
+	    // step and first are in bits.
+	    assert( areas[0].step == areas[1].step );
+	    assert( (areas[0].step % (8 * _sample_bytes)) == 0 );
+	    dst_left = (char*)areas[0].addr + (areas[0].first + offset * areas[0].step) / 8;
+	    dst_right = (char*)areas[1].addr + (areas[1].first + offset * areas[1].step) / 8;
+	    _convert_to_output(dst_left, dst_right, areas[0].step / (8 * _sample_bytes),
+			       done, frames);
+
+	    committed = snd_pcm_mmap_commit(_playback_handle, offset, frames);
+	    if(committed < 0) {
+		return committed;
+	    }
+	    if(snd_pcm_uframes_t(committed) != frames) {
+		return -EPIPE;
+	    }
+	    done += frames;
 	}
+
+	/* Unlike snd_pcm_writei(), committing doesn't start the
+	 * stream.
+	 */
+	if(snd_pcm_state(_playback_handle) == SND_PCM_STATE_PREPARED) {
+	    if((err = snd_pcm_start(_playback_handle)) < 0) {
+		return err;
+	    }
+	}
+	return 0;
     }
 
-    void AlsaAudioSystem::_convert_to_output_float(uint32_t nframes)
+    /**
+     * \brief Convert and copy _left and _right (starting at offset) to
+     * the output.
+     *
+     * dst_left and dst_right point to the first sample of each
+     * channel, and stride is the distance between frames in samples
+     * (2 for an interleaved stereo buffer).
+     */
+    void AlsaAudioSystem::_convert_to_output(char *dst_left, char *dst_right, int stride,
+					     uint32_t offset, uint32_t nframes)
     {
-	float *out, *l, *r;
-	uint32_t f, count;
-	assert(_bits == 32);
-	assert(_little_endian);
-	out = (float*)_buf;
-	l = &_left[0];
-	r = &_right[0];
-	count = nframes;
-	while(count--) {
-	    (*out++) = (*l++);
-	    (*out++) = (*r++);
-	}
-	/* Check for non-native byte ordering */
+	float *l = &_left[offset];
+	float *r = &_right[offset];
+
+	if( (stride == 2) && (dst_right == dst_left + _sample_bytes) ) {
+	    // Plain interleaved stereo: convert both channels in one pass.
+	    _interleave(dst_left, l, r, nframes, &_dither_state);
+	} else {
 #if __BYTE_ORDER == __LITTLE_ENDIAN
-	if(!_little_endian) {
-	    bams_byte_reorder_in_place(_buf, 4, 1, 2*nframes);
-	}
+	    bams_copy_floatle(_format, dst_left, stride, l, nframes);
+	    bams_copy_floatle(_format, dst_right, stride, r, nframes);
 #else
-	if(_little_endian) {
-	    bams_byte_reorder_in_place(_buf, 4, 1, 2*nframes);
-	}	    
+	    bams_copy_floatbe(_format, dst_left, stride, l, nframes);
+	    bams_copy_floatbe(_format, dst_right, stride, r, nframes);
 #endif
+	}
     }
 
 } // namespace StretchPlayer
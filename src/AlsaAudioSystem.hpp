@@ -21,7 +21,11 @@
 
 #include <AudioSystem.hpp>
 #include <alsa/asoundlib.h>
+#include "bams_format.h"
+#include "XrunLog.hpp"
 #include <sys/time.h>
+#include <QAtomicInt>
+#include <vector>
 
 namespace StretchPlayer
 {
@@ -46,6 +50,9 @@ namespace StretchPlayer
 	virtual int set_segment_size_callback(segment_size_callback_t cb, void* arg, QString* err_msg = 0);
 	virtual int activate(QString *err_msg = 0);
 	virtual int deactivate(QString *err_msg = 0);
+	virtual uint32_t output_count();
+	virtual uint32_t input_count();
+	virtual uint32_t input_delay();
 	virtual sample_t* output_buffer(int index);
 	virtual uint32_t output_buffer_size(int index);
 	virtual uint32_t sample_rate();
@@ -53,16 +60,37 @@ namespace StretchPlayer
 	virtual uint32_t time_stamp();
 	virtual uint32_t segment_start_time_stamp();
 	virtual uint32_t current_segment_size();
+	virtual int realtime_priority();
+	virtual bool freewheeling();
+	virtual int set_rewind_callback(rewind_callback_t cb, void* arg, QString* err_msg = 0);
+	virtual void request_rewind();
+	virtual uint32_t buffered_frames();
+	virtual uint32_t output_delay();
+	virtual uint32_t xrun_count();
+	virtual uint32_t xruns_last_minute();
+	virtual int set_latency_callback(latency_callback_t cb, void* arg, QString* err_msg = 0);
+	virtual void latency_changed();
+	virtual bool transport_query(bool *rolling, uint32_t *frame);
+	virtual void transport_start();
+	virtual void transport_stop();
+	virtual void transport_locate(uint32_t frame);
 
     private:
 	static void run(AlsaAudioSystem *that) {
 	    that->_run();
 	}
 	void _run();
-	void _convert_to_output(uint32_t nframes);
-	void _convert_to_output_int(uint32_t nframes);
-	void _convert_to_output_uint(uint32_t nframes);
-	void _convert_to_output_float(uint32_t nframes);
+	int _tsched_loop(const char **err_msg, const char **str_err);
+	snd_pcm_sframes_t _tsched_rewind();
+	void _tsched_sleep(snd_pcm_uframes_t nframes);
+	void _update_clock();
+	int _recover(int err);
+	int _write(uint32_t nframes);
+	int _write_mmap(uint32_t nframes);
+	int _open_capture(const QString& device, unsigned channels, QString *emsg);
+	bool _read_capture(uint32_t nframes);
+	void _convert_to_output(char *dst_left, char *dst_right, int stride,
+				uint32_t offset, uint32_t nframes);
 
 	void _stopwatch_init();
 	void _stopwatch_start_idle();
@@ -72,9 +100,12 @@ namespace StretchPlayer
     private:
 	// Configuration variables:
 	unsigned _channels;
-	enum { INT, UINT, FLOAT } _type;
-	unsigned _bits;
-	bool _little_endian;
+	bams_format_t _format; // Device sample format
+	unsigned _sample_bytes; // Physical size of one sample
+	bool _dither; // TPDF dither (integer formats only)
+	bams_interleave_t _interleave; // Converter for _format and _dither
+	bams_dither_t _dither_state;
+	bool _mmap; // Write straight into the DMA buffer
 	uint32_t _sample_rate;
 	uint32_t _period_nframes;
 
@@ -85,8 +116,51 @@ namespace StretchPlayer
 	float *_left, *_right;
 	unsigned short *_buf_root, *_buf;
 
+	/* Capture (see _read_capture()).  A second PCM on the same
+	 * device, read once per period just before the process
+	 * callback.  Not available with --tsched.
+	 */
+	snd_pcm_t *_capture_handle;
+	unsigned _capture_channels;
+	snd_pcm_format_t _capture_format; // FLOAT, S32 or S16 (native)
+	std::vector<char> _capture_raw; // One period, interleaved
+	std::vector<float> _capture_data; // One period per channel
+	std::vector<sample_t*> _capture_bufs; // Into _capture_data
+	volatile uint32_t _capture_delay; // See input_delay()
+
 	process_callback_t _callback;
 	void *_callback_arg;
+	rewind_callback_t _rewind_callback;
+	void *_rewind_callback_arg;
+
+	/* Timer-scheduled mode (see _tsched_loop()).  Instead of
+	 * waking every period, keep the (large) hardware buffer
+	 * nearly full and sleep on a timer until it drains to the
+	 * watermark.  Changes are made audible quickly by rewinding
+	 * the unplayed part of the buffer.
+	 */
+	bool _tsched;
+	snd_pcm_uframes_t _buffer_nframes; // Actual hardware buffer size
+	snd_pcm_uframes_t _tsched_shallow; // Fill level until rewind is known to work
+	snd_pcm_uframes_t _tsched_watermark; // Refill at this fill level
+	snd_pcm_uframes_t _tsched_safety; // Never rewind past this
+	int _timer_fd;
+	int _event_fd; // Poked by request_rewind()
+	QAtomicInt _rewind_requested;
+
+	/* Output clock (see _update_clock()).  Frames are counted
+	 * from activate(), as the process callback produced them.
+	 */
+	snd_pcm_status_t *_status;
+	bool _htstamp; // _status has usable CLOCK_MONOTONIC timestamps
+	volatile uint32_t _frames_written;
+	volatile uint32_t _segment_start;
+	volatile snd_pcm_sframes_t _delay; // Queued in the device...
+	volatile double _delay_time;       // ...at this time
+	XrunLog _xruns;
+
+	// SCHED_FIFO priority of the audio thread
+	enum { RT_PRIORITY = 80 };
 
 	// DSP Load estimation
 	enum { DSP_AVG_SIZE = 32 };
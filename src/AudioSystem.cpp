@@ -27,6 +27,7 @@
 #ifdef AUDIO_SUPPORT_ALSA
 #include "AlsaAudioSystem.hpp"
 #endif
+#include "NullAudioSystem.hpp"
 
 namespace StretchPlayer
 {
@@ -45,6 +46,9 @@ namespace StretchPlayer
 	    d = new AlsaAudioSystem;
 	    break;
 #endif
+	case Configuration::NullDriver:
+	    d = new NullAudioSystem;
+	    break;
 	default:
 	    throw std::runtime_error("Unsupported driver requested");
 	}
@@ -30,16 +30,31 @@ namespace StretchPlayer
     /**
      * \brief Pure virtual interface to an audio driver API.
      *
-     * This AudioSystem assumes a very simple system with two audio
-     * outputs.  It maintains those ports and buffers and the
-     * connection of them.
+     * This AudioSystem has output_count() audio outputs, at least
+     * two (0 is left and 1 is right).  It maintains those ports and
+     * buffers and the connection of them.
      */
     class AudioSystem
     {
     public:
 	typedef float sample_t;
-	typedef int (*process_callback_t)(uint32_t nframes, void *arg);
+
+	/**
+	 * What the process() callback works on, resolved once by the
+	 * driver at the top of each cycle.
+	 */
+	struct cycle_t {
+	    uint32_t nframes;        // Frames to make this cycle
+	    uint32_t outputs;        // output_count()
+	    sample_t * const *out;   // Output buffers [0..outputs-1]
+	    uint32_t inputs;         // input_count(), or 0 if no input this cycle
+	    const sample_t * const *in; // Captured audio [0..inputs-1]
+	};
+
+	typedef int (*process_callback_t)(const cycle_t& cycle, void *arg);
 	typedef int (*segment_size_callback_t)(uint32_t nframes, void *arg);
+	typedef int (*rewind_callback_t)(uint32_t nframes, void *arg);
+	typedef uint32_t (*latency_callback_t)(void *arg);
 
 	virtual ~AudioSystem() {}
 
@@ -87,6 +102,59 @@ namespace StretchPlayer
 	 */
 	virtual int set_segment_size_callback(segment_size_callback_t cb, void* arg, QString* err_msg = 0) = 0;
 
+	/**
+	 * Set the rewind callback function.
+	 *
+	 * Called from the audio thread, between process() callbacks,
+	 * when the driver has thrown away the last nframes frames of
+	 * output that had not been played yet.  The next process()
+	 * callback continues from where those frames started.
+	 */
+	virtual int set_rewind_callback(rewind_callback_t cb, void* arg, QString* err_msg = 0) = 0;
+
+	/**
+	 * Ask the driver to throw away as much queued output as it
+	 * safely can, so that a change (speed, volume, locate...) is
+	 * heard right away. [RT SAFE, any thread]
+	 *
+	 * Drivers that don't queue more than a period or two ignore
+	 * this.
+	 */
+	virtual void request_rewind() = 0;
+
+	/**
+	 * Frames that have been handed to the driver but not played
+	 * yet (approximate).  Only meaningful for drivers that buffer
+	 * far ahead; others may return 0.  [RT SAFE, any thread]
+	 */
+	virtual uint32_t buffered_frames() = 0;
+
+	/**
+	 * Set the latency callback function.
+	 *
+	 * It returns how many frames the application's output runs
+	 * behind the audio that it is made from (e.g. the stretcher
+	 * and its rings).  Drivers that can tell the rest of the
+	 * system (other JACK clients) call it when they need to, not
+	 * necessarily from the audio thread.  Others may ignore it.
+	 */
+	virtual int set_latency_callback(latency_callback_t cb, void* arg, QString* err_msg = 0) = 0;
+
+	/**
+	 * The value that the latency callback returns has changed,
+	 * so report it again.  Not RT safe.
+	 */
+	virtual void latency_changed() = 0;
+
+	/**
+	 * Frames between the last one that process() produced and
+	 * the one being heard now: what the driver has queued plus
+	 * any latency after it (other JACK clients, the sound card).
+	 * Unlike buffered_frames(), this is not time that the
+	 * process() callback may take.  [RT SAFE, any thread]
+	 */
+	virtual uint32_t output_delay() = 0;
+
 	/**
 	 * Activate the driver (may start processing audio).
 	 *
@@ -101,11 +169,34 @@ namespace StretchPlayer
 	 */
 	virtual int deactivate(QString *err_msg = 0) = 0;
 
+	/**
+	 * Number of outputs (at least 2).  Fixed from init() on.
+	 */
+	virtual uint32_t output_count() = 0;
+
+	/**
+	 * Number of capture inputs, or 0 if not capturing.  Fixed
+	 * from init() on.
+	 */
+	virtual uint32_t input_count() = 0;
+
+	/**
+	 * Frames between a sound reaching the inputs and the start
+	 * of the cycle whose cycle_t::in has it as frame 0 (converter,
+	 * driver buffering, and any latency before us in the graph).
+	 * With output_delay() this is the round trip that lines a
+	 * recording up with what the player was hearing.  [RT SAFE,
+	 * any thread]
+	 */
+	virtual uint32_t input_delay() = 0;
+
 	/**
 	 * Returns a pointer to the output buffer. [RT SAFE]
 	 *
-	 * index is 0 for Left, 1 for Right.  Any others will return a
-	 * null pointer.
+	 * index is 0 for Left, 1 for Right, and so on up to
+	 * output_count() - 1.  Any others will return a null
+	 * pointer.  The process() callback should use the buffers in
+	 * its cycle_t instead.
 	 *
 	 * \returns pointer to buffer, or null pointer if the buffer
 	 * does not exist.
@@ -130,6 +221,10 @@ namespace StretchPlayer
 	/**
 	 * Returns a timestamp of the current output, in audio frames.
 	 *
+	 * Frames are counted from when the driver started.  Drivers
+	 * that queue output report the frame being played now, which
+	 * is behind segment_start_time_stamp() by what is queued.
+	 *
 	 * \return Approximate frame of current audio output.
 	 */
 	virtual uint32_t time_stamp() = 0;
@@ -146,6 +241,56 @@ namespace StretchPlayer
 	 *
 	 */
 	virtual uint32_t current_segment_size() = 0;
+
+	/**
+	 * Returns the SCHED_FIFO priority of the thread that calls the
+	 * process() callback.
+	 *
+	 * \return priority, or -1 if the thread is not real-time.
+	 */
+	virtual int realtime_priority() = 0;
+
+	/**
+	 * True if the process() callback is not tied to a clock
+	 * (e.g. rendering faster than real time).  The application
+	 * should then take as long as it needs to fill each buffer
+	 * instead of outputting silence when it falls behind.
+	 */
+	virtual bool freewheeling() = 0;
+
+	/**
+	 * Reads the state of the audio system's transport (e.g. JACK
+	 * transport), if the application should follow one.  frame
+	 * is the transport position at the start of the current
+	 * process() cycle.  Either pointer may be null.  [RT SAFE,
+	 * any thread]
+	 *
+	 * \return false if there is no transport to follow (and
+	 * nothing was written).
+	 */
+	virtual bool transport_query(bool *rolling, uint32_t *frame) = 0;
+
+	/**
+	 * Ask the transport to start, stop or move to frame.  When
+	 * following a transport, play/stop/locate should go through
+	 * here so that everybody else follows too.  Drivers without
+	 * one ignore these.  [any thread]
+	 */
+	virtual void transport_start() = 0;
+	virtual void transport_stop() = 0;
+	virtual void transport_locate(uint32_t frame) = 0;
+
+	/**
+	 * Number of xruns (the device ran out of audio and had to
+	 * be restarted) since init(). [RT SAFE, any thread]
+	 */
+	virtual uint32_t xrun_count() = 0;
+
+	/**
+	 * Number of xruns in the last 60 seconds. [RT SAFE, any
+	 * thread]
+	 */
+	virtual uint32_t xruns_last_minute() = 0;
     };
 
     AudioSystem* audio_system_factory(int driver);
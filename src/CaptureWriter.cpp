@@ -0,0 +1,260 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "CaptureWriter.hpp"
+#include <sndfile.h>
+#include <cstring>
+#include <cstdio>
+#include <iostream>
+
+using namespace std;
+
+namespace StretchPlayer
+{
+    CaptureWriter::CaptureWriter(const QString& base_name,
+				 unsigned channels,
+				 uint32_t sample_rate,
+				 bool quiet) :
+	_base_name(base_name),
+	_channels(channels),
+	_sample_rate(sample_rate),
+	_quiet(quiet),
+	_running(true),
+	_frames_in(0),
+	_frames_out(0),
+	_dropped(0),
+	_marker_w(0),
+	_marker_r(0),
+	_sf(0),
+	_take(0)
+    {
+	if( _base_name.endsWith(".wav") )
+	    _base_name = _base_name.left( _base_name.size() - 4 );
+
+	// About 4 seconds.  The writer wakes up every 20 ms, so
+	// this only runs out if the disk stalls.
+	_ring.reset( new Tritium::RingBuffer<float>(sample_rate * channels * 4) );
+	_scratch.resize( 4096 * channels );
+	memset(_markers, 0, sizeof(_markers));
+    }
+
+    CaptureWriter::~CaptureWriter()
+    {
+	shutdown();
+    }
+
+    void CaptureWriter::start()
+    {
+	QThread::start();
+    }
+
+    void CaptureWriter::shutdown()
+    {
+	_running = false;
+	QThread::wait();
+	_close_take();
+    }
+
+    int CaptureWriter::start_take(double song_secs)
+    {
+	uint32_t w = _marker_w;
+
+	// Always leave room for the END that goes with it.
+	if( w - _marker_r > MARKERS - 2 )
+	    return -1;
+
+	Marker& m = _markers[w % MARKERS];
+	m.type = START;
+	m.frame = _frames_in;
+	m.secs = song_secs;
+	__sync_synchronize();
+	_marker_w = w + 1;
+	return 0;
+    }
+
+    void CaptureWriter::end_take()
+    {
+	uint32_t w = _marker_w;
+
+	if( w - _marker_r >= MARKERS )
+	    return;
+
+	Marker& m = _markers[w % MARKERS];
+	m.type = END;
+	m.frame = _frames_in;
+	m.secs = 0.0;
+	__sync_synchronize();
+	_marker_w = w + 1;
+    }
+
+    int CaptureWriter::write(const float * const *in, uint32_t nframes)
+    {
+	Tritium::RingBuffer<float>::rw_vector vec;
+	unsigned long n = (unsigned long)nframes * _channels;
+	unsigned long k, i = 0;
+	uint32_t f;
+	unsigned c;
+
+	_ring->get_write_vector(&vec);
+	if( vec.len[0] + vec.len[1] < n ) {
+	    _dropped = _dropped + nframes;
+	    return -1;
+	}
+
+	for( f=0 ; f<nframes ; ++f ) {
+	    for( c=0 ; c<_channels ; ++c, ++i ) {
+		k = i;
+		if( k < vec.len[0] ) {
+		    vec.buf[0][k] = in[c][f];
+		} else {
+		    vec.buf[1][k - vec.len[0]] = in[c][f];
+		}
+	    }
+	}
+	_ring->increment_write_idx(n);
+	_frames_in += nframes;
+	return 0;
+    }
+
+    void CaptureWriter::run()
+    {
+	while( _running ) {
+	    _drain();
+	    msleep(20);
+	}
+	_drain();
+    }
+
+    /**
+     * Write out what's in the ring, opening and closing takes at
+     * the frames that the markers say.
+     */
+    void CaptureWriter::_drain()
+    {
+	// The ring has to be looked at before the markers.  Anything
+	// that write() adds after this gets a marker at or after
+	// _frames_out + avail, so none are missed.
+	unsigned long avail = _ring->read_space() / _channels;
+	__sync_synchronize();
+
+	while( _marker_r != _marker_w ) {
+	    __sync_synchronize();
+	    const Marker& m = _markers[_marker_r % MARKERS];
+	    if( m.frame > _frames_out + avail )
+		break;
+
+	    unsigned long upto = (unsigned long)(m.frame - _frames_out);
+	    _write_frames(upto);
+	    avail -= upto;
+
+	    if( m.type == START ) {
+		_close_take();
+		_open_take(m.secs);
+	    } else {
+		_close_take();
+	    }
+	    __sync_synchronize();
+	    _marker_r = _marker_r + 1;
+	}
+
+	_write_frames(avail);
+    }
+
+    /**
+     * Take nframes out of the ring and into the take (or the bin,
+     * if there's no take).
+     */
+    void CaptureWriter::_write_frames(unsigned long nframes)
+    {
+	unsigned long chunk = _scratch.size() / _channels;
+	unsigned long n;
+
+	while( nframes ) {
+	    n = (nframes < chunk) ? nframes : chunk;
+	    _ring->read(&_scratch[0], n * _channels);
+	    if( _sf ) {
+		SNDFILE *sf = static_cast<SNDFILE*>(_sf);
+		if( sf_writef_float(sf, &_scratch[0], n) != sf_count_t(n) ) {
+		    cerr << "WARNING: Could not write take "
+			 << _take << ": " << sf_strerror(sf) << endl;
+		    _close_take();
+		}
+	    }
+	    _frames_out += n;
+	    nframes -= n;
+	}
+    }
+
+    void CaptureWriter::_open_take(double song_secs)
+    {
+	SF_INFO sf_info;
+	SF_BROADCAST_INFO bext;
+	unsigned long long ref;
+	QString filename;
+	SNDFILE *sf;
+
+	++_take;
+	filename = QString("%1-%2.wav").arg(_base_name).arg(_take, 2, 10, QChar('0'));
+
+	memset(&sf_info, 0, sizeof(sf_info));
+	sf_info.samplerate = _sample_rate;
+	sf_info.channels = _channels;
+	sf_info.format = SF_FORMAT_WAV | SF_FORMAT_PCM_24;
+	sf = sf_open(filename.toLocal8Bit().data(), SFM_WRITE, &sf_info);
+	if( ! sf ) {
+	    cerr << "WARNING: Could not open " << filename.toLocal8Bit().data()
+		 << " for recording: " << sf_strerror(0) << endl;
+	    return;
+	}
+	sf_command(sf, SFC_SET_CLIPPING, 0, SF_TRUE);
+
+	// Song position of the first frame, for lining the take up
+	// again later.  Has to go in before any audio.
+	memset(&bext, 0, sizeof(bext));
+	ref = (unsigned long long)(song_secs * _sample_rate + 0.5);
+	snprintf(bext.description, sizeof(bext.description),
+		 "StretchPlayer take %u at %.3f s", _take, song_secs);
+	snprintf(bext.originator, sizeof(bext.originator), "StretchPlayer");
+	bext.time_reference_low = uint32_t(ref & 0xFFFFFFFFULL);
+	bext.time_reference_high = uint32_t(ref >> 32);
+	bext.version = 1;
+	if( ! sf_command(sf, SFC_SET_BROADCAST_INFO, &bext, sizeof(bext)) ) {
+	    cerr << "WARNING: Could not stamp the song position on "
+		 << filename.toLocal8Bit().data() << endl;
+	}
+
+	// So that a crash doesn't leave a file with no length.
+	sf_command(sf, SFC_SET_UPDATE_HEADER_AUTO, 0, SF_TRUE);
+
+	if( ! _quiet ) {
+	    cout << "Recording take " << _take << " to "
+		 << filename.toLocal8Bit().data() << endl;
+	}
+	_sf = sf;
+    }
+
+    void CaptureWriter::_close_take()
+    {
+	if( _sf ) {
+	    sf_close( static_cast<SNDFILE*>(_sf) );
+	    _sf = 0;
+	}
+    }
+
+} // namespace StretchPlayer
@@ -0,0 +1,131 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef CAPTUREWRITER_HPP
+#define CAPTUREWRITER_HPP
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+#include <QString>
+#include <QThread>
+#include "RingBuffer.hpp"
+
+namespace StretchPlayer
+{
+    /**
+     * \brief Streams captured audio to WAV files from its own thread.
+     *
+     * The audio thread hands over each cycle's input with write(),
+     * and brackets the stretches it wants kept with start_take() and
+     * end_take().  None of these block or allocate: the audio goes
+     * through a lock-free ring, and the take boundaries through a
+     * small queue of markers that carry the ring position they
+     * apply at.  The writer thread wakes up every few ms, and writes
+     * each take to BASE-01.wav, BASE-02.wav, ... (24-bit PCM).
+     *
+     * Each take gets a BWF time reference of the song position at
+     * its first frame (in frames at the device rate), so an editor
+     * can drop it back in place against the song.
+     *
+     * start_take(), end_take() and write() may only be called by one
+     * thread (the audio thread). [RT SAFE]
+     */
+    class CaptureWriter : private QThread
+    {
+    public:
+	enum { MAX_CHANNELS = 32 };
+
+	CaptureWriter(const QString& base_name,
+		      unsigned channels,
+		      uint32_t sample_rate,
+		      bool quiet);
+	~CaptureWriter();
+
+	void start();
+
+	/**
+	 * Finish the take that is being written (if any) and stop
+	 * the thread.  Returns when it's done.
+	 */
+	void shutdown();
+
+	/**
+	 * Start a new take with the next frame that is write()n.
+	 * song_secs is the song position that it lines up with.
+	 * Returns 0 on success, or non-zero if the writer is too far
+	 * behind to take it.
+	 */
+	int start_take(double song_secs);
+
+	/**
+	 * End the take after the last frame that was write()n.
+	 */
+	void end_take();
+
+	/**
+	 * Queue nframes of in[0..channels-1].  All of them go, or
+	 * none: if there's no room this returns non-zero and the
+	 * frames are counted in dropped().
+	 */
+	int write(const float * const *in, uint32_t nframes);
+
+	unsigned channels() const { return _channels; }
+	uint32_t dropped() const { return _dropped; }
+
+    private:
+	virtual void run();
+	void _drain();
+	void _write_frames(unsigned long nframes);
+	void _open_take(double song_secs);
+	void _close_take();
+
+	enum { START = 1, END = 2 };
+
+	struct Marker {
+	    int type;
+	    unsigned long long frame; // Ring frame that it applies at
+	    double secs;
+	};
+
+	enum { MARKERS = 16 };
+
+    private:
+	QString _base_name;
+	unsigned _channels;
+	uint32_t _sample_rate;
+	bool _quiet;
+	volatile bool _running;
+
+	std::auto_ptr< Tritium::RingBuffer<float> > _ring; // Interleaved
+	unsigned long long _frames_in;  // Audio thread only
+	unsigned long long _frames_out; // Writer thread only
+	volatile uint32_t _dropped;
+
+	Marker _markers[MARKERS];
+	volatile uint32_t _marker_w; // Audio thread
+	volatile uint32_t _marker_r; // Writer thread
+
+	void *_sf; // SNDFILE* of the take being written, or 0
+	unsigned _take;
+	std::vector<float> _scratch;
+    };
+
+} // namespace StretchPlayer
+
+#endif // CAPTUREWRITER_HPP
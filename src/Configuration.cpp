@@ -18,6 +18,8 @@
  */
 
 #include "Configuration.hpp"
+#include "OutputRouter.hpp"
+#include "CaptureWriter.hpp"
 #include "config.h"
 #include <getopt.h>
 #include <iostream>
@@ -28,6 +30,7 @@ using namespace std;
 #define DEFAULT_SAMPLE_RATE "44100"
 #define DEFAULT_PERIOD_SIZE "1024"
 #define DEFAULT_PERIODS_PER_BUFFER "2"
+#define DEFAULT_TSCHED_BUFFER "2000"
 #define DEFAULT_ALSA_DEVICE "hw:0"
 
 namespace StretchPlayer
@@ -51,7 +54,32 @@ namespace StretchPlayer
 	  {"jack", 0, 0, 'J'},
 	  "on",
 	  "use JACK for audio" },
+
+	{ "t",
+	  {"transport", 0, 0, 't'},
+	  "off",
+	  "follow JACK transport (start, stop and locate with it)" },
+
+	{ "O:",
+	  {"outputs", 1, 0, 'O'},
+	  "2",
+	  "number of JACK outputs (left, right, out3...)" },
 #endif
+
+	{ "R:",
+	  {"routes", 1, 0, 'R'},
+	  "none",
+	  "output:source=gain,... (sources 0=left 1=right), e.g. 2:0=0.5,3:1=0.5" },
+
+	{ "i:",
+	  {"inputs", 1, 0, 'i'},
+	  "0",
+	  "number of capture inputs (2 if recording)" },
+
+	{ "W:",
+	  {"record", 1, 0, 'W'},
+	  "none",
+	  "record the inputs while playing, to FILE-01.wav, FILE-02.wav..." },
 #ifdef AUDIO_SUPPORT_ALSA
 	{ "A",
 	  {"alsa", 0, 0, 'A'},
@@ -67,27 +95,86 @@ namespace StretchPlayer
 	  DEFAULT_ALSA_DEVICE,
 	  "device to use for ALSA" },
 
+	{ "n:",
+	  {"periods", 1, 0, 'n'},
+	  DEFAULT_PERIODS_PER_BUFFER,
+	  "periods per buffer for ALSA" },
+
+	{ "M",
+	  {"no-mmap", 0, 0, 'M'},
+	  "off",
+	  "ALSA copies with snd_pcm_writei() instead of mmap" },
+
+	{ "T",
+	  {"tsched", 0, 0, 'T'},
+	  "off",
+	  "ALSA wakes on a timer and keeps a deep buffer" },
+
+	{ "B:",
+	  {"tsched-buffer", 1, 0, 'B'},
+	  DEFAULT_TSCHED_BUFFER,
+	  "buffer length for --tsched, in ms" },
+
+	{ "D",
+	  {"dither", 0, 0, 'D'},
+	  "off",
+	  "ALSA adds TPDF dither when the device takes integers" },
+#endif
+
+	{ "N",
+	  {"null", 0, 0, 'N'},
+#if defined( AUDIO_SUPPORT_JACK ) || defined( AUDIO_SUPPORT_ALSA )
+	  "off",
+#else
+	  "on",
+#endif
+	  "no audio device, run from a timer (headless)" },
+
+	{ "F",
+	  {"freewheel", 0, 0, 'F'},
+	  "off",
+	  "null driver runs as fast as possible" },
+
+	{ "j:",
+	  {"jitter", 1, 0, 'j'},
+	  "0",
+	  "null driver max random wakeup delay (usecs)" },
+
+	{ "o:",
+	  {"output-file", 1, 0, 'o'},
+	  "none",
+	  "null driver writes its output to this WAV file" },
+
 	{ "r:",
 	  {"sample-rate", 1, 0, 'r'},
 	  DEFAULT_SAMPLE_RATE,
-	  "sample rate to use for ALSA" },
+	  "sample rate to use for ALSA or null" },
 
 	{ "p:",
 	  {"period-size", 1, 0, 'p'},
 	  DEFAULT_PERIOD_SIZE,
-	  "period size to use for ALSA" },
-
-	{ "n:",
-	  {"periods", 1, 0, 'n'},
-	  DEFAULT_PERIODS_PER_BUFFER,
-	  "periods per buffer for ALSA" },
-#endif
+	  "period size to use for ALSA or null" },
 
 	{ "x",
 	  {"no-autoconnect", 0, 0, 'x'},
 	  "off",
 	  "disable auto-connection ot ouputs" },
 
+	{ "w:",
+	  {"worker-priority", 1, 0, 'w'},
+	  "auto",
+	  "RT priority of stretcher thread (0=off, auto=audio-1)" },
+
+	{ "a:",
+	  {"worker-cpus", 1, 0, 'a'},
+	  "0 (any)",
+	  "CPU affinity mask for stretcher thread (e.g. 0xc)" },
+
+	{ "m",
+	  {"lock-memory", 0, 0, 'm'},
+	  "off",
+	  "lock all memory to avoid page faults (mlockall)" },
+
 	{ "c",
 	  {"compositing", 0, 0, 'c'},
 	  "on",
@@ -98,6 +185,11 @@ namespace StretchPlayer
 	  "off",
 	  "disable desktop compositing" },
 
+	{ "g:",
+	  {"gui-rate", 1, 0, 'g'},
+	  "60",
+	  "display refresh rate while playing (Hz)" },
+
 	{ "q",
 	  {"quiet", 0, 0, 'q'},
 	  "off",
@@ -207,7 +299,7 @@ namespace StretchPlayer
 
 	it = sp_opts;
 
-	int align = 14, size;
+	int align = 18, size;
 	for( it=sp_opts ; it->optstring != 0 ; ++it ) {
 	    opts = &(it->longopts);
 	    cout << "  -" << ((char)opts->val)
@@ -235,15 +327,31 @@ namespace StretchPlayer
 #elif defined( AUDIO_SUPPORT_ALSA )
 	driver = AlsaDriver;
 #else
-#error "Must have support for at least ONE audio API"
+	driver = NullDriver;
 #endif
 	audio_device( DEFAULT_ALSA_DEVICE );
 	sample_rate( atoi(DEFAULT_SAMPLE_RATE) );
 	period_size( atoi(DEFAULT_PERIOD_SIZE) );
 	periods_per_buffer( atoi(DEFAULT_PERIODS_PER_BUFFER) );
+	alsa_mmap(true);
+	alsa_tsched(false);
+	alsa_tsched_buffer( atoi(DEFAULT_TSCHED_BUFFER) );
+	alsa_dither(false);
+	jack_transport(false);
+	outputs(2);
+	routes( QString() );
+	inputs(0);
+	record( QString() );
+	freewheel(false);
+	null_jitter(0);
+	null_output( QString() );
 	startup_file( QString() );
 	autoconnect(true);
+	worker_priority(-1);
+	worker_cpu_mask(0);
+	lock_memory(false);
 	compositing(true);
+	gui_rate(60);
 	quiet(false);
 	help(false);
 
@@ -265,6 +373,18 @@ namespace StretchPlayer
 		case 'A':
 		    driver(AlsaDriver);
 		    break;
+		case 'N':
+		    driver(NullDriver);
+		    break;
+		case 'F':
+		    freewheel(true);
+		    break;
+		case 'j':
+		    null_jitter( atoi(optarg) );
+		    break;
+		case 'o':
+		    null_output( QString::fromLocal8Bit(optarg) );
+		    break;
 		case 'd':
 		    audio_device(optarg);
 		    break;
@@ -277,15 +397,58 @@ namespace StretchPlayer
 		case 'n':
 		    periods_per_buffer( atoi(optarg) );
 		    break;
+		case 'M':
+		    alsa_mmap(false);
+		    break;
+		case 'T':
+		    alsa_tsched(true);
+		    break;
+		case 'B':
+		    alsa_tsched_buffer( atoi(optarg) );
+		    break;
+		case 'D':
+		    alsa_dither(true);
+		    break;
+		case 't':
+		    jack_transport(true);
+		    break;
+		case 'O':
+		    outputs( atoi(optarg) );
+		    break;
+		case 'R':
+		    routes( QString::fromLocal8Bit(optarg) );
+		    break;
+		case 'i':
+		    inputs( atoi(optarg) );
+		    break;
+		case 'W':
+		    record( QString::fromLocal8Bit(optarg) );
+		    break;
 		case 'x':
 		    autoconnect(false);
 		    break;
+		case 'w':
+		    if( QString(optarg) == "auto" ) {
+			worker_priority(-1);
+		    } else {
+			worker_priority( atoi(optarg) );
+		    }
+		    break;
+		case 'a':
+		    worker_cpu_mask( strtoul(optarg, 0, 0) );
+		    break;
+		case 'm':
+		    lock_memory(true);
+		    break;
 		case 'c':
 		    compositing(true);
 		    break;
 		case 'C':
 		    compositing(false);
 		    break;
+		case 'g':
+		    gui_rate( atoi(optarg) );
+		    break;
 		case 'q':
 		    quiet(true);
 		    break;
@@ -304,11 +467,21 @@ namespace StretchPlayer
 	}
 
 	// Check if setup is sane.
+	if( worker_priority() < -1 ) bad = true;
+	if( gui_rate() == 0 || gui_rate() > 1000 ) bad = true;
+	if( outputs() < 2 || outputs() > OutputRouter::MAX_OUTPUTS ) bad = true;
+	if( ! record().isEmpty() && inputs() == 0 ) inputs(2);
+	if( inputs() > CaptureWriter::MAX_CHANNELS ) bad = true;
 	if( driver() == AlsaDriver ) {
 	    if( sample_rate() == 0 ) bad = true;
 	    if( audio_device() == "" ) bad = true;
 	    if( period_size() == 0 ) bad = true;
 	    if( periods_per_buffer() == 0 ) bad = true;
+	    if( alsa_tsched() && alsa_tsched_buffer() == 0 ) bad = true;
+	}
+	if( driver() == NullDriver ) {
+	    if( sample_rate() == 0 ) bad = true;
+	    if( period_size() == 0 ) bad = true;
 	}
 
 	if( !bad ) ok.set(this, true);
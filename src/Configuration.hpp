@@ -75,7 +75,7 @@ private:
 class Configuration
 {
 public:
-    typedef enum { JackDriver = 1, AlsaDriver = 2 } driver_t;
+    typedef enum { JackDriver = 1, AlsaDriver = 2, NullDriver = 3 } driver_t;
 
     Configuration(int argc, char* argv[]);
     ~Configuration();
@@ -90,9 +90,25 @@ public:
     Property<unsigned> sample_rate;
     Property<unsigned> period_size;
     Property<unsigned> periods_per_buffer;
+    Property<bool>     alsa_mmap; // Use mmap access if the device can
+    Property<bool>     alsa_tsched; // Timer-scheduled, deep buffer
+    Property<unsigned> alsa_tsched_buffer; // msecs
+    Property<bool>     alsa_dither; // TPDF dither for integer formats
+    Property<bool>     jack_transport; // Follow JACK transport
+    Property<unsigned> outputs; // JACK output ports
+    Property<QString>  routes; // OutputRouter::set_routes(), or empty
+    Property<unsigned> inputs; // Capture channels, 0 = none
+    Property<QString>  record; // CaptureWriter base name, or empty
+    Property<bool>     freewheel; // Null driver: as fast as possible
+    Property<unsigned> null_jitter; // Null driver: max wakeup delay (usecs)
+    Property<QString>  null_output; // Null driver: WAV file, or empty
     Property<QString>  startup_file;
     Property<bool>     autoconnect; // Automatically connect to first 2 outputs
+    Property<int>      worker_priority; // SCHED_FIFO, 0 = off, -1 = auto
+    Property<unsigned long> worker_cpu_mask; // 0 = any CPU
+    Property<bool>     lock_memory;
     Property<bool>     compositing;
+    Property<unsigned> gui_rate; // Display refreshes per second while playing
     Property<bool>     quiet;
     Property<bool>     help;
 
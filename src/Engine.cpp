@@ -21,14 +21,17 @@
 #include "AudioSystem.hpp"
 #include "RubberBandServer.hpp"
 #include "Configuration.hpp"
-#include <sndfile.h>
-#include <mpg123.h>
+#include "SongLoader.hpp"
+#include "SampleOps.hpp"
+#include "CaptureWriter.hpp"
 #include <stdexcept>
 #include <cassert>
 #include <cstring>
 #include <cmath>
 #include <cstdlib>
 #include <algorithm>
+#include <unistd.h>
+#include <time.h>
 #include <QFileInfo>
 #include <QString>
 
@@ -38,11 +41,19 @@ using RubberBand::RubberBandStretcher;
 
 namespace StretchPlayer
 {
+    static inline double monotonic_now() {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
+    }
+
     Engine::Engine(Configuration *config)
 	: _config(config),
 	  _playing(false),
 	  _hit_end(false),
 	  _state_changed(false),
+	  _primed(false),
+	  _underruns(0),
 	  _position(0),
 	  _loop_a(0),
 	  _loop_b(0),
@@ -50,10 +61,16 @@ namespace StretchPlayer
 	  _stretch(1.0),
 	  _pitch(0),
 	  _gain(1.0),
-	  _output_position(0)
+	  _output_position(0),
+	  _time_ratio(1.0),
+	  _stretcher_latency(0),
+	  _transport(false),
+	  _transport_rolling(false),
+	  _transport_frame(0),
+	  _capture_rolling(false),
+	  _capture_next(0.0),
+	  _capture_ratio(1.0)
     {
-	QString err;
-
 	QMutexLocker lk(&_audio_lock);
 
 	Configuration::driver_t pref_driver;
@@ -63,11 +80,55 @@ namespace StretchPlayer
 	}
 
 	_audio_system.reset( audio_system_factory(pref_driver) );
+	_init();
+    }
+
+    Engine::Engine(AudioSystem *audio_system, Configuration *config)
+	: _config(config),
+	  _playing(false),
+	  _hit_end(false),
+	  _state_changed(false),
+	  _primed(false),
+	  _underruns(0),
+	  _position(0),
+	  _loop_a(0),
+	  _loop_b(0),
+	  _sample_rate(48000.0),
+	  _stretch(1.0),
+	  _pitch(0),
+	  _gain(1.0),
+	  _output_position(0),
+	  _time_ratio(1.0),
+	  _stretcher_latency(0),
+	  _transport(false),
+	  _transport_rolling(false),
+	  _transport_frame(0),
+	  _capture_rolling(false),
+	  _capture_next(0.0),
+	  _capture_ratio(1.0)
+    {
+	QMutexLocker lk(&_audio_lock);
+
+	_audio_system.reset( audio_system );
+	_init();
+    }
+
+    /**
+     * Bring up the audio system and the stretcher.  The audio
+     * system must already be set.
+     *
+     * MUTEX MUST ALREADY BE LOCKED
+     */
+    void Engine::_init()
+    {
+	QString err;
 
 	QString app_name("StretchPlayer");
 	_audio_system->init( &app_name, _config, &err );
 	_audio_system->set_process_callback(Engine::static_process_callback, this);
 	_audio_system->set_segment_size_callback(Engine::static_segment_size_callback, this);
+	_audio_system->set_rewind_callback(Engine::static_rewind_callback, this);
+	_audio_system->set_latency_callback(Engine::static_latency_callback, this);
 
 	if( ! err.isNull() ) {
 	    char msg[513];
@@ -80,7 +141,50 @@ namespace StretchPlayer
 
 	_stretcher.reset( new RubberBandServer(sample_rate) );
 	_stretcher->set_segment_size( _audio_system->current_segment_size() );
+
+	// What the stretcher makes, before it's routed to the outputs
+	_src_L.assign( _audio_system->current_segment_size(), 0.0f );
+	_src_R.assign( _audio_system->current_segment_size(), 0.0f );
+	_router.reset( _audio_system->output_count(), 2 );
+	if( _config && ! _config->routes().isEmpty() ) {
+	    if( _router.set_routes(_config->routes(), &err) )
+		throw std::runtime_error(err.toLocal8Bit().data());
+	}
+
+	if( _config && ! _config->record().isEmpty() ) {
+	    if( _audio_system->input_count() == 0 )
+		throw std::runtime_error("Can't record: the audio system has no inputs.");
+	    _capture.reset( new CaptureWriter( _config->record(),
+					       _audio_system->input_count(),
+					       sample_rate,
+					       _config->quiet() ) );
+	    _capture->start();
+	}
+
+	// Worker runs just below the audio thread by default.
+	int worker_prio = -1;
+	unsigned long worker_cpus = 0;
+	bool lock_mem = false;
+	if(_config) {
+	    worker_prio = _config->worker_priority();
+	    worker_cpus = _config->worker_cpu_mask();
+	    lock_mem = _config->lock_memory();
+	}
+	if( worker_prio < 0 ) {
+	    worker_prio = _audio_system->realtime_priority() - 1;
+	    if( worker_prio < 0 ) worker_prio = 0;
+	}
+	_stretcher->set_scheduling(worker_prio, worker_cpus, lock_mem);
+	_transport = _audio_system->transport_query(0, 0);
+
+	memset(&_state, 0, sizeof(_state));
+	_state.stretch = _stretch;
+	_state.volume = _gain;
+	_state.stamp = monotonic_now();
+	_published.publish(_state);
+
 	_stretcher->start();
+	_stretcher->go_active();
 
 	if( _audio_system->activate(&err) )
 	    throw std::runtime_error(err.toLocal8Bit().data());
@@ -95,6 +199,9 @@ namespace StretchPlayer
 	_stretcher->shutdown();
 
 	_audio_system->deactivate();
+	if( _capture.get() ) {
+	    _capture->shutdown(); // Finishes the last take
+	}
 	_audio_system->cleanup();
 
 	callback_seq_t::iterator it;
@@ -109,29 +216,79 @@ namespace StretchPlayer
 	_stretcher->wait();
     }
 
-    void Engine::_zero_buffers(uint32_t nframes)
+    void Engine::_zero_buffers(const AudioSystem::cycle_t& cycle)
     {
 	// MUTEX MUST ALREADY BE LOCKED
 
 	// Just zero the buffers
-	void *buf_L = 0, *buf_R = 0;
-	buf_L = _audio_system->output_buffer(0);
-	if(buf_L) {
-	    memset(buf_L, 0, nframes * sizeof(float));
-	}
-	buf_R = _audio_system->output_buffer(1);
-	if(buf_R) {
-	    memset(buf_R, 0, nframes * sizeof(float));
+	for( uint32_t k=0 ; k<cycle.outputs ; ++k ) {
+	    if(cycle.out[k]) {
+		memset(cycle.out[k], 0, cycle.nframes * sizeof(float));
+	    }
 	}
     }
 
     int Engine::segment_size_callback(uint32_t nframes)
     {
 	_stretcher->set_segment_size(nframes);
+	if( nframes > _src_L.size() ) {
+	    _src_L.assign(nframes, 0.0f);
+	    _src_R.assign(nframes, 0.0f);
+	}
+	return 0;
     }
 
-    int Engine::process_callback(uint32_t nframes)
+    /**
+     * The audio system threw away nframes of output that hadn't
+     * been heard yet.  Back up so that they get generated again.
+     *
+     * The frames are already gone, so if we can't get the lock now
+     * they are made up for on the next cycle that does.
+     */
+    int Engine::rewind_callback(uint32_t nframes)
     {
+	if( ! _audio_lock.tryLock() ) {
+	    _rewound_pending.fetchAndAddOrdered(nframes);
+	    return 0;
+	}
+
+	_rewound( nframes + _rewound_pending.fetchAndStoreOrdered(0) );
+
+	_audio_lock.unlock();
+	return 0;
+    }
+
+    /**
+     * If the state already changed (locate, stop, play) then
+     * _output_position is already where it needs to be.
+     *
+     * AUDIO LOCK MUST BE HELD.
+     */
+    void Engine::_rewound(uint32_t nframes)
+    {
+	if( _playing && !_state_changed ) {
+	    _output_position = _latency.position( double(_stretcher_latency) + nframes );
+	    _state_changed = true;
+	}
+    }
+
+    /**
+     * How far our output runs behind the song that feeds it: the
+     * stretcher's latency plus what can wait in its input ring.
+     * Called by the audio system (not necessarily the audio
+     * thread) when it needs to tell others.
+     */
+    uint32_t Engine::latency_callback()
+    {
+	if( ! _stretcher.get() )
+	    return 0;
+	return _stretcher_latency
+	    + uint32_t( _stretcher->feed_block_min() * _time_ratio );
+    }
+
+    int Engine::process_callback(const AudioSystem::cycle_t& cycle)
+    {
+	uint32_t nframes = cycle.nframes;
 	bool locked = false;
 
 	if( _loop_ab_pressed > 0 ) {
@@ -140,6 +297,15 @@ namespace StretchPlayer
 
 	try {
 	    locked = _audio_lock.tryLock();
+	    if(locked && _stop_pressed.fetchAndStoreOrdered(0)) {
+		_handle_stop();
+	    }
+	    if(locked && _rewound_pending > 0) {
+		_rewound( _rewound_pending.fetchAndStoreOrdered(0) );
+	    }
+	    if(locked && _transport) {
+		_follow_transport(nframes);
+	    }
 	    if(_state_changed) {
 		_state_changed = false;
 		_stretcher->reset();
@@ -148,20 +314,33 @@ namespace StretchPlayer
 		    _stretcher->read_audio(left, right, 64);
 		assert( 0 == _stretcher->available_read() );
 		_position = _output_position;
+		if( _position > _left.size() ) {
+		    _position = _left.size();
+		}
+		_latency.reset(_position);
+		_primed = false;
 	    }
 	    if(locked) {
 		if(_playing) {
 		    if(_left.size()) {
-			_process_playing(nframes);
+			_process_playing(cycle);
 		    } else {
 			_playing = false;
 		    }
 		} else {
-		    _zero_buffers(nframes);
+		    _zero_buffers(cycle);
 		}
 	    } else {
-		_zero_buffers(nframes);
+		_zero_buffers(cycle);
 	    }
+	    if(_capture.get()) {
+		if(locked) {
+		    _capture_cycle(cycle);
+		} else {
+		    _end_take();
+		}
+	    }
+	    _publish_state(locked);
 	} catch (...) {
 	}
 
@@ -170,100 +349,185 @@ namespace StretchPlayer
 	return 0;
     }
 
-    static void apply_gain_to_buffer(float *buf, uint32_t frames, float gain);
+    /**
+     * Put out this cycle's state_t for get_state().  Whatever has to
+     * be read under the lock (the song and where we are in it) is
+     * left as it was if we didn't get it.
+     */
+    void Engine::_publish_state(bool locked)
+    {
+	if( locked ) {
+	    if( _left.size() > 0 ) {
+		_state.position = float(_heard_position()) / _sample_rate;
+		_state.length = float(_left.size()) / _sample_rate;
+	    } else {
+		_state.position = 0.0f;
+		_state.length = 0.0f;
+	    }
+	    _state.loop_a = float(_loop_a) / _sample_rate;
+	    _state.loop_b = looping() ? float(_loop_b) / _sample_rate : _state.loop_a;
+	    _state.playing = _playing && !_state_changed;
+	    _state.stamp = monotonic_now();
+	}
+	_state.stretch = _stretch;
+	_state.pitch = _pitch;
+	_state.volume = _gain;
+	_state.cpu_load = get_cpu_load();
+	_state.xruns_last_minute = get_xruns_last_minute();
+	_state.underruns = _underruns;
+	_published.publish(_state);
+    }
+
+    /**
+     * The audio thread may not be back for a while (a whole
+     * --tsched refill, for one), so carry the position on at the
+     * current speed from when it was heard.
+     */
+    Engine::state_t Engine::get_state() const
+    {
+	state_t st = _published.read();
+
+	if( st.playing && st.length > 0.0f ) {
+	    double dt = monotonic_now() - st.stamp;
+	    if( dt > 0.0 ) {
+		double pos = st.position + dt * st.stretch;
+		if( (st.loop_b > st.loop_a) && (pos >= st.loop_b) ) {
+		    pos = st.loop_a + ::fmod(pos - st.loop_a, double(st.loop_b - st.loop_a));
+		}
+		if( pos > st.length ) pos = st.length;
+		st.position = pos;
+	    }
+	}
+	return st;
+    }
+
+    /**
+     * Hand this cycle's input to the CaptureWriter, in takes that
+     * each cover one straight run through the song.
+     *
+     * Frame 0 of the input was captured input_delay() frames before
+     * this cycle, while the listener was hearing what is now
+     * output_delay() + nframes frames (plus the stretcher's
+     * latency) behind the stretcher's output.  So that's the song
+     * position the take lines up with.  A locate, loop jump or
+     * stretch change ends the take, and a new one starts with the
+     * next cycle that can be placed.
+     *
+     * MUTEX MUST ALREADY BE LOCKED
+     */
+    void Engine::_capture_cycle(const AudioSystem::cycle_t& cycle)
+    {
+	uint32_t nframes = cycle.nframes;
+	double back, song, step;
+
+	if( !_playing || _state_changed || cycle.inputs == 0 ) {
+	    _end_take();
+	    return;
+	}
+
+	back = double(_stretcher_latency) + nframes
+	    + _audio_system->output_delay() + _audio_system->input_delay();
+	if( ! _latency.covers(back) ) {
+	    // The listener was still hearing the old position
+	    _end_take();
+	    return;
+	}
+	song = _latency.position(back);
+	step = nframes / _time_ratio;
+
+	if( _capture_rolling
+	    && ((::fabs(song - _capture_next) > step) || (_time_ratio != _capture_ratio)) ) {
+	    _end_take();
+	}
+	if( ! _capture_rolling ) {
+	    if( _capture->start_take(song / _sample_rate) )
+		return;
+	    _capture_rolling = true;
+	    _capture_ratio = _time_ratio;
+	}
+	if( _capture->write(cycle.in, nframes) ) {
+	    // The disk fell behind.  Start over next cycle.
+	    _end_take();
+	    return;
+	}
+	_capture_next = song + step;
+    }
+
+    void Engine::_end_take()
+    {
+	if( _capture_rolling ) {
+	    _capture->end_take();
+	    _capture_rolling = false;
+	}
+    }
 
-    void Engine::_process_playing(uint32_t nframes)
+    void Engine::_process_playing(const AudioSystem::cycle_t& cycle)
     {
 	// MUTEX MUST ALREADY BE LOCKED
+	uint32_t nframes = cycle.nframes;
 	float *buf_L = 0, *buf_R = 0;
 
-	buf_L = _audio_system->output_buffer(0);
-	buf_R = _audio_system->output_buffer(1);
+	if( nframes > _src_L.size() ) {
+	    // Missed a segment size change
+	    _zero_buffers(cycle);
+	    return;
+	}
+	buf_L = &_src_L[0];
+	buf_R = &_src_R[0];
 
 	uint32_t srate = _audio_system->sample_rate();
 	float time_ratio = srate / _sample_rate / _stretch;
+	_time_ratio = time_ratio;
 
 	_stretcher->time_ratio( time_ratio );
 	_stretcher->pitch_scale( ::pow(2.0, double(_pitch)/12.0) * _sample_rate / srate );
 
-	uint32_t frame;
-	uint32_t reqd, gend, zeros, feed;
-
 	assert( _stretcher->is_running() );
 
-	// Determine how much data to push into the stretcher
-	int32_t write_space, written, input_frames;
-	write_space = _stretcher->available_write();
-	written = _stretcher->written();
-	if(written < _stretcher->feed_block_min()
-	   && write_space >= _stretcher->feed_block_max() ) {
-	    input_frames = _stretcher->feed_block_max();
-	} else {
-	    input_frames = 0;
-	}
+	_feed_stretcher();
 
-	// Push data into the stretcher, observing A/B loop points
-	while( input_frames > 0 ) {
-	    feed = input_frames;
-	    if( looping() && ((_position + feed) >= _loop_b) ) {
-		if( _position >= _loop_b ) {
-		    _position = _loop_a;
-		    if( _loop_a + feed > _loop_b ) {
-			assert(_loop_b > _loop_a );
-			feed = _loop_b - _loop_a;
-		    }
-		} else {
-		    assert( _loop_b >= _position );
-		    feed = _loop_b - _position;
+	// Pull generated data off the stretcher
+	uint32_t read_space;
+	read_space = _stretcher->available_read();
+
+	if( read_space < nframes ) {
+	    // How long can we wait without the device running dry?
+	    unsigned long max_usecs = 0;
+	    if( _audio_system->freewheeling() ) {
+		max_usecs = 1000000;
+	    } else {
+		uint32_t buffered = _audio_system->buffered_frames();
+		if( buffered > 2 * nframes ) {
+		    max_usecs = 1000000.0 * (buffered - 2 * nframes) / srate / 2;
 		}
 	    }
-	    if( _position + feed > _left.size() ) {
-		feed = _left.size() - _position;
-		input_frames = feed;
-	    }
-	    _stretcher->write_audio( &_left[_position], &_right[_position], feed );
-	    _position += feed;
-	    assert( input_frames >= feed );
-	    input_frames -= feed;
-	    if( looping() && _position >= _loop_b ) {
-		_position = _loop_a;
+	    if( max_usecs ) {
+		read_space = _wait_for_stretcher(nframes, max_usecs);
 	    }
 	}
 
-	// Pull generated data off the stretcher
-	uint32_t read_space;
-	read_space = _stretcher->available_read();
-
 	if( read_space >= nframes ) {
 	    _stretcher->read_audio(buf_L, buf_R, nframes);
+	    _latency.read(nframes);
+	    _primed = true;
 	} else if ( (read_space > 0) && _hit_end ) {
-	    _zero_buffers(nframes);
+	    memset(buf_L, 0, nframes * sizeof(float));
+	    memset(buf_R, 0, nframes * sizeof(float));
 	    _stretcher->read_audio(buf_L, buf_R, read_space);
+	    _latency.read(read_space);
 	} else {
-	    _zero_buffers(nframes);
+	    memset(buf_L, 0, nframes * sizeof(float));
+	    memset(buf_R, 0, nframes * sizeof(float));
+	    if( _primed && !_hit_end ) ++_underruns;
 	}
 
 	// Update our estimation of the output position.
-	unsigned n_feed_buf = _stretcher->latency();
-	if(_position > n_feed_buf) {
-	    _output_position = _position - n_feed_buf;
-	} else {
-	    _output_position = 0;
-	}
-	assert( (_output_position > _position) ? (_output_position - _position) <= n_feed_buf : true );
-	assert( (_output_position < _position) ? (_position - _output_position) <= n_feed_buf : true );
+	_stretcher_latency = _stretcher->latency();
+	_output_position = _latency.position(_stretcher_latency);
 
-	// Apply gain... unroll loop manually so GCC will use SSE
-	if(nframes & 0xf) {  // nframes < 16
-	    unsigned f = nframes;
-	    while(f--) {
-		(*buf_L++) *= _gain;
-		(*buf_R++) *= _gain;
-	    }
-	} else {
-	    apply_gain_to_buffer(buf_L, nframes, _gain);
-	    apply_gain_to_buffer(buf_R, nframes, _gain);
-	}
+	// Apply gain and routing: one vector mix pass per output
+	const float *src[2] = { buf_L, buf_R };
+	_router.mix(src, cycle.out, nframes, _gain);
 
 	if(_position >= _left.size()) {
 	    _hit_end = true;
@@ -272,6 +536,7 @@ namespace StretchPlayer
 	    _hit_end = false;
 	    _playing = false;
 	    _position = 0;
+	    _primed = false;
 	    _stretcher->reset();
 	}
 
@@ -280,148 +545,124 @@ namespace StretchPlayer
     }
 
     /**
-     * Attempt to load a file via libsndfile
+     * Start, stop and locate with the audio system's transport.
+     * Transport frames are output frames, and map to the song at
+     * the current speed.  On a start or a jump, feed from the
+     * stretcher's latency ahead so that the song lines up with the
+     * transport once the stretcher's start-up latency has gone by.
      *
-     * \return true on success
+     * MUTEX MUST ALREADY BE LOCKED
      */
-    bool Engine::_load_song_using_libsndfile(const QString& filename)
-    {
-	SNDFILE *sf = 0;
-	SF_INFO sf_info;
-	memset(&sf_info, 0, sizeof(sf_info));
-
-	_message( QString("Opening file...") );
-	sf = sf_open(filename.toLocal8Bit().data(), SFM_READ, &sf_info);
-	if( !sf ) {
-	    _error( QString("Error opening file '%1': %2")
-		    .arg(filename)
-		    .arg( sf_strerror(sf) ) );
-	    return false;
-	}
-
-	_sample_rate = sf_info.samplerate;
-	_left.reserve( sf_info.frames );
-	_right.reserve( sf_info.frames );
-
-	if(sf_info.frames == 0) {
-	    _error( QString("Error opening file '%1': File is empty")
-		    .arg(filename) );
-	    sf_close(sf);
-	    return false;
-	}
-
-	_message( QString("Reading file...") );
-	std::vector<float> buf(4096, 0.0f);
-	sf_count_t read, k;
-	unsigned mod;
-	while(true) {
-	    read = sf_read_float(sf, &buf[0], buf.size());
-	    if( read < 1 ) break;
-	    for(k=0 ; k<read ; ++k) {
-		mod = k % sf_info.channels;
-		if( mod == 0 ) {
-		    _left.push_back( buf[k] );
-		} else if( mod == 1 ) {
-		    _right.push_back( buf[k] );
-		} else {
-		    // remaining channels ignored
-		}
-	    }
-	}
+    void Engine::_follow_transport(uint32_t nframes)
+    {
+	bool rolling, started, stopped, jumped;
+	uint32_t frame;
+	double out_frame;
+	unsigned long pos;
+
+	if( ! _audio_system->transport_query(&rolling, &frame) )
+	    return;
 
-	if( _left.size() != sf_info.frames ) {
-	    _error( QString("Warning: not all of the file data was read.") );
+	started = rolling && !_transport_rolling;
+	stopped = !rolling && _transport_rolling;
+	jumped = (frame != _transport_frame);
+	_transport_rolling = rolling;
+	_transport_frame = rolling ? (frame + nframes) : frame;
+	if( !started && !stopped && !jumped )
+	    return;
+
+	out_frame = frame;
+	if( rolling ) {
+	    out_frame += _stretcher->latency();
+	}
+	pos = out_frame * _sample_rate * _stretch / _audio_system->sample_rate();
+	if( pos > _left.size() ) {
+	    pos = _left.size();
 	}
 
-	sf_close(sf);
-	return true;
+	_playing = rolling && (pos < _left.size());
+	_output_position = pos;
+	_hit_end = false;
+	_state_changed = true;
     }
 
     /**
-     * Attempt to load an MP3 file via libmpg123
-     *
-     * adapted by Sean Bolton from mpg123_to_wav.c
+     * Push the next block of the song into the stretcher, if it
+     * needs one, observing the A/B loop points.
      *
-     * \return true on success
+     * MUTEX MUST ALREADY BE LOCKED
      */
-    bool Engine::_load_song_using_libmpg123(const QString& filename)
-    {
-	mpg123_handle *mh = 0;
-	int err, channels, encoding;
-	long rate;
-
-	_message( QString("Opening file...") );
-	if ((err = mpg123_init()) != MPG123_OK ||
-	    (mh = mpg123_new(0, &err)) == 0 ||
-	    mpg123_open(mh, filename.toLocal8Bit().data()) != MPG123_OK ||
-	    mpg123_getformat(mh, &rate, &channels, &encoding) != MPG123_OK) {
-
-	    _error( QString("Error opening file '%1': %2")
-		    .arg(filename)
-		    .arg(mh == NULL ? mpg123_plain_strerror(err) : mpg123_strerror(mh)) );
-
-	  mpg123error:
-	    mpg123_close(mh);
-	    mpg123_delete(mh);
-	    mpg123_exit();
-	    return false;
-	}
-	if (encoding != MPG123_ENC_SIGNED_16) {
-	    _error( QString("Error: unsupported encoding format.") );
-	    goto mpg123error;
-	}
-	/* lock the output format */
-	mpg123_format_none(mh);
-	mpg123_format(mh, rate, channels, encoding);
-
-	off_t length = mpg123_length(mh);
-	if (length == MPG123_ERR || length == 0) {
-	    _error( QString("Error: file is empty or length unknown.") );
-	    goto mpg123error;
-	}
-
-	_sample_rate = rate;
-	_left.reserve( length );
-	_right.reserve( length );
-	
-	_message( QString("Reading file...") );
-	std::vector<signed short> buffer(4096, 0);
-	size_t read = 0, k;
-
-	while (1) {
-	    err = mpg123_read(mh, (unsigned char*)&buffer[0], buffer.size(), &read);
-	    if (err != MPG123_OK && err != MPG123_DONE)
-		break;
-	    if (read > 0) {
-		read /= sizeof(signed short);
-		for(k = 0; k < read ; k++) {
-		    unsigned int mod = k % channels;
-		    if( mod == 0 ) {
-			_left.push_back( (float)buffer[k] / 32768.0f );
-		    }
-		    if( mod == 1 || channels == 1 ) {
-			_right.push_back( (float)buffer[k] / 32768.0f );
+    void Engine::_feed_stretcher()
+    {
+	uint32_t feed;
+
+	// Determine how much data to push into the stretcher
+	int32_t write_space, written, input_frames;
+	write_space = _stretcher->available_write();
+	written = _stretcher->written();
+	if(written < int32_t(_stretcher->feed_block_min())
+	   && write_space >= int32_t(_stretcher->feed_block_max()) ) {
+	    input_frames = _stretcher->feed_block_max();
+	} else {
+	    input_frames = 0;
+	}
+
+	// Push data into the stretcher, observing A/B loop points
+	while( input_frames > 0 ) {
+	    feed = input_frames;
+	    if( looping() && ((_position + feed) >= _loop_b) ) {
+		if( _position >= _loop_b ) {
+		    _position = _loop_a;
+		    if( _loop_a + feed > _loop_b ) {
+			assert(_loop_b > _loop_a );
+			feed = _loop_b - _loop_a;
 		    }
-		    /* remaining channels ignored */
+		} else {
+		    assert( _loop_b >= _position );
+		    feed = _loop_b - _position;
 		}
 	    }
-	    if (err == MPG123_DONE)
-		break;
-	};
-
-	if (err == MPG123_NEED_MORE) {
-	    _error( QString("Warning: premature end of MP3 stream"));
-	    /* allow user to play what we did manage to read */
-	} else if (err != MPG123_DONE) {
-	    _error( QString("Error decoding file: %1.")
-		    .arg(err == MPG123_ERR ? mpg123_strerror(mh) : mpg123_plain_strerror(err)));
-	    goto mpg123error;
+	    if( _position > _left.size() ) {
+		_position = _left.size();
+	    }
+	    if( _position + feed > _left.size() ) {
+		feed = _left.size() - _position;
+		input_frames = feed;
+	    }
+	    _stretcher->write_audio( &_left[_position], &_right[_position], feed );
+	    _latency.fed(_position, feed, _time_ratio);
+	    _position += feed;
+	    assert( uint32_t(input_frames) >= feed );
+	    input_frames -= feed;
+	    if( looping() && _position >= _loop_b ) {
+		_position = _loop_a;
+	    }
 	}
+    }
 
-	mpg123_close(mh);
-	mpg123_delete(mh);
-	mpg123_exit();
-	return true;
+    /**
+     * When freewheeling (or when the audio system has plenty
+     * buffered, like after a rewind) nobody is waiting on the
+     * output, so keep feeding the stretcher and wait for it to
+     * produce nframes instead of outputting silence.  Gives up after
+     * about max_usecs in case the worker thread is stuck.
+     *
+     * MUTEX MUST ALREADY BE LOCKED
+     *
+     * \return the stretcher's available_read()
+     */
+    uint32_t Engine::_wait_for_stretcher(uint32_t nframes, unsigned long max_usecs)
+    {
+	uint32_t read_space = _stretcher->available_read();
+	unsigned long tries = max_usecs / 100;
+
+	while( (read_space < nframes) && (_position < _left.size()) && tries-- ) {
+	    _feed_stretcher();
+	    _stretcher->nudge();
+	    usleep(100);
+	    read_space = _stretcher->available_read();
+	}
+	return read_space;
     }
 
     /**
@@ -433,14 +674,24 @@ namespace StretchPlayer
     {
 	QMutexLocker lk(&_audio_lock);
 	stop();
+	// We have the lock, so stop now instead of waiting for the
+	// audio thread.  Nothing about the old song may carry over.
+	_playing = false;
+	_stop_pressed.fetchAndStoreOrdered(0);
+	_hit_end = false;
 	_left.clear();
 	_right.clear();
 	_position = 0;
 	_output_position = 0;
+	_latency.reset(0);
 	_stretcher->reset();
 
-	if( ! _load_song_using_libsndfile(filename) &&
-	    ! _load_song_using_libmpg123(filename) )
+	if( ! StretchPlayer::load_song( filename,
+					_left,
+					_right,
+					_sample_rate,
+					Engine::static_loader_callback,
+					this ) )
 	    return QString();
 
 	QFileInfo f_info(filename);
@@ -449,49 +700,114 @@ namespace StretchPlayer
 
     void Engine::play()
     {
+	if( _transport ) {
+	    _audio_system->transport_start();
+	    return;
+	}
+	if( _stop_pressed.fetchAndStoreOrdered(0) ) {
+	    // Still playing.  Just don't stop.
+	    return;
+	}
 	if( ! _playing ) {
 	    _state_changed = true;
 	    _playing = true;
+	    _request_rewind();
 	}
     }
 
     void Engine::play_pause()
     {
-	_playing = (_playing) ? false : true;
-	_state_changed = true;
+	if( _playing ) {
+	    stop();
+	} else {
+	    play();
+	}
     }
 
     void Engine::stop()
     {
+	if( _transport ) {
+	    _audio_system->transport_stop();
+	    return;
+	}
 	if( _playing ) {
+	    // The audio thread stops where the listener is (see
+	    // _handle_stop()).
+	    _stop_pressed.fetchAndStoreOrdered(1);
+	}
+    }
+
+    /**
+     * Pick up where the listener was, not where the stretcher was.
+     *
+     * AUDIO LOCK MUST BE HELD.  Called from the audio thread, since
+     * it moves _output_position out from under _process_playing().
+     * The rewind is requested only after that, so that
+     * rewind_callback() doesn't move it first.
+     */
+    void Engine::_handle_stop()
+    {
+	if( _playing ) {
+	    unsigned long heard = _heard_position();
 	    _playing = false;
+	    _output_position = heard;
 	    _state_changed = true;
+	    _request_rewind();
 	}
     }
 
     float Engine::get_position()
     {
-	if(_left.size() > 0) {
-	    return float(_output_position) / _sample_rate;
-	}
-	return 0;
+	return get_state().position;
     }
 
     void Engine::loop_ab()
     {
 	_loop_ab_pressed.fetchAndAddRelaxed(1);
+	_request_rewind();
+    }
+
+    /**
+     * Ask the audio system to drop what it has buffered ahead, so
+     * that a change is heard right away.
+     */
+    void Engine::_request_rewind()
+    {
+	_audio_system->request_rewind();
+    }
+
+    /**
+     * The speed or pitch changed, and with it the stretcher's
+     * latency.  Let the audio system pass it on.
+     */
+    void Engine::_latency_changed()
+    {
+	_audio_system->latency_changed();
+    }
+
+    /**
+     * The song position that is coming out of the speakers now:
+     * back through the stretcher's latency and everything that
+     * the audio system has queued after it.  Exact across loop
+     * jumps and speed changes (see LatencyTracker).
+     */
+    unsigned long Engine::_heard_position()
+    {
+	unsigned long pos = _output_position;
+	if( _playing && !_state_changed ) {
+	    pos = _latency.position( double(_stretcher_latency)
+				     + _audio_system->output_delay() );
+	}
+	return pos;
     }
 
     void Engine::_handle_loop_ab()
     {
 	while( _loop_ab_pressed > 0 ) {
-	    uint32_t pos, lat;
-	    uint32_t pressed_frame, seg_frame;
+	    uint32_t pos;
 
 	    assert( _stretcher->time_ratio() > 0 );
-	    pos = _output_position;
-
-	    if(pos > lat) pos -= lat;
+	    pos = _heard_position();
 
 	    if( _loop_b > _loop_a ) {
 		_loop_b = 0;
@@ -516,19 +832,22 @@ namespace StretchPlayer
 
     float Engine::get_length()
     {
-	if(_left.size() > 0) {
-	    return float(_left.size()) / _sample_rate;
-	}
-	return 0;
+	return get_state().length;
     }
 
     void Engine::locate(double secs)
     {
 	unsigned long pos = secs * _sample_rate;
+	if( _transport ) {
+	    // Transport frames run at the current speed
+	    _audio_system->transport_locate( secs * _audio_system->sample_rate() / _stretch );
+	    return;
+	}
 	QMutexLocker lk(&_audio_lock);
 	_output_position = _position = pos;
 	_state_changed = true;
 	_stretcher->reset();
+	_request_rewind();
     }
 
     void Engine::_dispatch_message(const Engine::callback_seq_t& seq, const QString& msg) const
@@ -569,76 +888,9 @@ namespace StretchPlayer
 	return  audio_load + worker_load;
     }
 
-    /* SIMD code for optimizing the gain application.
-     *
-     * Below is vectorized (SSE, SIMD) code for applying
-     * the gain.  If you enable >= SSE2 optimization, then
-     * this will calculate 4 floats at a time.  If you do
-     * not, then it will still work.
-     *
-     * This syntax is a GCC extension, but more portable
-     * than writing x86 assembly.
-     */
-
-    typedef float __vf4 __attribute__((vector_size(16)));
-    typedef union {
-	float f[4];
-	__vf4 v;
-    } vf4;
-
-    /**
-     * \brief Multiply each element in a buffer by a scalar.
-     *
-     * For each element in buf[0..nframes-1], buf[i] *= gain.
-     *
-     * This function detects the buffer alignment, and if it's 4-byte
-     * aligned and SSE optimization is enabled, it will use the
-     * optimized code-path.  However, it will still work with 1-byte
-     * aligned buffers.
-     *
-     * \param buf - Pointer to a buffer of floats.
-     */
-    static void apply_gain_to_buffer(float *buf, uint32_t nframes, float gain)
+    unsigned long Engine::get_xruns_last_minute()
     {
-	vf4* opt;
-	vf4 gg = {gain, gain, gain, gain};
-	int alignment;
-	unsigned ctr = nframes/4;
-
-	alignment = (((int)buf)%16);
-
-	switch(alignment) {
-	case 4: (*buf++) *= gain;
-	case 8: (*buf++) *= gain;
-	case 12:(*buf++) *= gain;
-	    --ctr;
-	case 0:
-	    break;
-	default:
-	  goto LAME;
-	}
-
-	assert( (((int)buf)&0xf) == 0 );
-	opt = (vf4*) buf;
-	while(ctr--) {
-	    opt->v *= gg.v; ++opt;
-	}
-
-	buf = (float*) opt;
-	switch(alignment) {
-	case 12: (*buf++) *= gain;
-	case 8:  (*buf++) *= gain;
-	case 4:  (*buf++) *= gain;
-	}
-
-	return;
-
-    LAME:
-	// If it's not even 4-byte aligned
-	// then this is is the un-optimized code.
-	while(nframes--) {
-	  (*buf++) *= gain;
-	}
+	return _audio_system->xruns_last_minute();
     }
 
 } // namespace StretchPlayer
@@ -21,6 +21,10 @@
 
 #include <stdint.h>
 #include <memory>
+#include "LatencyTracker.hpp"
+#include "AudioSystem.hpp"
+#include "OutputRouter.hpp"
+#include "Snapshot.hpp"
 #include <QString>
 #include <QMutex>
 #include <QAtomicInt>
@@ -32,15 +36,46 @@ namespace StretchPlayer
 
 class Configuration;
 class EngineMessageCallback;
-class AudioSystem;
 class RubberBandServer;
+class CaptureWriter;
 
 class Engine
 {
 public:
     Engine(Configuration *config = 0);
+
+    /**
+     * Use audio_system instead of the driver from the
+     * configuration.  It must not have been init()'ed yet.  The
+     * Engine takes ownership of it.
+     */
+    Engine(AudioSystem *audio_system, Configuration *config = 0);
     ~Engine();
 
+    /**
+     * Everything the GUI shows, as of one process cycle.
+     */
+    struct state_t {
+	float position; // Audible position (secs)
+	float length;   // secs, 0 if nothing is loaded
+	float loop_a;   // secs
+	float loop_b;   // secs, same as loop_a if not looping
+	float stretch;
+	int pitch;
+	float volume;
+	float cpu_load; // See get_cpu_load()
+	unsigned long xruns_last_minute;
+	unsigned long underruns;
+	bool playing;
+	double stamp; // When position was heard (monotonic secs)
+    };
+
+    /**
+     * The state that the audio thread published last, with the
+     * position moved on to now.  Lock-free, and never torn.
+     */
+    state_t get_state() const;
+
     QString load_song(const QString& filename);
     void play();
     void play_pause();
@@ -63,6 +98,8 @@ public:
 	if(str > 0.2499 && str < 1.2501) {  /* would be 'if(str >= 0.25 && str <= 1.25)', but floating point is tricky... */
 	    _stretch = str;
 	    //_state_changed = true;
+	    _request_rewind();
+	    _latency_changed();
 	}
     }
     int get_pitch() {
@@ -77,6 +114,8 @@ public:
 	    _pitch = pit;
 	}
 	//_state_changed = true;
+	_request_rewind();
+	_latency_changed();
     }
 
     /**
@@ -86,17 +125,53 @@ public:
 	if(gain < 0.0) gain = 0.0;
 	if(gain > 10.0) gain = 10.0;
 	_gain=gain;
+	_request_rewind();
     }
 
     float get_volume() {
 	return _gain;
     }
 
+    /**
+     * Number of audio outputs.  The volume applies to all of them.
+     */
+    unsigned output_count() {
+	return _router.outputs();
+    }
+
+    /**
+     * How much of source (0 = left, 1 = right) goes to output.
+     * See OutputRouter.
+     */
+    void set_output_gain(unsigned output, unsigned source, float gain) {
+	_router.set_gain(output, source, gain);
+	_request_rewind();
+    }
+
+    float get_output_gain(unsigned output, unsigned source) {
+	return _router.gain(output, source);
+    }
+
     /**
      * Returns estimate of CPU load [0.0, 1.0]
      */
     float get_cpu_load();
 
+    /**
+     * Number of xruns that the audio driver had in the last
+     * minute.
+     */
+    unsigned long get_xruns_last_minute();
+
+    /**
+     * Number of process cycles that output silence because the
+     * stretcher fell behind (not counting the start-up latency
+     * after play or locate).
+     */
+    unsigned long get_underruns() {
+	return _underruns;
+    }
+
     void subscribe_errors(EngineMessageCallback* obj) {
 	_subscribe_list(_error_callbacks, obj);
     }
@@ -111,23 +186,52 @@ public:
     }
 
 private:
-    static int static_process_callback(uint32_t nframes, void* arg) {
+    static int static_process_callback(const AudioSystem::cycle_t& cycle, void* arg) {
 	Engine *e = static_cast<Engine*>(arg);
-	return e->process_callback(nframes);
+	return e->process_callback(cycle);
     }
     static int static_segment_size_callback(uint32_t nframes, void* arg) {
 	Engine *e = static_cast<Engine*>(arg);
 	return e->segment_size_callback(nframes);
     }
+    static int static_rewind_callback(uint32_t nframes, void* arg) {
+	Engine *e = static_cast<Engine*>(arg);
+	return e->rewind_callback(nframes);
+    }
+    static uint32_t static_latency_callback(void* arg) {
+	Engine *e = static_cast<Engine*>(arg);
+	return e->latency_callback();
+    }
 
-    int process_callback(uint32_t nframes);
+    static void static_loader_callback(const QString& msg, bool is_error, void* arg) {
+	Engine *e = static_cast<Engine*>(arg);
+	if(is_error) {
+	    e->_error(msg);
+	} else {
+	    e->_message(msg);
+	}
+    }
+
+    int process_callback(const AudioSystem::cycle_t& cycle);
     int segment_size_callback(uint32_t nframes);
+    int rewind_callback(uint32_t nframes);
+    uint32_t latency_callback();
 
-    void _zero_buffers(uint32_t nframes);
-    void _process_playing(uint32_t nframes);
-    bool _load_song_using_libsndfile(const QString &filename);
-    bool _load_song_using_libmpg123(const QString &filename);
+    void _init();
+    void _publish_state(bool locked);
+    void _zero_buffers(const AudioSystem::cycle_t& cycle);
+    void _process_playing(const AudioSystem::cycle_t& cycle);
+    void _feed_stretcher();
+    uint32_t _wait_for_stretcher(uint32_t nframes, unsigned long max_usecs);
     void _handle_loop_ab();
+    void _handle_stop();
+    void _rewound(uint32_t nframes);
+    void _follow_transport(uint32_t nframes);
+    void _capture_cycle(const AudioSystem::cycle_t& cycle);
+    void _end_take();
+    void _request_rewind();
+    void _latency_changed();
+    unsigned long _heard_position();
 
     typedef std::set<EngineMessageCallback*> callback_seq_t;
 
@@ -145,6 +249,8 @@ private:
     bool _playing;
     bool _hit_end;
     bool _state_changed;
+    bool _primed;
+    unsigned long _underruns;
     mutable QMutex _audio_lock;
     std::vector<float> _left;
     std::vector<float> _right;
@@ -152,6 +258,8 @@ private:
     unsigned long _loop_a;
     unsigned long _loop_b;
     QAtomicInt _loop_ab_pressed;
+    QAtomicInt _stop_pressed;
+    QAtomicInt _rewound_pending; // Frames rewound while we didn't have the lock
     float _sample_rate;
     float _stretch;
     int _pitch;
@@ -159,8 +267,31 @@ private:
     std::auto_ptr<RubberBandServer> _stretcher;
     std::auto_ptr<AudioSystem> _audio_system;
 
+    /* Stretcher output, and where it goes */
+    std::vector<float> _src_L;
+    std::vector<float> _src_R;
+    OutputRouter _router;
+
     /* Latency tracking */
-    unsigned long _output_position;
+    unsigned long _output_position; // Song frame of the next output frame
+    float _time_ratio; // Output frames per input frame
+    volatile uint32_t _stretcher_latency; // Output frames
+    LatencyTracker _latency;
+
+    /* Following the audio system's transport */
+    bool _transport;
+    bool _transport_rolling;
+    uint32_t _transport_frame; // Where it should be next cycle
+
+    /* Recording the inputs (see _capture_cycle()) */
+    std::auto_ptr<CaptureWriter> _capture;
+    bool _capture_rolling; // A take is open
+    double _capture_next; // Song frame expected at the next cycle's input
+    float _capture_ratio; // _time_ratio that the take started at
+
+    /* For the GUI (see get_state()) */
+    state_t _state; // Audio thread's working copy
+    Snapshot<state_t> _published;
 
     mutable QMutex _callback_lock;
     callback_seq_t _error_callbacks;
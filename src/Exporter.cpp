@@ -0,0 +1,467 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "Exporter.hpp"
+#include <rubberband/RubberBandStretcher.h>
+#include <sndfile.h>
+#include <QString>
+#include <QFileInfo>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <vector>
+#include <cassert>
+#include <cstring>
+#include <cmath>
+
+using RubberBand::RubberBandStretcher;
+
+namespace StretchPlayer
+{
+    namespace Details
+    {
+	/**
+	 * Shared state between the writer (caller of render()) and
+	 * the segment workers.
+	 */
+	struct ExportSync
+	{
+	    QMutex mutex;
+	    QWaitCondition done;
+	};
+
+	/**
+	 * \brief Stretches one segment of the song in a worker thread.
+	 */
+	class ExportSegment : public QRunnable
+	{
+	public:
+	    ExportSegment(ExportSync *sync,
+			  const float *left,
+			  const float *right,
+			  unsigned long nframes,
+			  uint32_t sample_rate,
+			  float time_ratio,
+			  float pitch_scale) :
+		_sync(sync),
+		_sample_rate(sample_rate),
+		_nframes(nframes),
+		_time_ratio(time_ratio),
+		_pitch_scale(pitch_scale),
+		_finished(false),
+		_failed(false)
+		{
+		    _in[0] = left;
+		    _in[1] = right;
+		    setAutoDelete(false);
+		}
+
+	    virtual ~ExportSegment() {}
+
+	    virtual void run();
+
+	    // Only valid after finished() returns true.
+	    std::vector<float> out_left;
+	    std::vector<float> out_right;
+
+	    // Must lock _sync->mutex to call these.
+	    bool finished() const { return _finished; }
+	    bool failed() const { return _failed; }
+
+	private:
+	    void _drain(RubberBandStretcher& s, float **bufs, size_t bufsize);
+
+	    ExportSync *_sync;
+	    const float *_in[2];
+	    uint32_t _sample_rate;
+	    unsigned long _nframes;
+	    float _time_ratio;
+	    float _pitch_scale;
+	    bool _finished;
+	    bool _failed;
+	};
+
+	void ExportSegment::_drain(RubberBandStretcher& s, float **bufs, size_t bufsize)
+	{
+	    int avail;
+	    size_t got;
+	    while( (avail = s.available()) > 0 ) {
+		got = s.retrieve(bufs, (size_t(avail) < bufsize) ? avail : bufsize);
+		out_left.insert( out_left.end(), bufs[0], bufs[0] + got );
+		out_right.insert( out_right.end(), bufs[1], bufs[1] + got );
+	    }
+	}
+
+	void ExportSegment::run()
+	{
+	    const size_t BLOCK = 4096;
+	    bool failed = false;
+
+	    try {
+		RubberBandStretcher s( _sample_rate,
+				       2,
+				       RubberBandStretcher::OptionProcessOffline
+				       | RubberBandStretcher::OptionThreadingNever,
+				       _time_ratio,
+				       _pitch_scale );
+		s.setExpectedInputDuration(_nframes);
+		s.setMaxProcessSize(BLOCK);
+
+		std::vector<float> left(BLOCK), right(BLOCK);
+		float *bufs[2] = { &left[0], &right[0] };
+		const float *in[2];
+		unsigned long pos, n;
+		bool final;
+
+		out_left.reserve( size_t(_nframes * _time_ratio) + BLOCK );
+		out_right.reserve( size_t(_nframes * _time_ratio) + BLOCK );
+
+		for( pos = 0 ; pos < _nframes ; pos += n ) {
+		    n = _nframes - pos;
+		    if(n > BLOCK) n = BLOCK;
+		    final = (pos + n) >= _nframes;
+		    in[0] = _in[0] + pos;
+		    in[1] = _in[1] + pos;
+		    s.study(in, n, final);
+		}
+
+		for( pos = 0 ; pos < _nframes ; pos += n ) {
+		    n = _nframes - pos;
+		    if(n > BLOCK) n = BLOCK;
+		    final = (pos + n) >= _nframes;
+		    in[0] = _in[0] + pos;
+		    in[1] = _in[1] + pos;
+		    s.process(in, n, final);
+		    _drain(s, bufs, BLOCK);
+		}
+
+		// available() returns -1 when everything is retrieved.
+		while( s.available() >= 0 ) {
+		    _drain(s, bufs, BLOCK);
+		    if( s.available() == 0 )
+			QThread::yieldCurrentThread();
+		}
+	    } catch (...) {
+		failed = true;
+	    }
+
+	    QMutexLocker lk(&_sync->mutex);
+	    _failed = failed;
+	    _finished = true;
+	    _sync->done.wakeAll();
+	}
+
+	static int sndfile_format_for(const QString& filename)
+	{
+	    QString ext = QFileInfo(filename).suffix().toLower();
+
+	    if( ext == "flac" )
+		return SF_FORMAT_FLAC | SF_FORMAT_PCM_16;
+	    if( ext == "ogg" || ext == "oga" )
+		return SF_FORMAT_OGG | SF_FORMAT_VORBIS;
+	    if( ext == "aif" || ext == "aiff" )
+		return SF_FORMAT_AIFF | SF_FORMAT_PCM_16;
+	    return SF_FORMAT_WAV | SF_FORMAT_PCM_16;
+	}
+
+	/**
+	 * Interleave and write count frames to the file.
+	 *
+	 * \return true on success
+	 */
+	static bool write_frames(SNDFILE *sf,
+				 const float *left,
+				 const float *right,
+				 unsigned long count)
+	{
+	    const unsigned long CHUNK = 4096;
+	    float buf[2 * CHUNK];
+	    unsigned long n, k;
+
+	    while( count ) {
+		n = (count < CHUNK) ? count : CHUNK;
+		for( k = 0 ; k < n ; ++k ) {
+		    buf[2*k] = left[k];
+		    buf[2*k+1] = right[k];
+		}
+		if( sf_writef_float(sf, buf, n) != sf_count_t(n) )
+		    return false;
+		left += n;
+		right += n;
+		count -= n;
+	    }
+	    return true;
+	}
+
+    } // namespace Details
+
+    using namespace Details;
+
+    Exporter::Exporter(const float *left,
+		       const float *right,
+		       unsigned long nframes,
+		       uint32_t sample_rate) :
+	_left(left),
+	_right(right),
+	_nframes(nframes),
+	_sample_rate(sample_rate),
+	_time_ratio(1.0),
+	_pitch_scale(1.0),
+	_threads(0),
+	_segment_size(1L<<18),
+	_overlap(1L<<13),
+	_frames_written(0)
+    {
+    }
+
+    Exporter::~Exporter()
+    {
+    }
+
+    void Exporter::time_ratio(float val)
+    {
+	_time_ratio = val;
+    }
+
+    float Exporter::time_ratio() const
+    {
+	return _time_ratio;
+    }
+
+    void Exporter::pitch_scale(float val)
+    {
+	_pitch_scale = val;
+    }
+
+    float Exporter::pitch_scale() const
+    {
+	return _pitch_scale;
+    }
+
+    void Exporter::threads(unsigned n)
+    {
+	_threads = n;
+    }
+
+    unsigned Exporter::threads() const
+    {
+	return _threads;
+    }
+
+    void Exporter::segment_size(unsigned long nframes)
+    {
+	_segment_size = nframes;
+    }
+
+    unsigned long Exporter::segment_size() const
+    {
+	return _segment_size;
+    }
+
+    void Exporter::overlap(unsigned long nframes)
+    {
+	_overlap = nframes;
+    }
+
+    unsigned long Exporter::overlap() const
+    {
+	return _overlap;
+    }
+
+    unsigned long Exporter::frames_written() const
+    {
+	return _frames_written;
+    }
+
+    int Exporter::render(const QString& filename, QString *err_msg)
+    {
+	QString err;
+	SNDFILE *sf = 0;
+	SF_INFO sf_info;
+	ExportSync sync;
+	QThreadPool pool;
+	std::vector<ExportSegment*> segs;
+	std::vector<float> tail_l, tail_r;
+	unsigned long seg_size, overlap, nsegs, k, submitted;
+	unsigned window;
+	int threads;
+	double r = _time_ratio;
+
+	_frames_written = 0;
+	submitted = 0;
+
+	if( _nframes == 0 || _left == 0 || _right == 0 ) {
+	    err = "There is no audio to export.";
+	    goto render_bail;
+	}
+	if( r <= 0.0 || _pitch_scale <= 0.0 ) {
+	    err = "Invalid stretch or pitch ratio.";
+	    goto render_bail;
+	}
+
+	seg_size = _segment_size;
+	if( seg_size < 4096 ) seg_size = 4096;
+	overlap = _overlap;
+	if( overlap > seg_size/2 ) overlap = seg_size/2;
+	nsegs = (_nframes + seg_size - 1) / seg_size;
+
+	threads = _threads;
+	if( threads <= 0 ) threads = QThread::idealThreadCount();
+	if( threads <= 0 ) threads = 1;
+	pool.setMaxThreadCount(threads);
+
+	memset(&sf_info, 0, sizeof(sf_info));
+	sf_info.samplerate = _sample_rate;
+	sf_info.channels = 2;
+	sf_info.format = sndfile_format_for(filename);
+	sf = sf_open(filename.toLocal8Bit().data(), SFM_WRITE, &sf_info);
+	if( !sf ) {
+	    err = QString("Error opening file '%1' for writing: %2")
+		.arg(filename)
+		.arg( sf_strerror(0) );
+	    goto render_bail;
+	}
+	sf_command(sf, SFC_SET_CLIPPING, 0, SF_TRUE);
+
+	// Each segment starts 'overlap' frames before its nominal
+	// start (except the first), so that it can be crossfaded with
+	// the tail of the segment before it.
+	segs.resize(nsegs, 0);
+	for( k = 0 ; k < nsegs ; ++k ) {
+	    unsigned long beg = k * seg_size;
+	    unsigned long end = beg + seg_size;
+	    if( end > _nframes ) end = _nframes;
+	    if( k > 0 ) beg -= overlap;
+	    segs[k] = new ExportSegment( &sync,
+					 _left + beg,
+					 _right + beg,
+					 end - beg,
+					 _sample_rate,
+					 _time_ratio,
+					 _pitch_scale );
+	}
+
+	// Keep a bounded number of segments in flight so that
+	// memory doesn't balloon on long songs.
+	window = 2 * threads;
+	while( submitted < nsegs && submitted < window ) {
+	    pool.start(segs[submitted]);
+	    ++submitted;
+	}
+
+	for( k = 0 ; k < nsegs ; ++k ) {
+	    ExportSegment *seg = segs[k];
+	    bool failed;
+
+	    sync.mutex.lock();
+	    while( ! seg->finished() )
+		sync.done.wait(&sync.mutex);
+	    failed = seg->failed();
+	    sync.mutex.unlock();
+
+	    if( submitted < nsegs ) {
+		pool.start(segs[submitted]);
+		++submitted;
+	    }
+
+	    if( failed ) {
+		err = QString("Time stretching failed for segment %1").arg(k);
+		goto render_bail;
+	    }
+
+	    // Map the input span onto the output timeline.
+	    unsigned long nom_beg = k * seg_size;
+	    unsigned long nom_end = nom_beg + seg_size;
+	    if( nom_end > _nframes ) nom_end = _nframes;
+	    unsigned long in_beg = (k > 0) ? (nom_beg - overlap) : 0;
+	    unsigned long out_beg = ::lrint(in_beg * r);
+	    unsigned long out_end = ::lrint(nom_end * r);
+	    unsigned long out_len = out_end - out_beg;
+	    unsigned long fade_in = tail_l.size();
+	    unsigned long fade_out = 0;
+	    unsigned long i;
+
+	    if( k + 1 < nsegs ) {
+		fade_out = out_end - ::lrint((nom_end - overlap) * r);
+	    }
+
+	    // Offline RubberBand hits the expected length to within a
+	    // few frames.  Pad or trim to the exact nominal length.
+	    seg->out_left.resize(out_len, 0.0f);
+	    seg->out_right.resize(out_len, 0.0f);
+
+	    if( fade_in > out_len ) fade_in = out_len;
+	    if( fade_in + fade_out > out_len ) fade_out = out_len - fade_in;
+
+	    // Overlap-add with the held-back tail of the previous
+	    // segment using a raised-cosine (sin^2 + cos^2 == 1)
+	    // crossfade.
+	    for( i = 0 ; i < fade_in ; ++i ) {
+		double w = ::sin( M_PI_2 * (double(i) + 0.5) / double(fade_in) );
+		w *= w;
+		seg->out_left[i] = tail_l[i] * (1.0 - w) + seg->out_left[i] * w;
+		seg->out_right[i] = tail_r[i] * (1.0 - w) + seg->out_right[i] * w;
+	    }
+
+	    if( ! write_frames( sf,
+				&seg->out_left[0],
+				&seg->out_right[0],
+				out_len - fade_out ) ) {
+		err = QString("Error writing to file '%1': %2")
+		    .arg(filename)
+		    .arg( sf_strerror(sf) );
+		goto render_bail;
+	    }
+	    _frames_written += out_len - fade_out;
+
+	    tail_l.assign( seg->out_left.begin() + (out_len - fade_out),
+			   seg->out_left.end() );
+	    tail_r.assign( seg->out_right.begin() + (out_len - fade_out),
+			   seg->out_right.end() );
+
+	    delete seg;
+	    segs[k] = 0;
+	}
+
+	sf_close(sf);
+	return 0;
+
+    render_bail:
+	if(err_msg) {
+	    *err_msg = err;
+	}
+	// Segments that were never handed to the pool can be deleted
+	// now.  The rest must finish before they can be cleaned up.
+	for( k = submitted ; k < segs.size() ; ++k ) {
+	    delete segs[k];
+	    segs[k] = 0;
+	}
+	pool.waitForDone();
+	for( k = 0 ; k < segs.size() ; ++k ) {
+	    delete segs[k];
+	}
+	if(sf) {
+	    sf_close(sf);
+	}
+	return 0xDEADBEEF;
+    }
+
+} // namespace StretchPlayer
@@ -0,0 +1,102 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef EXPORTER_HPP
+#define EXPORTER_HPP
+
+#include <stdint.h>
+
+class QString;
+
+namespace StretchPlayer
+{
+    /**
+     * \brief Offline (faster than real-time) renderer for a whole song.
+     *
+     * A single stretcher can only use one core, so the song is split
+     * into segments that overlap their neighbors by overlap() input
+     * frames.  Each segment is stretched by its own offline
+     * RubberBandStretcher on a thread pool, and the segments are
+     * stitched back together with a raised-cosine crossfade over the
+     * overlapping region.  Segments are written to the file in order
+     * as soon as they (and all the segments before them) are done.
+     *
+     * This is designed for a stereo setup only.  The source buffers
+     * must remain valid and unchanged while render() is running.
+     */
+    class Exporter
+    {
+    public:
+	Exporter(const float *left,
+		 const float *right,
+		 unsigned long nframes,
+		 uint32_t sample_rate);
+	~Exporter();
+
+	/**
+	 * Output duration / input duration.  (2.0 == half speed)
+	 */
+	void time_ratio(float val);
+	float time_ratio() const;
+	void pitch_scale(float val);
+	float pitch_scale() const;
+
+	/**
+	 * Number of worker threads.  0 means one per core.
+	 */
+	void threads(unsigned n);
+	unsigned threads() const;
+
+	/**
+	 * Nominal segment length and overlap, in input frames.
+	 */
+	void segment_size(unsigned long nframes);
+	unsigned long segment_size() const;
+	void overlap(unsigned long nframes);
+	unsigned long overlap() const;
+
+	/**
+	 * Render the whole song to filename.  The file type is
+	 * chosen by the file extension (.wav, .flac, .aiff, .ogg), and
+	 * defaults to WAV.  Not real-time safe... not even close.
+	 *
+	 * \return 0 on success, nonzero on error.
+	 */
+	int render(const QString& filename, QString *err_msg = 0);
+
+	/**
+	 * Number of output frames written by the last render().
+	 */
+	unsigned long frames_written() const;
+
+    private:
+	const float *_left;
+	const float *_right;
+	unsigned long _nframes;
+	uint32_t _sample_rate;
+	float _time_ratio;
+	float _pitch_scale;
+	unsigned _threads;
+	unsigned long _segment_size;
+	unsigned long _overlap;
+	unsigned long _frames_written;
+    };
+
+} // namespace StretchPlayer
+
+#endif // EXPORTER_HPP
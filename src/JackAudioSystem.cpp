@@ -23,16 +23,21 @@
 #include <cstring>
 #include <cstdlib>
 #include <jack/jack.h>
+#include <jack/transport.h>
 #include <QString>
 
 namespace StretchPlayer
 {
     JackAudioSystem::JackAudioSystem() :
 	_client(0),
-	_config(0)
+	_config(0),
+	_app_process_callback(0),
+	_app_process_callback_arg(0),
+	_app_latency_callback(0),
+	_app_latency_callback_arg(0),
+	_transport(false),
+	_freewheeling(false)
     {
-	_port[0] = 0;
-	_port[1] = 0;
     }
 
     JackAudioSystem::~JackAudioSystem()
@@ -42,13 +47,20 @@ namespace StretchPlayer
 
     int JackAudioSystem::init(QString * app_name, Configuration *config, QString *err_msg)
     {
-	QString name("StretchPlayer"), err;
+	QString name("StretchPlayer"), err, port_name;
+	unsigned outputs, inputs, k;
 
 	if(config == 0) {
 	    err = "The JackAudioSystem::init() function must have a non-null config parameter.";
 	    goto init_bail;
 	}
 	_config = config;
+	outputs = config->outputs();
+	if(outputs < 2) {
+	    outputs = 2;
+	}
+	inputs = config->inputs();
+	_transport = config->jack_transport();
 
 	if(app_name) {
 	    name = *app_name;
@@ -60,26 +72,48 @@ namespace StretchPlayer
 	    goto init_bail;
 	}
 
-	_port[0] = jack_port_register( _client,
-					"left",
-					JACK_DEFAULT_AUDIO_TYPE,
-					JackPortIsOutput,
-					0 );
-	if(!_port[0]) {
-	    err = "Could not set up left out";
-	    goto init_bail;
+	_port.assign(outputs, 0);
+	_buf.assign(outputs, 0);
+	for( k=0 ; k<outputs ; ++k ) {
+	    if( k == 0 ) {
+		port_name = "left";
+	    } else if( k == 1 ) {
+		port_name = "right";
+	    } else {
+		port_name = QString("out%1").arg(k + 1);
+	    }
+	    _port[k] = jack_port_register( _client,
+					   port_name.toAscii(),
+					   JACK_DEFAULT_AUDIO_TYPE,
+					   JackPortIsOutput,
+					   0 );
+	    if(!_port[k]) {
+		err = QString("Could not set up output '%1'").arg(port_name);
+		goto init_bail;
+	    }
 	}
 
-	_port[1] = jack_port_register( _client,
-					"right",
-					JACK_DEFAULT_AUDIO_TYPE,
-					JackPortIsOutput,
-					0 );
-	if(!_port[1]) {
-	    err = "Could not set up right out";
-	    goto init_bail;
+	_in_port.assign(inputs, 0);
+	_in_buf.assign(inputs, 0);
+	for( k=0 ; k<inputs ; ++k ) {
+	    port_name = QString("in%1").arg(k + 1);
+	    _in_port[k] = jack_port_register( _client,
+					      port_name.toAscii(),
+					      JACK_DEFAULT_AUDIO_TYPE,
+					      JackPortIsInput,
+					      0 );
+	    if(!_in_port[k]) {
+		err = QString("Could not set up input '%1'").arg(port_name);
+		goto init_bail;
+	    }
 	}
 
+	_xruns.reset();
+	jack_set_xrun_callback(_client, JackAudioSystem::_xrun_callback, this);
+	jack_set_latency_callback(_client, JackAudioSystem::_latency_callback, this);
+	_freewheeling = false;
+	jack_set_freewheel_callback(_client, JackAudioSystem::_freewheel_callback, this);
+
 	return 0;
 
     init_bail:
@@ -92,16 +126,22 @@ namespace StretchPlayer
     void JackAudioSystem::cleanup()
     {
 	deactivate();
-	if( _port[0] ) {
-	    assert(_client);
-	    jack_port_unregister(_client, _port[0]);
-	    _port[0] = 0;
+	for( unsigned k=0 ; k<_port.size() ; ++k ) {
+	    if( _port[k] ) {
+		assert(_client);
+		jack_port_unregister(_client, _port[k]);
+	    }
 	}
-	if( _port[1] ) {
-	    assert(_client);
-	    jack_port_unregister(_client, _port[1]);
-	    _port[1] = 0;
+	for( unsigned k=0 ; k<_in_port.size() ; ++k ) {
+	    if( _in_port[k] ) {
+		assert(_client);
+		jack_port_unregister(_client, _in_port[k]);
+	    }
 	}
+	_port.clear();
+	_buf.clear();
+	_in_port.clear();
+	_in_buf.clear();
 	if(_client) {
 	    jack_client_close(_client);
 	    _client = 0;
@@ -112,9 +152,11 @@ namespace StretchPlayer
     {
 	assert(_client);
 
+	_app_process_callback = cb;
+	_app_process_callback_arg = arg;
 	int rv = jack_set_process_callback( _client,
-					    cb,
-					    arg );
+					    JackAudioSystem::_process_callback,
+					    this );
 	if(rv && err_msg) {
 	    *err_msg = "Could not set up jack callback.";
 	}
@@ -137,32 +179,23 @@ namespace StretchPlayer
     int JackAudioSystem::activate(QString *err_msg)
     {
 	assert(_client);
-	assert(_port[0]);
-	assert(_port[1]);
+	assert(_port.size() >= 2);
 	int rv = 0;
 
 	jack_activate(_client);
 
 	if( _config->autoconnect() ) {
-	    // Autoconnection to first two ports we find.
+	    // Autoconnection of each output to the next input we find.
 	    const char** ports = jack_get_ports( _client,
 						 0,
 						 JACK_DEFAULT_AUDIO_TYPE,
 						 JackPortIsInput
 		);
-	    int k;
-	    for( k=0 ; ports && ports[k] != 0 ; ++k ) {
-		if(k==0) {
-		    rv = jack_connect( _client,
-				       jack_port_name(_port[0]),
-				       ports[k] );
-		} else if (k==1) {
-		    rv = jack_connect( _client,
-				       jack_port_name(_port[1]),
-				       ports[k] );
-		} else {
-		    break;
-		}
+	    unsigned k;
+	    for( k=0 ; ports && ports[k] != 0 && k < _port.size() ; ++k ) {
+		rv = jack_connect( _client,
+				   jack_port_name(_port[k]),
+				   ports[k] );
 		if( rv && err_msg ) {
 		    *err_msg = "Could not connect output ports";
 		}
@@ -174,6 +207,24 @@ namespace StretchPlayer
 	    if(ports) {
 		free(ports);
 	    }
+
+	    // ...and each input from the next capture port.
+	    ports = jack_get_ports( _client,
+				    0,
+				    JACK_DEFAULT_AUDIO_TYPE,
+				    JackPortIsOutput | JackPortIsPhysical
+		);
+	    for( k=0 ; ports && ports[k] != 0 && k < _in_port.size() ; ++k ) {
+		if( jack_connect( _client,
+				  ports[k],
+				  jack_port_name(_in_port[k]) ) && err_msg ) {
+		    *err_msg = "Could not connect input ports";
+		    rv = 1;
+		}
+	    }
+	    if(ports) {
+		free(ports);
+	    }
 	}
 	return rv;
     }
@@ -187,16 +238,36 @@ namespace StretchPlayer
 	return rv;
     }
 
+    uint32_t JackAudioSystem::output_count()
+    {
+	return _port.size();
+    }
+
+    uint32_t JackAudioSystem::input_count()
+    {
+	return _in_port.size();
+    }
+
+    /**
+     * The capture latency that the graph reports for our first
+     * input, plus the period that JACK spent collecting it.
+     */
+    uint32_t JackAudioSystem::input_delay()
+    {
+	jack_latency_range_t range;
+
+	if( !_client || _in_port.empty() ) return 0;
+	jack_port_get_latency_range(_in_port[0], JackCaptureLatency, &range);
+	return range.max + jack_get_buffer_size(_client);
+    }
+
     AudioSystem::sample_t* JackAudioSystem::output_buffer(int index)
     {
 	jack_nframes_t nframes = output_buffer_size(index);
 
-	if(index == 0) {
-	    assert(_port[0]);
-	    return static_cast<float*>( jack_port_get_buffer(_port[0], nframes) );
-	}else if(index == 1) {
-	    assert(_port[1]);
-	    return static_cast<float*>( jack_port_get_buffer(_port[1], nframes) );
+	if( index >= 0 && unsigned(index) < _port.size() ) {
+	    assert(_port[index]);
+	    return static_cast<float*>( jack_port_get_buffer(_port[index], nframes) );
 	}
 	return 0;
     }
@@ -237,4 +308,174 @@ namespace StretchPlayer
 	return jack_get_buffer_size(_client);
     }
 
+    int JackAudioSystem::realtime_priority()
+    {
+	if( !_client ) return -1;
+	if( !jack_is_realtime(_client) ) return -1;
+	return jack_client_real_time_priority(_client);
+    }
+
+    bool JackAudioSystem::freewheeling()
+    {
+	return _freewheeling;
+    }
+
+    int JackAudioSystem::set_rewind_callback(rewind_callback_t, void*, QString*)
+    {
+	// Never buffers ahead, so never rewinds
+	return 0;
+    }
+
+    void JackAudioSystem::request_rewind()
+    {
+    }
+
+    uint32_t JackAudioSystem::buffered_frames()
+    {
+	return 0;
+    }
+
+    /**
+     * The rest of this period, plus the playback latency that the
+     * graph reports for our ports.
+     */
+    uint32_t JackAudioSystem::output_delay()
+    {
+	jack_latency_range_t range;
+	jack_nframes_t period, since;
+
+	if( !_client || _port.empty() ) return 0;
+	jack_port_get_latency_range(_port[0], JackPlaybackLatency, &range);
+	period = jack_get_buffer_size(_client);
+	since = jack_frames_since_cycle_start(_client);
+	return range.max + ((since < period) ? (period - since) : 0);
+    }
+
+    uint32_t JackAudioSystem::xrun_count()
+    {
+	return _xruns.count();
+    }
+
+    uint32_t JackAudioSystem::xruns_last_minute()
+    {
+	return _xruns.within(double(jack_get_time()) * 1e-6, 60.0);
+    }
+
+    /**
+     * Looks up the port buffers once, so the application doesn't
+     * have to go through output_buffer() for them.
+     */
+    int JackAudioSystem::_process_callback(jack_nframes_t nframes, void *arg)
+    {
+	JackAudioSystem *that = static_cast<JackAudioSystem*>(arg);
+	cycle_t cycle;
+
+	if( ! that->_app_process_callback )
+	    return 0;
+
+	for( unsigned k=0 ; k<that->_port.size() ; ++k ) {
+	    that->_buf[k] = static_cast<sample_t*>( jack_port_get_buffer(that->_port[k], nframes) );
+	}
+	cycle.nframes = nframes;
+	cycle.outputs = that->_buf.size();
+	cycle.out = &that->_buf[0];
+	for( unsigned k=0 ; k<that->_in_port.size() ; ++k ) {
+	    that->_in_buf[k] = static_cast<const sample_t*>( jack_port_get_buffer(that->_in_port[k], nframes) );
+	}
+	cycle.inputs = that->_in_buf.size();
+	cycle.in = cycle.inputs ? &that->_in_buf[0] : 0;
+	return that->_app_process_callback(cycle, that->_app_process_callback_arg);
+    }
+
+    int JackAudioSystem::_xrun_callback(void *arg)
+    {
+	JackAudioSystem *that = static_cast<JackAudioSystem*>(arg);
+	that->_xruns.add( double(jack_get_time()) * 1e-6 );
+	return 0;
+    }
+
+    int JackAudioSystem::set_latency_callback(latency_callback_t cb, void* arg, QString* /*err_msg*/)
+    {
+	_app_latency_callback = cb;
+	_app_latency_callback_arg = arg;
+	return 0;
+    }
+
+    void JackAudioSystem::latency_changed()
+    {
+	if( _client ) {
+	    jack_recompute_total_latencies(_client);
+	}
+    }
+
+    /**
+     * Our outputs have no inputs upstream of them, so the only
+     * latency to report is our own: how old the audio is by the
+     * time it leaves our ports.  (The playback latency that the
+     * graph works out downstream of us is read in output_delay().)
+     */
+    void JackAudioSystem::_latency_callback(jack_latency_callback_mode_t mode, void *arg)
+    {
+	JackAudioSystem *that = static_cast<JackAudioSystem*>(arg);
+	jack_latency_range_t range;
+	unsigned k;
+
+	if( mode != JackCaptureLatency )
+	    return;
+
+	range.min = range.max = 0;
+	if( that->_app_latency_callback ) {
+	    range.min = range.max = that->_app_latency_callback(that->_app_latency_callback_arg);
+	}
+	for( k=0 ; k<that->_port.size() ; ++k ) {
+	    if( that->_port[k] ) {
+		jack_port_set_latency_range(that->_port[k], JackCaptureLatency, &range);
+	    }
+	}
+    }
+
+    /**
+     * In freewheel mode JACK runs the graph as fast as it can
+     * (e.g. to export through a recorder), so the Engine may take
+     * as long as it likes to fill each buffer.
+     */
+    void JackAudioSystem::_freewheel_callback(int starting, void *arg)
+    {
+	JackAudioSystem *that = static_cast<JackAudioSystem*>(arg);
+	that->_freewheeling = (starting != 0);
+    }
+
+    bool JackAudioSystem::transport_query(bool *rolling, uint32_t *frame)
+    {
+	jack_position_t pos;
+	jack_transport_state_t state;
+
+	if( !_client || !_transport ) return false;
+	state = jack_transport_query(_client, &pos);
+	if( rolling ) *rolling = (state == JackTransportRolling);
+	if( frame ) *frame = pos.frame;
+	return true;
+    }
+
+    void JackAudioSystem::transport_start()
+    {
+	if( _client && _transport ) {
+	    jack_transport_start(_client);
+	}
+    }
+
+    void JackAudioSystem::transport_stop()
+    {
+	if( _client && _transport ) {
+	    jack_transport_stop(_client);
+	}
+    }
+
+    void JackAudioSystem::transport_locate(uint32_t frame)
+    {
+	if( _client && _transport ) {
+	    jack_transport_locate(_client, frame);
+	}
+    }
+
 } // namespace StretchPlayer
@@ -20,18 +20,21 @@
 #define JACKAUDIOSYSTEM_HPP
 
 #include <AudioSystem.hpp>
+#include <XrunLog.hpp>
 #include <jack/jack.h>
+#include <vector>
 
 namespace StretchPlayer
 {
     class Configuration;
 
     /**
-     * \brief Pure virtual interface to an audio driver API.
+     * \brief AudioSystem for JACK.
      *
-     * This AudioSystem assumes a very simple system with two audio
-     * outputs.  It maintains those ports and buffers and the
-     * connection of them.
+     * Registers Configuration::outputs() output ports: "left",
+     * "right", and then "out3", "out4"... for any extra ones.  If
+     * Configuration::inputs() is set, there are also input ports
+     * "in1", "in2"... to capture from.
      */
     class JackAudioSystem : public AudioSystem
     {
@@ -47,6 +50,9 @@ namespace StretchPlayer
 	virtual int set_segment_size_callback(segment_size_callback_t cb, void* arg, QString* err_msg = 0);
 	virtual int activate(QString *err_msg = 0);
 	virtual int deactivate(QString *err_msg = 0);
+	virtual uint32_t output_count();
+	virtual uint32_t input_count();
+	virtual uint32_t input_delay();
 	virtual sample_t* output_buffer(int index);
 	virtual uint32_t output_buffer_size(int index);
 	virtual uint32_t sample_rate();
@@ -54,11 +60,41 @@ namespace StretchPlayer
 	virtual uint32_t time_stamp();
 	virtual uint32_t segment_start_time_stamp();
 	virtual uint32_t current_segment_size();
+	virtual int realtime_priority();
+	virtual bool freewheeling();
+	virtual int set_rewind_callback(rewind_callback_t cb, void* arg, QString* err_msg = 0);
+	virtual void request_rewind();
+	virtual uint32_t buffered_frames();
+	virtual uint32_t output_delay();
+	virtual uint32_t xrun_count();
+	virtual uint32_t xruns_last_minute();
+	virtual int set_latency_callback(latency_callback_t cb, void* arg, QString* err_msg = 0);
+	virtual void latency_changed();
+	virtual bool transport_query(bool *rolling, uint32_t *frame);
+	virtual void transport_start();
+	virtual void transport_stop();
+	virtual void transport_locate(uint32_t frame);
+
+    private:
+	static int _process_callback(jack_nframes_t nframes, void *arg);
+	static int _xrun_callback(void *arg);
+	static void _latency_callback(jack_latency_callback_mode_t mode, void *arg);
+	static void _freewheel_callback(int starting, void *arg);
 
     private:
 	jack_client_t *_client;
-	jack_port_t* _port[2];
+	std::vector<jack_port_t*> _port;
+	std::vector<sample_t*> _buf; // This cycle's port buffers
+	std::vector<jack_port_t*> _in_port;
+	std::vector<const sample_t*> _in_buf; // This cycle's input buffers
 	Configuration* _config;
+	XrunLog _xruns;
+	process_callback_t _app_process_callback;
+	void* _app_process_callback_arg;
+	latency_callback_t _app_latency_callback;
+	void* _app_latency_callback_arg;
+	bool _transport;
+	volatile bool _freewheeling;
     };
 
 } // namespace StretchPlayer
@@ -0,0 +1,139 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "LatencyTracker.hpp"
+#include <cstring>
+
+namespace StretchPlayer
+{
+    /* The audio thread brackets its changes with _seq (a seqlock),
+     * and position() retries if it sees that it raced with one.
+     * The writer never waits.
+     */
+    static inline void begin_write(volatile uint32_t& seq)
+    {
+	++seq;
+	__sync_synchronize();
+    }
+
+    static inline void end_write(volatile uint32_t& seq)
+    {
+	__sync_synchronize();
+	++seq;
+    }
+
+    LatencyTracker::LatencyTracker() :
+	_seq(0),
+	_count(0),
+	_out_fed(0.0),
+	_out_read(0.0),
+	_base(0)
+    {
+	memset(_rec, 0, sizeof(_rec));
+    }
+
+    void LatencyTracker::reset(unsigned long song_pos)
+    {
+	begin_write(_seq);
+	_count = 0;
+	_out_fed = 0.0;
+	_out_read = 0.0;
+	_base = song_pos;
+	end_write(_seq);
+    }
+
+    void LatencyTracker::fed(unsigned long song_pos, uint32_t nframes, float time_ratio)
+    {
+	if( nframes == 0 )
+	    return;
+
+	begin_write(_seq);
+	Record *r = _count ? &_rec[(_count - 1) % SIZE] : 0;
+	if( r && (r->time_ratio == time_ratio)
+	    && (r->song_start + r->song_frames == song_pos) ) {
+	    // Carries straight on from the last one
+	    r->song_frames += nframes;
+	    r->out_frames += double(nframes) * time_ratio;
+	} else {
+	    r = &_rec[_count % SIZE];
+	    r->out_start = _out_fed;
+	    r->out_frames = double(nframes) * time_ratio;
+	    r->song_start = song_pos;
+	    r->song_frames = nframes;
+	    r->time_ratio = time_ratio;
+	    ++_count;
+	}
+	_out_fed += double(nframes) * time_ratio;
+	end_write(_seq);
+    }
+
+    void LatencyTracker::read(uint32_t nframes)
+    {
+	begin_write(_seq);
+	_out_read += nframes;
+	end_write(_seq);
+    }
+
+    unsigned long LatencyTracker::position(double frames_back) const
+    {
+	unsigned long pos;
+	uint32_t seq;
+
+	do {
+	    while( (seq = _seq) & 1 ) {
+		// The audio thread is in the middle of a change.
+	    }
+	    __sync_synchronize();
+	    pos = _lookup(_out_read - frames_back);
+	    __sync_synchronize();
+	} while( seq != _seq );
+
+	return pos;
+    }
+
+    bool LatencyTracker::covers(double frames_back) const
+    {
+	return _count && (_out_read - frames_back >= 0.0);
+    }
+
+    unsigned long LatencyTracker::_lookup(double out_frame) const
+    {
+	uint32_t oldest = (_count > SIZE) ? (_count - SIZE) : 0;
+	uint32_t k;
+
+	if( _count == 0 || out_frame < 0.0 ) {
+	    // Nothing has come out since reset()
+	    return _base;
+	}
+
+	for( k = _count ; k > oldest ; --k ) {
+	    const Record& r = _rec[(k - 1) % SIZE];
+	    if( out_frame >= r.out_start ) {
+		double song = (out_frame - r.out_start) / r.time_ratio;
+		if( song > r.song_frames )
+		    song = r.song_frames;
+		return r.song_start + (unsigned long)song;
+	    }
+	}
+
+	// Older than anything still recorded
+	return _rec[oldest % SIZE].song_start;
+    }
+
+} // namespace StretchPlayer
@@ -0,0 +1,101 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef LATENCYTRACKER_HPP
+#define LATENCYTRACKER_HPP
+
+#include <stdint.h>
+
+namespace StretchPlayer
+{
+    /**
+     * \brief Maps the stretcher's output back to song frames.
+     *
+     * Each span of the song that is fed to the stretcher is recorded
+     * with the time ratio it was fed at.  The stretcher makes
+     * time_ratio output frames for every input frame, so the record
+     * says which output frames that span will become.  Counting the
+     * output frames that have been read back then gives the song
+     * frame for any point in the output stream, including frames
+     * that are still queued in the stretcher, its rings or the audio
+     * driver.  Loop jumps and ratio changes start a new record, so
+     * they don't throw the count off.  (See
+     * Documentation/position-math.txt.)
+     *
+     * reset(), fed() and read() may only be called by the audio
+     * thread. [RT SAFE]  position() may be called from any thread.
+     */
+    class LatencyTracker
+    {
+    public:
+	LatencyTracker();
+
+	/**
+	 * Forget everything.  The stretcher starts over at song_pos.
+	 */
+	void reset(unsigned long song_pos);
+
+	/**
+	 * nframes of the song, starting at song_pos, were fed to the
+	 * stretcher at time_ratio (output frames per input frame).
+	 */
+	void fed(unsigned long song_pos, uint32_t nframes, float time_ratio);
+
+	/**
+	 * nframes were read from the stretcher's output.
+	 */
+	void read(uint32_t nframes);
+
+	/**
+	 * The song frame that became the output frame frames_back
+	 * frames before the next one to be read.
+	 */
+	unsigned long position(double frames_back) const;
+
+	/**
+	 * True if the output frame frames_back frames before the
+	 * next one to be read has been read since reset(), so that
+	 * position() maps it exactly instead of clamping to the
+	 * reset() position.  Audio thread only.
+	 */
+	bool covers(double frames_back) const;
+
+    private:
+	unsigned long _lookup(double out_frame) const;
+
+	struct Record {
+	    double out_start; // Output frame counting from reset()
+	    double out_frames;
+	    unsigned long song_start;
+	    uint32_t song_frames;
+	    float time_ratio;
+	};
+
+	enum { SIZE = 512 }; // Records kept
+
+	volatile uint32_t _seq; // Odd while the audio thread is changing things
+	uint32_t _count; // Records since reset()
+	double _out_fed; // Output frames that the fed song will make
+	double _out_read; // Output frames read
+	unsigned long _base; // Song frame at reset()
+	Record _rec[SIZE];
+    };
+
+} // namespace StretchPlayer
+
+#endif // LATENCYTRACKER_HPP
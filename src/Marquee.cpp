@@ -31,14 +31,18 @@ namespace Widgets
 
     Marquee::Marquee(QWidget* parent) :
 	QWidget(parent),
+	_frame_msecs(1000/60),
+	_suspended(true),
 	_pos(0),
-	_incr(5),
+	_pos_frac(0.0),
+	_speed(120.0),
 	_show_temporary(0),
 	_show_temporary_first(3)
     {
-	_scroll_timer.setInterval(42);
+	// Every pixel comes from _canvas, so scroll() can blit.
+	setAttribute(Qt::WA_OpaquePaintEvent);
+
 	_scroll_timer.setSingleShot(false);
-	_wait_timer.setInterval(1500);
 	_wait_timer.setSingleShot(true);
 
 	connect( &_scroll_timer, SIGNAL(timeout()),
@@ -46,6 +50,11 @@ namespace Widgets
 	connect( &_wait_timer, SIGNAL(timeout()),
 		 this, SLOT(_wait_over()) );
 
+	// Minimizing doesn't hide the children, so watch the window.
+	if( window() != this ) {
+	    window()->installEventFilter(this);
+	}
+
 	_draw_text("");
 	_scroll = false;
     }
@@ -60,12 +69,19 @@ namespace Widgets
 	_font = font;
     }
 
+    void Marquee::set_frame_rate(unsigned hz) {
+	if( hz == 0 ) return;
+	_frame_msecs = 1000 / hz;
+	if( _frame_msecs < 1 ) _frame_msecs = 1;
+	if( _scroll_timer.isActive() ) {
+	    _scroll_timer.start(_frame_msecs);
+	}
+    }
+
     void Marquee::set_temporary(QString txt) {
-	_scroll_timer.stop();
 	_temporary = txt;
 	_show_temporary = _show_temporary_first;
 	_draw_text(txt);
-	_wait_timer.start();
     }
 
     void Marquee::set_permanent(QString txt) {
@@ -75,33 +91,107 @@ namespace Widgets
 	}
     }
 
+    /**
+     * Move on by however far the time since the last step says, and
+     * blit.  Only the strip that scrolls into view gets painted.
+     */
     void Marquee::_scroll_incr()
     {
-	_pos += _incr;
+	int dx;
+
+	_pos_frac += _speed * _clock.restart() / 1000.0;
+	dx = int(_pos_frac);
+	if( dx <= 0 )
+	    return;
+	_pos_frac -= dx;
+	_pos += dx;
+
 	if(_pos > _canvas->width()) {
-	    _scroll_timer.stop();
-	    _pos = 0;
-	    _wait_timer.start(1500);
+	    // Back to the start, and pause there.
+	    _restart();
+	} else {
+	    scroll(-dx, 0);
 	}
     }
 
     void Marquee::_wait_over()
     {
 	if( _show_temporary == 1 ) {
-	    _draw_text(_permanent);
-	    _pos = 0;
 	    _show_temporary = 0;
+	    _draw_text(_permanent);
+	    return;
 	} else if( _show_temporary > 0 ) {
 	    --_show_temporary;
 	}
 	if(_scroll == false) {
-	    _draw_text(_permanent);
-	    _pos = 0;
-	    _show_temporary = 0;
+	    if( _show_temporary > 0 ) {
+		_show_temporary = 0;
+		_draw_text(_permanent);
+	    }
 	    return;
+	}
+	_clock.start();
+	_pos_frac = 0.0;
+	_scroll_timer.start(_frame_msecs);
+    }
+
+    /**
+     * Back to the start of the text.  If there's anything to do
+     * (scrolling, or taking a temporary message down) pause there
+     * and then do it.  Otherwise, sit still with no timers.
+     */
+    void Marquee::_restart()
+    {
+	_scroll_timer.stop();
+	_wait_timer.stop();
+	_pos = 0;
+	_pos_frac = 0.0;
+	update();
+
+	if( _suspended )
+	    return;
+	if( _scroll || (_show_temporary > 0) ) {
+	    _wait_timer.start(1500);
+	}
+    }
+
+    void Marquee::_update_suspended()
+    {
+	bool suspend = !isVisible() || window()->isMinimized();
+
+	if( suspend == _suspended )
+	    return;
+	_suspended = suspend;
+	if( _suspended ) {
+	    _scroll_timer.stop();
+	    _wait_timer.stop();
 	} else {
-	    _scroll_timer.start();
+	    _restart();
+	}
+    }
+
+    void Marquee::showEvent(QShowEvent * /*event*/)
+    {
+	_update_suspended();
+    }
+
+    void Marquee::hideEvent(QHideEvent * /*event*/)
+    {
+	_update_suspended();
+    }
+
+    bool Marquee::eventFilter(QObject *obj, QEvent *event)
+    {
+	switch( event->type() ) {
+	case QEvent::WindowStateChange:
+	case QEvent::Show:
+	case QEvent::Hide:
+	    _update_suspended();
+	    break;
+	default:
+	    break;
 	}
+	return QWidget::eventFilter(obj, event);
     }
 
     void Marquee::_draw_text(const QString& txt)
@@ -110,21 +200,18 @@ namespace Widgets
 	QSize size = fm.size(0, txt);
 	int w = size.width();
 	int h = height();
-	_incr = fm.maxWidth() / 8;
-	if( _incr <= 0 ) _incr = 1;
+	int incr;
+
+	// What it used to move every 42 ms
+	incr = fm.maxWidth() / 8;
+	if( incr <= 0 ) incr = 1;
+	_speed = incr * 1000.0 / 42.0;
 
 	if( width() > w ) {
 	    w = width();
 	    _scroll = false;
-	    _scroll_timer.stop();
-	    _wait_timer.start(3000);
-	    _pos = 0;
 	} else {
-	    // w = w
 	    _scroll = true;
-	    _scroll_timer.stop();
-	    _wait_timer.start(1500);
-	    _pos = 0;
 	}
 
 	_canvas.reset(new QPixmap(w*6/5, h) );
@@ -139,6 +226,9 @@ namespace Widgets
 	painter.setFont(_font);
 
 	painter.drawText( 0, 0, w, h, Qt::TextSingleLine, txt );
+	painter.end();
+
+	_restart();
     }
 
     void Marquee::resizeEvent(QResizeEvent * /*event*/)
@@ -23,6 +23,7 @@
 #include <QString>
 #include <QRect>
 #include <QTimer>
+#include <QTime>
 #include <memory>
 
 class QImage;
@@ -32,6 +33,14 @@ namespace StretchPlayer
 
 namespace Widgets
 {
+    /**
+     * \brief One line of text that scrolls if it doesn't fit.
+     *
+     * The text is drawn once into a pixmap, and scrolling just
+     * blits the widget over and fills in the strip that comes into
+     * view.  Nothing runs while the text fits (and no temporary
+     * message is up), or while the window is hidden or minimized.
+     */
     class Marquee : public QWidget
     {
 	Q_OBJECT
@@ -41,6 +50,12 @@ namespace Widgets
 
 	void set_font(const QFont& font);
 
+	/**
+	 * Scroll steps per second (the display refresh rate).  The
+	 * scrolling speed doesn't depend on it.
+	 */
+	void set_frame_rate(unsigned hz);
+
     public slots:
 	void set_temporary(QString);
 	void set_permanent(QString);
@@ -48,6 +63,9 @@ namespace Widgets
     private:
 	virtual void resizeEvent(QResizeEvent *event);
 	virtual void paintEvent(QPaintEvent *event);
+	virtual void showEvent(QShowEvent *event);
+	virtual void hideEvent(QHideEvent *event);
+	virtual bool eventFilter(QObject *obj, QEvent *event);
 
     private slots:
 	void _scroll_incr();
@@ -55,6 +73,8 @@ namespace Widgets
 
     private:
 	void _draw_text(const QString& txt);
+	void _restart();
+	void _update_suspended();
 
     private:
 	QString _temporary;
@@ -63,8 +83,12 @@ namespace Widgets
 	QTimer _scroll_timer;
 	bool _scroll;
 	QTimer _wait_timer;
+	QTime _clock; // Since the last scroll step
+	int _frame_msecs;
+	bool _suspended; // Hidden or minimized
 	int _pos;
-	int _incr;
+	double _pos_frac; // Sub-pixel part of _pos
+	double _speed; // Pixels per second
 	int _show_temporary;
 	const int _show_temporary_first;
 	QFont _font;
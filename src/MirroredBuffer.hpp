@@ -0,0 +1,129 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef TRITIUM_MIRROREDBUFFER_HPP
+#define TRITIUM_MIRROREDBUFFER_HPP
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <cstddef>
+
+namespace Tritium
+{
+
+/**
+ * \brief Memory where each region is mapped twice, back to back.
+ *
+ * region(k)[i] and region(k)[i + bytes] are the same memory, so a ring
+ * buffer that lives in a region can hand out any span of up to its
+ * capacity as one contiguous pointer, even when the span wraps.
+ *
+ * The regions are backed by one anonymous memfd.  bytes must be a
+ * multiple of the page size (see page_size()).  If the kernel doesn't
+ * support this, map() returns false and the caller should fall back
+ * to ordinary memory.
+ */
+class MirroredBuffer
+{
+public:
+	MirroredBuffer () : _base (0), _bytes (0), _count (0) {}
+
+	~MirroredBuffer () {
+		unmap ();
+	}
+
+	static size_t page_size () {
+		return sysconf (_SC_PAGESIZE);
+	}
+
+	bool map (size_t bytes, unsigned count) {
+		unmap ();
+		if (bytes == 0 || count == 0 || (bytes % page_size ()))
+			return false;
+
+#ifdef SYS_memfd_create
+		int fd = syscall (SYS_memfd_create, "stretchplayer-ring", 0);
+		if (fd < 0)
+			return false;
+		if (ftruncate (fd, bytes * count)) {
+			close (fd);
+			return false;
+		}
+
+		/* Reserve the address range first, then map the file
+		   over it twice per region. */
+		void *base = mmap (0, 2 * bytes * count, PROT_NONE,
+				   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED) {
+			close (fd);
+			return false;
+		}
+
+		bool ok = true;
+		for (unsigned k = 0; ok && k < count; ++k) {
+			char *r = static_cast<char*> (base) + 2 * bytes * k;
+			for (unsigned half = 0; ok && half < 2; ++half) {
+				void *p = mmap (r + half * bytes, bytes,
+						PROT_READ | PROT_WRITE,
+						MAP_SHARED | MAP_FIXED,
+						fd, bytes * k);
+				ok = (p != MAP_FAILED);
+			}
+		}
+		close (fd); // The mappings keep it alive.
+
+		if (!ok) {
+			munmap (base, 2 * bytes * count);
+			return false;
+		}
+
+		_base = static_cast<char*> (base);
+		_bytes = bytes;
+		_count = count;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void unmap () {
+		if (_base)
+			munmap (_base, 2 * _bytes * _count);
+		_base = 0;
+		_bytes = 0;
+		_count = 0;
+	}
+
+	bool is_mapped () const { return _base != 0; }
+
+	void *region (unsigned k) { return _base + 2 * _bytes * k; }
+
+private:
+	/* Not copyable */
+	MirroredBuffer (const MirroredBuffer&);
+	MirroredBuffer& operator= (const MirroredBuffer&);
+
+	char *_base;
+	size_t _bytes;
+	unsigned _count;
+};
+
+} // namespace Tritium
+
+#endif // TRITIUM_MIRROREDBUFFER_HPP
@@ -0,0 +1,242 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef TRITIUM_MULTICHANNELRINGBUFFER_HPP
+#define TRITIUM_MULTICHANNELRINGBUFFER_HPP
+
+#include <cstring>
+#include "RingBuffer.hpp"
+
+namespace Tritium
+{
+
+/**
+ * \brief Lock-free single-reader/single-writer ring buffer of frames.
+ *
+ * Like RingBuffer, but every element is a frame of CHANNELS samples.
+ * Storage is planar (one contiguous block per channel), and all the
+ * channels share a single RingBufferIndex.  So a read or write always
+ * moves whole frames, and the channels can never get out of step with
+ * each other.
+ *
+ * All counts and indexes are in frames.  If mirrored is true, each
+ * channel is a MirroredBuffer region and read/write vectors are always
+ * a single segment; see RingBuffer.
+ */
+template<class T, unsigned CHANNELS>
+class MultiChannelRingBuffer
+{
+  public:
+	MultiChannelRingBuffer (unsigned sz, bool mirrored = false) :
+		idx (ring_buffer_size (sz, sizeof (T), mirrored)) {
+		unsigned c;
+		size = ring_buffer_size (sz, sizeof (T), mirrored);
+		if (mirrored && mirror.map (size * sizeof (T), CHANNELS)) {
+			buf = 0;
+			for (c = 0; c < CHANNELS; ++c)
+				chan[c] = static_cast<T*> (mirror.region (c));
+		} else {
+			buf = new T[size * CHANNELS];
+			for (c = 0; c < CHANNELS; ++c)
+				chan[c] = &buf[c * size];
+		}
+		reset ();
+	}
+
+	virtual ~MultiChannelRingBuffer() {
+		delete [] buf;
+	}
+
+	static void* operator new (size_t bytes) { return RingBufferIndex::alloc (bytes); }
+	static void operator delete (void *p) { RingBufferIndex::release (p); }
+
+	void reset () {
+		/* !!! NOT THREAD SAFE !!! */
+		idx.set (0, 0);
+	}
+
+	/**
+	 * dest[c] receives cnt samples of channel c.
+	 */
+	unsigned read  (T * const *dest, unsigned cnt);
+	unsigned write (T * const *src, unsigned cnt);
+
+	struct rw_vector {
+	    T *buf[CHANNELS][2];
+	    unsigned len[2];
+	};
+
+	void get_read_vector (rw_vector *);
+	void get_write_vector (rw_vector *);
+
+	void increment_read_idx (unsigned cnt) {
+		idx.consumer_commit (cnt);
+	}
+
+	void increment_write_idx (unsigned cnt) {
+		idx.producer_commit (cnt);
+	}
+
+	unsigned write_space () {
+		return idx.write_space ();
+	}
+
+	unsigned read_space () {
+		return idx.read_space ();
+	}
+
+	T *buffer (unsigned c) { return chan[c]; }
+	unsigned bufsize () const { return size; }
+	unsigned channels () const { return CHANNELS; }
+	bool mirrored () const { return mirror.is_mapped (); }
+
+  protected:
+	T *buf;
+	T *chan[CHANNELS];
+	unsigned size;
+	MirroredBuffer mirror;
+	RingBufferIndex idx;
+};
+
+template<class T, unsigned CHANNELS> unsigned
+MultiChannelRingBuffer<T, CHANNELS>::read (T * const *dest, unsigned cnt)
+{
+	unsigned free_cnt;
+	unsigned to_read;
+	unsigned n1, n2;
+	unsigned priv_read_idx;
+	unsigned c;
+
+	priv_read_idx = idx.consumer_idx ();
+
+	if ((free_cnt = idx.consumer_space (cnt)) == 0) {
+		return 0;
+	}
+
+	to_read = cnt > free_cnt ? free_cnt : cnt;
+
+	if (priv_read_idx + to_read > size && !mirrored ()) {
+		n1 = size - priv_read_idx;
+		n2 = to_read - n1;
+	} else {
+		n1 = to_read;
+		n2 = 0;
+	}
+
+	for (c = 0; c < CHANNELS; ++c) {
+		memcpy (dest[c], &chan[c][priv_read_idx], n1 * sizeof (T));
+		if (n2) {
+			memcpy (dest[c] + n1, chan[c], n2 * sizeof (T));
+		}
+	}
+
+	idx.consumer_commit (to_read);
+	return to_read;
+}
+
+template<class T, unsigned CHANNELS> unsigned
+MultiChannelRingBuffer<T, CHANNELS>::write (T * const *src, unsigned cnt)
+{
+	unsigned free_cnt;
+	unsigned to_write;
+	unsigned n1, n2;
+	unsigned priv_write_idx;
+	unsigned c;
+
+	priv_write_idx = idx.producer_idx ();
+
+	if ((free_cnt = idx.producer_space (cnt)) == 0) {
+		return 0;
+	}
+
+	to_write = cnt > free_cnt ? free_cnt : cnt;
+
+	if (priv_write_idx + to_write > size && !mirrored ()) {
+		n1 = size - priv_write_idx;
+		n2 = to_write - n1;
+	} else {
+		n1 = to_write;
+		n2 = 0;
+	}
+
+	for (c = 0; c < CHANNELS; ++c) {
+		memcpy (&chan[c][priv_write_idx], src[c], n1 * sizeof (T));
+		if (n2) {
+			memcpy (chan[c], src[c] + n1, n2 * sizeof (T));
+		}
+	}
+
+	idx.producer_commit (to_write);
+	return to_write;
+}
+
+template<class T, unsigned CHANNELS> void
+MultiChannelRingBuffer<T, CHANNELS>::get_read_vector (rw_vector *vec)
+{
+	unsigned free_cnt;
+	unsigned r;
+	unsigned c;
+
+	r = idx.consumer_idx ();
+	free_cnt = idx.consumer_space (size);
+
+	if (r + free_cnt > size && !mirrored ()) {
+		/* Two part vector: the rest of the buffer after the
+		   current read ptr, plus some from the start of
+		   the buffer.
+		*/
+		vec->len[0] = size - r;
+		vec->len[1] = free_cnt - vec->len[0];
+	} else {
+		vec->len[0] = free_cnt;
+		vec->len[1] = 0;
+	}
+
+	for (c = 0; c < CHANNELS; ++c) {
+		vec->buf[c][0] = &chan[c][r];
+		vec->buf[c][1] = chan[c];
+	}
+}
+
+template<class T, unsigned CHANNELS> void
+MultiChannelRingBuffer<T, CHANNELS>::get_write_vector (rw_vector *vec)
+{
+	unsigned free_cnt;
+	unsigned w;
+	unsigned c;
+
+	w = idx.producer_idx ();
+	free_cnt = idx.producer_space (size);
+
+	if (w + free_cnt > size && !mirrored ()) {
+		vec->len[0] = size - w;
+		vec->len[1] = free_cnt - vec->len[0];
+	} else {
+		vec->len[0] = free_cnt;
+		vec->len[1] = 0;
+	}
+
+	for (c = 0; c < CHANNELS; ++c) {
+		vec->buf[c][0] = &chan[c][w];
+		vec->buf[c][1] = chan[c];
+	}
+}
+
+} // namespace Tritium
+
+#endif // TRITIUM_MULTICHANNELRINGBUFFER_HPP
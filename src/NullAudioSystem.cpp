@@ -0,0 +1,421 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "NullAudioSystem.hpp"
+#include "Configuration.hpp"
+#include <QString>
+#include <QThread>
+#include <sndfile.h>
+#include <cassert>
+#include <cstdlib>
+#include <ctime>
+#include <sched.h>
+
+#include <iostream>
+using namespace std;
+
+namespace StretchPlayer
+{
+    /**
+     * \brief Thread for NullAudioSystem's main loop.
+     */
+    class NullAudioSystemPrivate : public QThread
+    {
+    public:
+	typedef void (*callback_t)(NullAudioSystem*);
+
+	NullAudioSystemPrivate(NullAudioSystem *parent, callback_t run_callback) :
+	    _run_callback(run_callback),
+	    _parent(parent)
+	    {}
+
+	virtual ~NullAudioSystemPrivate()
+	    {}
+
+    private:
+	virtual void run() {
+	    (*_run_callback)(_parent);
+	}
+
+	callback_t _run_callback;
+	NullAudioSystem *_parent;
+    };
+
+    static inline void timespec_add_nsec(timespec& ts, long long nsec)
+    {
+	nsec += ts.tv_nsec;
+	ts.tv_sec += nsec / 1000000000LL;
+	ts.tv_nsec = nsec % 1000000000LL;
+    }
+
+    static inline double timespec_secs(const timespec& ts)
+    {
+	return double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
+    }
+
+    static inline long long timespec_diff_nsec(const timespec& a, const timespec& b)
+    {
+	return (long long)(b.tv_sec - a.tv_sec) * 1000000000LL
+	    + (b.tv_nsec - a.tv_nsec);
+    }
+
+    NullAudioSystem::NullAudioSystem() :
+	_sample_rate(48000),
+	_period_nframes(1024),
+	_freewheel(false),
+	_jitter_usecs(0),
+	_active(false),
+	_sndfile(0),
+	_callback(0),
+	_callback_arg(0),
+	_frame(0),
+	_segment_start(0),
+	_dsp_load(0.0f),
+	_d(0)
+    {
+	_d = new NullAudioSystemPrivate(this, NullAudioSystem::run);
+    }
+
+    NullAudioSystem::~NullAudioSystem()
+    {
+	cleanup();
+	delete _d;
+	_d = 0;
+    }
+
+    int NullAudioSystem::init(QString * /*app_name*/, Configuration *config, QString *err_msg)
+    {
+	QString emsg;
+
+	if(config) {
+	    _sample_rate = config->sample_rate();
+	    _period_nframes = config->period_size();
+	    _freewheel = config->freewheel();
+	    _jitter_usecs = config->null_jitter();
+	    _output_file = config->null_output();
+	}
+
+	_xruns.reset();
+
+	if( _sample_rate == 0 || _period_nframes == 0 ) {
+	    emsg = QString("invalid sample rate (%1) or period size (%2) for the null driver")
+		.arg(_sample_rate)
+		.arg(_period_nframes);
+	    goto init_bail;
+	}
+
+	_left.assign(_period_nframes, 0.0f);
+	_right.assign(_period_nframes, 0.0f);
+
+	if( ! _output_file.isEmpty() ) {
+	    SF_INFO info;
+	    info.frames = 0;
+	    info.samplerate = _sample_rate;
+	    info.channels = 2;
+	    info.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+	    info.sections = 0;
+	    info.seekable = 0;
+	    _sndfile = sf_open(_output_file.toLocal8Bit().data(), SFM_WRITE, &info);
+	    if( !_sndfile ) {
+		emsg = QString("cannot open '%1' for writing (%2)")
+		    .arg(_output_file)
+		    .arg(sf_strerror(0));
+		goto init_bail;
+	    }
+	    _interleaved.assign(2 * _period_nframes, 0.0f);
+	}
+
+	return 0;
+
+    init_bail:
+	if(err_msg) {
+	    *err_msg = emsg;
+	}
+	cleanup();
+	return 0xDEADBEEF;
+    }
+
+    void NullAudioSystem::cleanup()
+    {
+	deactivate();
+	if(_sndfile) {
+	    sf_close(_sndfile);
+	    _sndfile = 0;
+	}
+	_left.clear();
+	_right.clear();
+	_interleaved.clear();
+    }
+
+    int NullAudioSystem::set_process_callback(process_callback_t cb, void* arg, QString* /*err_msg*/)
+    {
+	assert( !_active );
+	_callback = cb;
+	_callback_arg = arg;
+	return 0;
+    }
+
+    int NullAudioSystem::set_segment_size_callback(segment_size_callback_t, void*, QString*)
+    {
+	// The segment size never changes
+	return 0;
+    }
+
+    int NullAudioSystem::activate(QString *err_msg)
+    {
+	assert(_d);
+	if( _active )
+	    return 0;
+	if( _left.empty() ) {
+	    if(err_msg) *err_msg = "The null driver was activated before init().";
+	    return 0xDEADBEEF;
+	}
+
+	_active = true;
+	_d->start();
+	return 0;
+    }
+
+    int NullAudioSystem::deactivate(QString * /*err_msg*/)
+    {
+	assert(_d);
+	_active = false;
+	_d->wait();
+	return 0;
+    }
+
+    uint32_t NullAudioSystem::output_count()
+    {
+	// Stereo, like the WAV file it can write
+	return 2;
+    }
+
+    uint32_t NullAudioSystem::input_count()
+    {
+	// Nothing to capture from
+	return 0;
+    }
+
+    uint32_t NullAudioSystem::input_delay()
+    {
+	return 0;
+    }
+
+    AudioSystem::sample_t* NullAudioSystem::output_buffer(int index)
+    {
+	if( _left.empty() ) return 0;
+	if(index == 0) {
+	    return &_left[0];
+	} else if(index == 1) {
+	    return &_right[0];
+	}
+	return 0;
+    }
+
+    uint32_t NullAudioSystem::output_buffer_size(int index)
+    {
+	if(index == 0 || index == 1) return _period_nframes;
+	return 0;
+    }
+
+    uint32_t NullAudioSystem::sample_rate()
+    {
+	return _sample_rate;
+    }
+
+    float NullAudioSystem::dsp_load()
+    {
+	return _dsp_load;
+    }
+
+    uint32_t NullAudioSystem::time_stamp()
+    {
+	return _frame;
+    }
+
+    uint32_t NullAudioSystem::segment_start_time_stamp()
+    {
+	return _segment_start;
+    }
+
+    uint32_t NullAudioSystem::current_segment_size()
+    {
+	return _period_nframes;
+    }
+
+    int NullAudioSystem::realtime_priority()
+    {
+	return -1;
+    }
+
+    bool NullAudioSystem::freewheeling()
+    {
+	return _freewheel;
+    }
+
+    int NullAudioSystem::set_rewind_callback(rewind_callback_t, void*, QString*)
+    {
+	// Never buffers ahead, so never rewinds
+	return 0;
+    }
+
+    void NullAudioSystem::request_rewind()
+    {
+    }
+
+    uint32_t NullAudioSystem::buffered_frames()
+    {
+	return 0;
+    }
+
+    uint32_t NullAudioSystem::output_delay()
+    {
+	return 0;
+    }
+
+    uint32_t NullAudioSystem::xrun_count()
+    {
+	return _xruns.count();
+    }
+
+    uint32_t NullAudioSystem::xruns_last_minute()
+    {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return _xruns.within(timespec_secs(ts), 60.0);
+    }
+
+    int NullAudioSystem::set_latency_callback(latency_callback_t, void*, QString*)
+    {
+	// Nobody to report it to
+	return 0;
+    }
+
+    void NullAudioSystem::latency_changed()
+    {
+    }
+
+    bool NullAudioSystem::transport_query(bool*, uint32_t*)
+    {
+	return false;
+    }
+
+    void NullAudioSystem::transport_start()
+    {
+    }
+
+    void NullAudioSystem::transport_stop()
+    {
+    }
+
+    void NullAudioSystem::transport_locate(uint32_t)
+    {
+    }
+
+    /**
+     * Append the current output buffers to the WAV file.  Not RT
+     * safe... but there's no hardware to miss a deadline for.
+     */
+    void NullAudioSystem::_write_output(uint32_t nframes)
+    {
+	float *out = &_interleaved[0];
+	for( uint32_t k = 0 ; k < nframes ; ++k ) {
+	    (*out++) = _left[k];
+	    (*out++) = _right[k];
+	}
+	if( sf_writef_float(_sndfile, &_interleaved[0], nframes) != sf_count_t(nframes) ) {
+	    cerr << "WARNING: Write to '" << _output_file.toLocal8Bit().data()
+		 << "' failed (" << sf_strerror(_sndfile) << ")."
+		 << "  No more audio will be written." << endl;
+	    sf_close(_sndfile);
+	    _sndfile = 0;
+	}
+    }
+
+    void NullAudioSystem::_run()
+    {
+	const long long period_ns = 1000000000LL * _period_nframes / _sample_rate;
+	timespec deadline, start, end;
+	long long work_ns;
+	sample_t *outs[2];
+	cycle_t cycle;
+
+	assert(_active);
+	assert(_callback);
+	assert(!_left.empty());
+
+	outs[0] = &_left[0];
+	outs[1] = &_right[0];
+	cycle.nframes = _period_nframes;
+	cycle.outputs = 2;
+	cycle.out = outs;
+	cycle.inputs = 0;
+	cycle.in = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	srand( deadline.tv_nsec );
+
+	while(_active) {
+	    _segment_start = _frame;
+
+	    clock_gettime(CLOCK_MONOTONIC, &start);
+	    if( _callback(cycle, _callback_arg) != 0 ) {
+		cerr << "ERROR: Application's audio callback failed." << endl;
+		cerr << "Aborting audio driver." << endl;
+		break;
+	    }
+	    if(_sndfile) {
+		_write_output(_period_nframes);
+	    }
+	    clock_gettime(CLOCK_MONOTONIC, &end);
+
+	    work_ns = timespec_diff_nsec(start, end);
+	    _dsp_load = 0.9f * _dsp_load + 0.1f * float(work_ns) / float(period_ns);
+	    if(_dsp_load > 1.0f) _dsp_load = 1.0f;
+
+	    _frame += _period_nframes;
+
+	    if( _freewheel ) {
+		// Let the stretcher thread in, even on a single CPU.
+		sched_yield();
+		continue;
+	    }
+
+	    timespec_add_nsec(deadline, period_ns);
+	    if( timespec_diff_nsec(end, deadline) < 0 ) {
+		// Fell behind (like an xrun).  Start counting again
+		// from now rather than trying to catch up.
+		_xruns.add( timespec_secs(end) );
+		deadline = end;
+		continue;
+	    }
+
+	    timespec wake = deadline;
+	    if( _jitter_usecs ) {
+		timespec_add_nsec(wake, 1000LL * (rand() % (_jitter_usecs + 1)));
+	    }
+	    while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, 0) ) {
+		if( !_active ) break; // EINTR
+	    }
+	}
+
+	_active = false;
+    }
+
+} // namespace StretchPlayer
@@ -0,0 +1,122 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef NULLAUDIOSYSTEM_HPP
+#define NULLAUDIOSYSTEM_HPP
+
+#include <AudioSystem.hpp>
+#include <XrunLog.hpp>
+#include <QString>
+#include <vector>
+
+typedef struct SNDFILE_tag SNDFILE;
+
+namespace StretchPlayer
+{
+    class Configuration;
+    class NullAudioSystemPrivate;
+
+    /**
+     * \brief Audio driver with no sound card.
+     *
+     * A thread calls the process callback every period_size frames,
+     * paced by the clock at the configured sample rate, or back to
+     * back in freewheel mode.  The output can be written to a WAV
+     * file.  For running headless (servers, CI) and for profiling.
+     *
+     * Settings come from the Configuration: sample_rate(),
+     * period_size(), freewheel(), null_jitter() (max random delay
+     * added to each wakeup, in microseconds) and null_output()
+     * (file name, empty for none).  Without a Configuration, 48 kHz
+     * and 1024 frames are used.
+     */
+    class NullAudioSystem : public AudioSystem
+    {
+    public:
+	NullAudioSystem();
+	virtual ~NullAudioSystem();
+
+	/* Implementing all of AudioSystem's interface:
+	 */
+	virtual int init(QString * app_name, Configuration *config, QString *err_msg = 0);
+	virtual void cleanup();
+	virtual int set_process_callback(process_callback_t cb, void* arg, QString* err_msg = 0);
+	virtual int set_segment_size_callback(segment_size_callback_t cb, void* arg, QString* err_msg = 0);
+	virtual int activate(QString *err_msg = 0);
+	virtual int deactivate(QString *err_msg = 0);
+	virtual uint32_t output_count();
+	virtual uint32_t input_count();
+	virtual uint32_t input_delay();
+	virtual sample_t* output_buffer(int index);
+	virtual uint32_t output_buffer_size(int index);
+	virtual uint32_t sample_rate();
+	virtual float dsp_load();
+	virtual uint32_t time_stamp();
+	virtual uint32_t segment_start_time_stamp();
+	virtual uint32_t current_segment_size();
+	virtual int realtime_priority();
+	virtual bool freewheeling();
+	virtual int set_rewind_callback(rewind_callback_t cb, void* arg, QString* err_msg = 0);
+	virtual void request_rewind();
+	virtual uint32_t buffered_frames();
+	virtual uint32_t output_delay();
+	virtual uint32_t xrun_count();
+	virtual uint32_t xruns_last_minute();
+	virtual int set_latency_callback(latency_callback_t cb, void* arg, QString* err_msg = 0);
+	virtual void latency_changed();
+	virtual bool transport_query(bool *rolling, uint32_t *frame);
+	virtual void transport_start();
+	virtual void transport_stop();
+	virtual void transport_locate(uint32_t frame);
+
+    private:
+	static void run(NullAudioSystem *that) {
+	    that->_run();
+	}
+	void _run();
+	void _write_output(uint32_t nframes);
+
+    private:
+	// Configuration variables:
+	uint32_t _sample_rate;
+	uint32_t _period_nframes;
+	bool _freewheel;
+	unsigned _jitter_usecs;
+	QString _output_file;
+
+	volatile bool _active;
+	std::vector<float> _left;
+	std::vector<float> _right;
+	std::vector<float> _interleaved;
+	SNDFILE *_sndfile;
+
+	process_callback_t _callback;
+	void *_callback_arg;
+
+	volatile uint32_t _frame;
+	volatile uint32_t _segment_start;
+	float _dsp_load;
+	XrunLog _xruns; // Times it fell a period behind
+
+	// Private object
+	NullAudioSystemPrivate *_d;
+    };
+
+} // namespace StretchPlayer
+
+#endif // NULLAUDIOSYSTEM_HPP
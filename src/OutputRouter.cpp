@@ -0,0 +1,159 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "OutputRouter.hpp"
+#include <QString>
+#include <cstdlib>
+#include <cctype>
+
+namespace StretchPlayer
+{
+    OutputRouter::OutputRouter() :
+	_outputs(0),
+	_sources(0)
+    {
+	reset(2, 2);
+    }
+
+    void OutputRouter::reset(unsigned outputs, unsigned sources)
+    {
+	unsigned o, s;
+
+	if( outputs > MAX_OUTPUTS ) outputs = MAX_OUTPUTS;
+	if( sources > MAX_SOURCES ) sources = MAX_SOURCES;
+	_outputs = outputs;
+	_sources = sources;
+
+	for( o=0 ; o<MAX_OUTPUTS ; ++o ) {
+	    for( s=0 ; s<MAX_SOURCES ; ++s ) {
+		_gain[o][s] = (sources && (s == o % sources)) ? 1.0f : 0.0f;
+	    }
+	}
+    }
+
+    void OutputRouter::set_gain(unsigned output, unsigned source, float gain)
+    {
+	if( output < _outputs && source < _sources ) {
+	    _gain[output][source] = gain;
+	}
+    }
+
+    float OutputRouter::gain(unsigned output, unsigned source) const
+    {
+	if( output < _outputs && source < _sources ) {
+	    return _gain[output][source];
+	}
+	return 0.0f;
+    }
+
+    int OutputRouter::set_routes(const QString& spec, QString *err_msg)
+    {
+	float g[MAX_OUTPUTS][MAX_SOURCES];
+	bool named[MAX_OUTPUTS];
+	QByteArray bytes = spec.toLocal8Bit();
+	const char *p = bytes.data();
+	char *end;
+	unsigned o, s;
+	float gain;
+	QString err;
+
+	for( o=0 ; o<MAX_OUTPUTS ; ++o ) {
+	    named[o] = false;
+	    for( s=0 ; s<MAX_SOURCES ; ++s ) {
+		g[o][s] = _gain[o][s];
+	    }
+	}
+
+	while( *p ) {
+	    if( *p == ',' || isspace(*p) ) {
+		++p;
+		continue;
+	    }
+
+	    // output:source[=gain]
+	    o = strtoul(p, &end, 10);
+	    if( end == p || *end != ':' ) goto parse_bail;
+	    p = end + 1;
+	    s = strtoul(p, &end, 10);
+	    if( end == p ) goto parse_bail;
+	    p = end;
+	    gain = 1.0f;
+	    if( *p == '=' ) {
+		++p;
+		gain = strtod(p, &end);
+		if( end == p ) goto parse_bail;
+		p = end;
+	    }
+	    if( *p && *p != ',' && !isspace(*p) ) goto parse_bail;
+
+	    if( o >= _outputs || s >= _sources ) {
+		err = QString("The route %1:%2 needs an output below %3 and a source below %4.")
+		    .arg(o).arg(s).arg(_outputs).arg(_sources);
+		goto route_bail;
+	    }
+	    if( !named[o] ) {
+		named[o] = true;
+		for( unsigned k=0 ; k<MAX_SOURCES ; ++k ) g[o][k] = 0.0f;
+	    }
+	    g[o][s] = gain;
+	}
+
+	for( o=0 ; o<MAX_OUTPUTS ; ++o ) {
+	    for( s=0 ; s<MAX_SOURCES ; ++s ) {
+		_gain[o][s] = g[o][s];
+	    }
+	}
+	return 0;
+
+    parse_bail:
+	err = QString("Could not parse the routes '%1' (expected output:source=gain,...).").arg(spec);
+    route_bail:
+	if(err_msg) {
+	    *err_msg = err;
+	}
+	return 0xDEADBEEF;
+    }
+
+    void OutputRouter::mix(const float * const *src,
+			   float * const *out,
+			   uint32_t nframes,
+			   float master) const
+    {
+	const float *use[MAX_SOURCES];
+	float gain[MAX_SOURCES];
+	unsigned o, s, n;
+
+	for( o=0 ; o<_outputs ; ++o ) {
+	    if( !out[o] ) continue;
+
+	    // Only the sources that this output actually hears
+	    n = 0;
+	    for( s=0 ; s<_sources ; ++s ) {
+		float g = _gain[o][s] * master;
+		if( g != 0.0f ) {
+		    use[n] = src[s];
+		    gain[n] = g;
+		    ++n;
+		}
+	    }
+	    mix_to_buffer(out[o], use, gain, n, nframes);
+	}
+    }
+
+} // namespace StretchPlayer
@@ -0,0 +1,93 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef OUTPUTROUTER_HPP
+#define OUTPUTROUTER_HPP
+
+#include <stdint.h>
+#include "SampleOps.hpp"
+
+class QString;
+
+namespace StretchPlayer
+{
+    /**
+     * \brief Gain matrix from the Engine's sources to the driver's outputs.
+     *
+     * Each output is the sum of the sources, each at its own gain,
+     * so a second pair of outputs can carry a headphone cue at
+     * another volume (or a mono sum, or nothing).  mix() renders
+     * all of the outputs with one mix_to_buffer() pass each.
+     *
+     * By default output k plays source k % 2 (left, right, left,
+     * right...) at unity gain.
+     *
+     * set_gain() and set_routes() may be called from any thread
+     * while mix() runs; a change takes effect on the next cycle.
+     * mix() is [RT SAFE].
+     */
+    class OutputRouter
+    {
+    public:
+	enum { MAX_OUTPUTS = 32, MAX_SOURCES = MIX_MAX_SOURCES };
+
+	OutputRouter();
+
+	/**
+	 * Set the size of the matrix and go back to the default
+	 * routing.  Not RT safe: the audio thread must not be in
+	 * mix().
+	 */
+	void reset(unsigned outputs, unsigned sources);
+
+	unsigned outputs() const { return _outputs; }
+	unsigned sources() const { return _sources; }
+
+	void set_gain(unsigned output, unsigned source, float gain);
+	float gain(unsigned output, unsigned source) const;
+
+	/**
+	 * Apply a route list like "2:0=0.5,3:1=0.5" (output:source=gain,
+	 * with "=gain" defaulting to 1.0).  Every output that the list
+	 * names is cleared first, so "2:0,3:0" makes outputs 2 and 3
+	 * play only the left source.
+	 *
+	 * \return 0 on success, nonzero (and nothing changed) if
+	 * the list doesn't parse or names an output or source that
+	 * doesn't exist.
+	 */
+	int set_routes(const QString& spec, QString *err_msg = 0);
+
+	/**
+	 * out[k] = sum of src[s] * gain(k, s) * master, for each of
+	 * the outputs.  Null outputs are skipped.
+	 */
+	void mix(const float * const *src,
+		 float * const *out,
+		 uint32_t nframes,
+		 float master) const;
+
+    private:
+	unsigned _outputs;
+	unsigned _sources;
+	volatile float _gain[MAX_OUTPUTS][MAX_SOURCES];
+    };
+
+} // namespace StretchPlayer
+
+#endif // OUTPUTROUTER_HPP
@@ -36,6 +36,9 @@
 #include <QBitmap>
 #include <QAction>
 #include <QResizeEvent>
+#include <QPaintEvent>
+#include <QShowEvent>
+#include <QHideEvent>
 #include <QCoreApplication>
 
 #include <cmath>
@@ -112,6 +115,11 @@ namespace StretchPlayer
 
     PlayerWidget::PlayerWidget(Configuration *config, QWidget *parent)
 	: QMainWindow(parent),
+	  _status(0),
+	  _refresh_timer(0),
+	  _refresh_msecs(1000/60),
+	  _linger(0),
+	  _shown_valid(false),
 	  _config(config)
 	  
     {
@@ -156,6 +164,7 @@ namespace StretchPlayer
 	} else {
 	    _status->song_name(name);
 	}
+	_kick_refresh();
     }
 
     int PlayerWidget::heightForWidth(int w)
@@ -166,17 +175,20 @@ namespace StretchPlayer
     void PlayerWidget::play_pause()
     {
 	_engine->play_pause();
+	_kick_refresh();
     }
 
     void PlayerWidget::stop()
     {
 	_engine->stop();
 	_engine->locate(0);
+	_kick_refresh();
     }
 
     void PlayerWidget::ab()
     {
 	_engine->loop_ab();
+	_kick_refresh();
     }
 
     void PlayerWidget::open_file()
@@ -198,48 +210,57 @@ namespace StretchPlayer
     void PlayerWidget::locate(float pos)
     {
 	_engine->locate(pos * _engine->get_length());
+	_kick_refresh();
     }
 
     void PlayerWidget::pitch_inc()
     {
 	_engine->set_pitch( _engine->get_pitch() + 1 );
+	_kick_refresh();
     }
 
     void PlayerWidget::pitch_dec()
     {
 	_engine->set_pitch( _engine->get_pitch() - 1);
+	_kick_refresh();
     }
 
     void PlayerWidget::speed_inc()
     {
 	_engine->set_stretch( _engine->get_stretch() + .05 );
+	_kick_refresh();
     }
 
     void PlayerWidget::speed_dec()
     {
 	_engine->set_stretch( _engine->get_stretch() - .05 );
+	_kick_refresh();
     }
 
     void PlayerWidget::volume_inc()
     {
 	float gain = _from_fader(_volume->value() + 50);
 	_engine->set_volume( gain );
+	_kick_refresh();
     }
 
     void PlayerWidget::volume_dec()
     {
 	float gain = _from_fader(_volume->value() - 50);
 	_engine->set_volume( gain );
+	_kick_refresh();
     }
 
     void PlayerWidget::stretch(int pos)
     {
 	_engine->set_stretch( 0.25 + double(pos)/1000.0 );
+	_kick_refresh();
     }
 
     void PlayerWidget::volume(int vol)
     {
 	_engine->set_volume( _from_fader(vol) );
+	_kick_refresh();
     }
 
     /**
@@ -301,29 +322,114 @@ namespace StretchPlayer
 	_engine->set_stretch(1.0);
     }
 
+    static bool display_differs(const Engine::state_t& a, const Engine::state_t& b)
+    {
+	return (a.position != b.position)
+	    || (a.length != b.length)
+	    || (a.stretch != b.stretch)
+	    || (a.pitch != b.pitch)
+	    || (a.volume != b.volume)
+	    || (a.cpu_load != b.cpu_load)
+	    || (a.xruns_last_minute != b.xruns_last_minute);
+    }
+
+    /**
+     * Show the engine's latest state, if it changed.
+     *
+     * Runs off _refresh_timer, which only runs while there's
+     * something to follow: at --gui-rate while playing, and for a
+     * moment after user input (until the audio thread has
+     * published the result).  See _schedule_refresh().
+     */
     void PlayerWidget::update_time()
     {
-	float pos = _engine->get_position();
-	_status->time(pos);
+	// One consistent look at the engine, without locking it
+	Engine::state_t st = _engine->get_state();
+
+	if( _linger > 0 ) --_linger;
+
+	if( !_shown_valid || display_differs(st, _shown) ) {
+	    _status->time(st.position);
+	    _status->position(st.position/st.length);
+	    _status->speed(st.stretch);
+	    _status->pitch(st.pitch);
+	    _status->cpu(st.cpu_load);
+	    _status->xruns(st.xruns_last_minute);
+
+	    _volume->setValue( _to_fader(st.volume) );
+	    _status->volume( _volume->value() / 1000.0 );
+
+	    _stretch->setValue( (st.stretch-0.25) * 1000 );
+
+	    _shown = st;
+	    _shown_valid = true;
+	}
+
+	_schedule_refresh(st.playing);
+    }
+
+    /**
+     * Something was changed from here.  Keep refreshing for half a
+     * second so that the result shows up even when not playing.
+     */
+    void PlayerWidget::_kick_refresh()
+    {
+	_linger = 500 / _refresh_msecs + 1;
+	_schedule_refresh(_shown_valid && _shown.playing);
+    }
+
+    /**
+     * Run _refresh_timer at the right rate, or stop it.  Nothing
+     * polls while hidden, minimized, or sitting still.  (When
+     * following JACK transport, someone else can start us, so it
+     * keeps checking a few times a second.)
+     */
+    void PlayerWidget::_schedule_refresh(bool playing)
+    {
+	int msecs = -1;
 
-	float len = _engine->get_length();
-	_status->position(pos/len);
+	if( !_refresh_timer ) return;
 
-	float sch = _engine->get_stretch();
-	_status->speed(sch);
+	if( isVisible() && !isMinimized() ) {
+	    if( playing || _linger > 0 ) {
+		msecs = _refresh_msecs;
+	    } else if( _config && _config->jack_transport() ) {
+		msecs = 250;
+	    }
+	}
 
-	int pit = _engine->get_pitch();
-	_status->pitch(pit);
+	if( msecs < 0 ) {
+	    _refresh_timer->stop();
+	} else if( !_refresh_timer->isActive() || _refresh_timer->interval() != msecs ) {
+	    _refresh_timer->start(msecs);
+	}
+    }
 
-	float cpu = _engine->get_cpu_load();
-	_status->cpu(cpu);
+    void PlayerWidget::showEvent(QShowEvent* event)
+    {
+	QMainWindow::showEvent(event);
+	_shown_valid = false; // Redraw it all
+	_kick_refresh();
+    }
 
-	float vol = _engine->get_volume();
-	_volume->setValue( _to_fader(vol) );
-	_status->volume( _volume->value() / 1000.0 );
+    void PlayerWidget::hideEvent(QHideEvent* event)
+    {
+	QMainWindow::hideEvent(event);
+	if( _refresh_timer ) _refresh_timer->stop();
+    }
 
-	_stretch->setValue( (sch-0.25) * 1000 );
-	_status->update();
+    void PlayerWidget::changeEvent(QEvent* event)
+    {
+	QMainWindow::changeEvent(event);
+	if( event->type() == QEvent::PaletteChange ) {
+	    _bg_cache = QPixmap();
+	    if( _status ) _status->update_palette();
+	    update();
+	} else if( event->type() == QEvent::WindowStateChange ) {
+	    // Stops on minimize, and catches up on restore
+	    _shown_valid = false;
+	    _kick_refresh();
+	}
     }
 
     void PlayerWidget::resizeEvent(QResizeEvent * /*event*/)
@@ -334,11 +440,32 @@ namespace StretchPlayer
 	_stretch->setStyleSheet(css);
 	_volume->setStyleSheet(css);
 	_layout_widgets();
+	_bg_cache = QPixmap();
     }
 
     void PlayerWidget::paintEvent(QPaintEvent * event)
     {
+	if( _bg_cache.size() != size() ) {
+	    _render_background();
+	}
+
+	const QRect& dirty = event->rect();
 	QPainter painter(this);
+	painter.drawPixmap(dirty, _bg_cache, dirty);
+
+	QWidget::paintEvent(event);
+    }
+
+    /**
+     * Draw the background (and set the window's shape) once per
+     * size and palette.  paintEvent() just copies from it.
+     */
+    void PlayerWidget::_render_background()
+    {
+	_bg_cache = QPixmap( size() );
+	_bg_cache.fill( Qt::transparent );
+
+	QPainter painter(&_bg_cache);
 	painter.setRenderHints(QPainter::Antialiasing);
 
 	const QPalette& pal = palette();
@@ -379,8 +506,6 @@ namespace StretchPlayer
 	painter.drawRoundedRect( bg_rect,
 				 border_rad,
 				 border_rad );
-
-	QWidget::paintEvent(event);
     }
 
     void PlayerWidget::mousePressEvent(QMouseEvent *event)
@@ -722,12 +847,16 @@ namespace StretchPlayer
 	connect(_volume, SIGNAL(sliderMoved(int)),
 		this, SLOT(volume(int)));
 
-	QTimer* timer = new QTimer(this);
-	timer->setSingleShot(false);
-	timer->setInterval(200);
-	connect(timer, SIGNAL(timeout()),
+	if( _config && _config->gui_rate() ) {
+	    _refresh_msecs = 1000 / _config->gui_rate();
+	    if( _refresh_msecs < 1 ) _refresh_msecs = 1;
+	    _status->set_frame_rate( _config->gui_rate() );
+	}
+	_refresh_timer = new QTimer(this);
+	_refresh_timer->setSingleShot(false);
+	connect(_refresh_timer, SIGNAL(timeout()),
 		this, SLOT(update_time()));
-	timer->start();
+	_kick_refresh(); // Started for real by showEvent()
     }
 
     float PlayerWidget::_margin()
@@ -22,7 +22,9 @@
 #include <QMainWindow>
 #include <memory>
 #include <QIcon>
+#include <QPixmap>
 #include "PlayerSizes.hpp"
+#include "Engine.hpp"
 
 class QToolButton;
 class QLabel;
@@ -31,13 +33,15 @@ class QHBoxLayout;
 class QSlider;
 class QSpinBox;
 class QPaintEvent;
+class QShowEvent;
+class QHideEvent;
+class QTimer;
 class QStyle;
 
 namespace StretchPlayer
 {
 
 class Configuration;
-class Engine;
 class EngineMessageCallback;
 class StatusWidget;
 
@@ -75,6 +79,9 @@ protected:
     virtual void mousePressEvent(QMouseEvent* event);
     virtual void mouseMoveEvent(QMouseEvent* event);
     //virtual void mouseReleaseEvent(QMouseEvent* event);
+    virtual void showEvent(QShowEvent* event);
+    virtual void hideEvent(QHideEvent* event);
+    virtual void changeEvent(QEvent* event);
 
 private:
     void _setup_color_scheme(int profile);
@@ -85,6 +92,9 @@ private:
     void _setup_signals_and_slots();
     Qt::CursorShape _which_cursor(const QPoint& pos);
     void _drag_resize(Qt::CursorShape cur, QMouseEvent* event);
+    void _render_background();
+    void _kick_refresh();
+    void _schedule_refresh(bool playing);
 
     // Encode/decode volume fader
     float _from_fader(int val);
@@ -135,6 +145,14 @@ private:
     QSlider *_stretch;
     QSlider *_volume;
     PlayerSizes _sizes;
+    QPixmap _bg_cache; // Background and border, made on demand
+
+    // Display refresh (see update_time())
+    QTimer *_refresh_timer;
+    int _refresh_msecs; // While playing
+    int _linger; // Ticks to keep refreshing after user input
+    bool _shown_valid;
+    Engine::state_t _shown; // What the display shows now
 
     std::auto_ptr<EngineMessageCallback> _engine_callback;
     std::auto_ptr<Engine> _engine;
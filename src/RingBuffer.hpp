@@ -19,49 +19,205 @@
 /*  This file came from the Ardour sources, SVN Rev 3435 2008-06-02.
     Changed file name and added Tritium namespaces and include guards.
     - Gabriel Beddingfield 2009-04-17, 2009-11-25
+
+    Replaced the QAtomicInt indexes with RingBufferIndex
+    (acquire/release, one cache line per side).  Added the optional
+    mirrored (wrap-free) backend.
+    - Gabriel Beddingfield 2011
 */
 
 #ifndef TRITIUM_RINGBUFFER_HPP
 #define TRITIUM_RINGBUFFER_HPP
 
 #include <cstring>
-#include <QAtomicInt>
+#include <cstdlib>
+#include <new>
+#include "MirroredBuffer.hpp"
 
 namespace Tritium
 {
 
+/**
+ * \brief Read and write indexes for a single-reader/single-writer
+ * ring of size (a power of 2) elements.
+ *
+ * The producer's index and the consumer's index live on separate
+ * cache lines, so the two threads don't fight over one line on every
+ * update.  Each side also keeps its own copy of the other side's
+ * index, and only reloads it (acquire) when the copy says there isn't
+ * enough room/data for the current request.  Updates are published
+ * with a release store, so everything written to the buffer before
+ * the index moves is visible to the other side.
+ *
+ * The producer_*() methods may only be called by the writer thread
+ * and the consumer_*() methods only by the reader thread.  The plain
+ * read_space()/write_space() may be called from any thread.
+ */
+class RingBufferIndex
+{
+public:
+	enum { CACHE_LINE = 64 };
+
+	RingBufferIndex (unsigned sz) : size (sz), size_mask (sz - 1) {
+		set (0, 0);
+	}
+
+	void set (unsigned r, unsigned w) {
+		/* !!! NOT THREAD SAFE !!! */
+		prod.idx = w;
+		prod.cached = r;
+		cons.idx = r;
+		cons.cached = w;
+		__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	}
+
+	unsigned read_idx () const {
+		return __atomic_load_n (&cons.idx, __ATOMIC_ACQUIRE);
+	}
+
+	unsigned write_idx () const {
+		return __atomic_load_n (&prod.idx, __ATOMIC_ACQUIRE);
+	}
+
+	unsigned read_space () const {
+		unsigned w = write_idx ();
+		return (w - read_idx ()) & size_mask;
+	}
+
+	unsigned write_space () const {
+		unsigned r = read_idx ();
+		return (r - write_idx () - 1) & size_mask;
+	}
+
+	/* Writer thread only */
+
+	unsigned producer_idx () const {
+		return prod.idx;
+	}
+
+	/**
+	 * Room for up to wanted elements.  Only touches the consumer's
+	 * cache line if the cached read index says there isn't enough.
+	 */
+	unsigned producer_space (unsigned wanted) {
+		unsigned space = (prod.cached - prod.idx - 1) & size_mask;
+		if (space < wanted) {
+			prod.cached = __atomic_load_n (&cons.idx, __ATOMIC_ACQUIRE);
+			space = (prod.cached - prod.idx - 1) & size_mask;
+		}
+		return space;
+	}
+
+	void producer_commit (unsigned cnt) {
+		__atomic_store_n (&prod.idx, (prod.idx + cnt) & size_mask, __ATOMIC_RELEASE);
+	}
+
+	/* Reader thread only */
+
+	unsigned consumer_idx () const {
+		return cons.idx;
+	}
+
+	unsigned consumer_space (unsigned wanted) {
+		unsigned space = (cons.cached - cons.idx) & size_mask;
+		if (space < wanted) {
+			cons.cached = __atomic_load_n (&prod.idx, __ATOMIC_ACQUIRE);
+			space = (cons.cached - cons.idx) & size_mask;
+		}
+		return space;
+	}
+
+	void consumer_commit (unsigned cnt) {
+		__atomic_store_n (&cons.idx, (cons.idx + cnt) & size_mask, __ATOMIC_RELEASE);
+	}
+
+	/**
+	 * Allocation helpers for classes that contain a
+	 * RingBufferIndex.  operator new does not honor the alignment
+	 * of prod and cons (below) before C++17.
+	 */
+	static void* alloc (size_t bytes) {
+		void *p = 0;
+		if (posix_memalign (&p, CACHE_LINE, bytes))
+			throw std::bad_alloc ();
+		return p;
+	}
+
+	static void release (void *p) {
+		free (p);
+	}
+
+private:
+	struct side {
+		unsigned idx;    // Owned by this side
+		unsigned cached; // This side's copy of the other side's idx
+		char pad[CACHE_LINE - 2 * sizeof (unsigned)];
+	} __attribute__ ((aligned (CACHE_LINE)));
+
+	const unsigned size;
+	const unsigned size_mask;
+	side prod;
+	side cons;
+};
+
+/**
+ * Ring size (a power of 2) for at least sz elements of elem_size
+ * bytes.  A mirrored ring also has to be a whole number of pages.
+ */
+inline unsigned ring_buffer_size (unsigned sz, size_t elem_size, bool mirrored)
+{
+	unsigned power_of_two;
+	for (power_of_two = 1; 1U<<power_of_two < sz; power_of_two++) {}
+	sz = 1U<<power_of_two;
+	if (mirrored) {
+		while ((sz * elem_size) % MirroredBuffer::page_size ())
+			sz <<= 1;
+	}
+	return sz;
+}
+
+/**
+ * If mirrored is true, the buffer is mapped twice back-to-back (see
+ * MirroredBuffer), and read/write vectors always come back as a single
+ * segment (len[1] == 0).  The size is rounded up to a whole number of
+ * pages.  If the mapping can't be made, it quietly falls back to the
+ * ordinary two-segment buffer; check mirrored().
+ */
 template<class T>
-class RingBuffer 
+class RingBuffer
 {
   public:
-	RingBuffer (unsigned sz) {
-//	size = ffs(sz); /* find first [bit] set is a single inlined assembly instruction. But it looks like the API rounds up so... */
-	unsigned power_of_two;
-	for (power_of_two = 1; 1U<<power_of_two < sz; power_of_two++);
-		size = 1<<power_of_two;
+	RingBuffer (unsigned sz, bool mirrored = false) :
+		idx (ring_buffer_size (sz, sizeof (T), mirrored)) {
+		size = ring_buffer_size (sz, sizeof (T), mirrored);
 		size_mask = size;
 		size_mask -= 1;
-		buf = new T[size];
+		if (mirrored && mirror.map (size * sizeof (T), 1)) {
+			buf = static_cast<T*> (mirror.region (0));
+		} else {
+			buf = new T[size];
+		}
 		reset ();
-
 	};
-	
+
 	virtual ~RingBuffer() {
-		delete [] buf;
+		if (!mirror.is_mapped ())
+			delete [] buf;
 	}
 
+	static void* operator new (size_t bytes) { return RingBufferIndex::alloc (bytes); }
+	static void operator delete (void *p) { RingBufferIndex::release (p); }
+
 	void reset () {
 		/* !!! NOT THREAD SAFE !!! */
-		write_idx.fetchAndStoreOrdered(0);
-		read_idx.fetchAndStoreOrdered(0);
+		idx.set (0, 0);
 	}
 
 	void set (unsigned r, unsigned w) {
 		/* !!! NOT THREAD SAFE !!! */
-		write_idx.fetchAndStoreOrdered(w);
-		read_idx.fetchAndStoreOrdered(r);
+		idx.set (r, w);
 	}
-	
+
 	unsigned read  (T *dest, unsigned cnt);
 	unsigned  write (T *src, unsigned cnt);
 
@@ -72,102 +228,72 @@ class RingBuffer
 
 	void get_read_vector (rw_vector *);
 	void get_write_vector (rw_vector *);
-	
+
 	void decrement_read_idx (unsigned cnt) {
-		read_idx.fetchAndStoreOrdered(
-			read_idx.fetchAndAddOrdered( - (int)cnt ) & size_mask
-			);
-	}                
+		idx.consumer_commit (- cnt);
+	}
 
 	void increment_read_idx (unsigned cnt) {
-		read_idx.fetchAndStoreOrdered(
-			read_idx.fetchAndAddOrdered( (int)cnt ) & size_mask
-			);
-	}                
+		idx.consumer_commit (cnt);
+	}
 
 	void increment_write_idx (unsigned cnt) {
-		write_idx.fetchAndStoreOrdered(
-			write_idx.fetchAndAddOrdered( (int)cnt ) & size_mask
-			);
-	}                
+		idx.producer_commit (cnt);
+	}
 
 	unsigned write_space () {
-		unsigned w, r;
-		
-		w = (int) write_idx;
-		r = (int) read_idx;
-		
-		if (w > r) {
-			return ((r - w + size) & size_mask) - 1;
-		} else if (w < r) {
-			return (r - w) - 1;
-		} else {
-			return size - 1;
-		}
+		return idx.write_space ();
 	}
-	
+
 	unsigned read_space () {
-		unsigned w, r;
-		
-		w = (int) write_idx;
-		r = (int) read_idx;
-		
-		if (w > r) {
-			return w - r;
-		} else {
-			return (w - r + size) & size_mask;
-		}
+		return idx.read_space ();
 	}
 
 	T *buffer () { return buf; }
-	unsigned get_write_idx () const { return (int)write_idx; }
-	unsigned get_read_idx () const { return (int)read_idx; }
+	unsigned get_write_idx () const { return idx.write_idx (); }
+	unsigned get_read_idx () const { return idx.read_idx (); }
 	unsigned bufsize () const { return size; }
+	bool mirrored () const { return mirror.is_mapped (); }
 
   protected:
 	T *buf;
 	unsigned size;
-	mutable QAtomicInt write_idx;
-	mutable QAtomicInt read_idx;
 	unsigned size_mask;
+	MirroredBuffer mirror;
+	RingBufferIndex idx;
 };
 
-template<class T> unsigned 
+template<class T> unsigned
 RingBuffer<T>::read (T *dest, unsigned cnt)
 {
         unsigned free_cnt;
-        unsigned cnt2;
         unsigned to_read;
         unsigned n1, n2;
         unsigned priv_read_idx;
 
-        priv_read_idx = (int) read_idx;
+        priv_read_idx = idx.consumer_idx ();
 
-        if ((free_cnt = read_space ()) == 0) {
+        if ((free_cnt = idx.consumer_space (cnt)) == 0) {
                 return 0;
         }
 
         to_read = cnt > free_cnt ? free_cnt : cnt;
-        
-        cnt2 = priv_read_idx + to_read;
 
-        if (cnt2 > size) {
+        if (priv_read_idx + to_read > size && !mirrored ()) {
                 n1 = size - priv_read_idx;
-                n2 = cnt2 & size_mask;
+                n2 = to_read - n1;
         } else {
                 n1 = to_read;
                 n2 = 0;
         }
-        
+
         memcpy (dest, &buf[priv_read_idx], n1 * sizeof (T));
-        priv_read_idx = (priv_read_idx + n1) & size_mask;
 
         if (n2) {
                 memcpy (dest+n1, buf, n2 * sizeof (T));
-                priv_read_idx = n2;
         }
 
-        read_idx.fetchAndStoreOrdered(priv_read_idx);
+        idx.consumer_commit (to_read);
         return to_read;
 }
 
@@ -176,38 +302,33 @@ RingBuffer<T>::write (T *src, unsigned cnt)
 
 {
         unsigned free_cnt;
-        unsigned cnt2;
         unsigned to_write;
         unsigned n1, n2;
         unsigned priv_write_idx;
 
-        priv_write_idx = (int) write_idx;
+        priv_write_idx = idx.producer_idx ();
 
-        if ((free_cnt = write_space ()) == 0) {
+        if ((free_cnt = idx.producer_space (cnt)) == 0) {
                 return 0;
         }
 
         to_write = cnt > free_cnt ? free_cnt : cnt;
-        
-        cnt2 = priv_write_idx + to_write;
 
-        if (cnt2 > size) {
+        if (priv_write_idx + to_write > size && !mirrored ()) {
                 n1 = size - priv_write_idx;
-                n2 = cnt2 & size_mask;
+                n2 = to_write - n1;
         } else {
                 n1 = to_write;
                 n2 = 0;
         }
 
         memcpy (&buf[priv_write_idx], src, n1 * sizeof (T));
-        priv_write_idx = (priv_write_idx + n1) & size_mask;
 
         if (n2) {
                 memcpy (buf, src+n1, n2 * sizeof (T));
-                priv_write_idx = n2;
         }
 
-	write_idx.fetchAndStoreOrdered( priv_write_idx );
+        idx.producer_commit (to_write);
         return to_write;
 }
 
@@ -216,35 +337,26 @@ RingBuffer<T>::get_read_vector (RingBuffer<T>::rw_vector *vec)
 
 {
 	unsigned free_cnt;
-	unsigned cnt2;
-	unsigned w, r;
-	
-	w = (int) write_idx;
-	r = (int) read_idx;
-	
-	if (w > r) {
-		free_cnt = w - r;
-	} else {
-		free_cnt = (w - r + size) & size_mask;
-	}
+	unsigned r;
 
-	cnt2 = r + free_cnt;
+	r = idx.consumer_idx ();
+	free_cnt = idx.consumer_space (size);
 
-	if (cnt2 > size) {
+	if (r + free_cnt > size && !mirrored ()) {
 		/* Two part vector: the rest of the buffer after the
-		   current write ptr, plus some from the start of 
+		   current write ptr, plus some from the start of
 		   the buffer.
 		*/
 
 		vec->buf[0] = &buf[r];
 		vec->len[0] = size - r;
 		vec->buf[1] = buf;
-		vec->len[1] = cnt2 & size_mask;
+		vec->len[1] = free_cnt - vec->len[0];
 
 	} else {
-		
+
 		/* Single part vector: just the rest of the buffer */
-		
+
 		vec->buf[0] = &buf[r];
 		vec->len[0] = free_cnt;
 		vec->len[1] = 0;
@@ -256,33 +368,22 @@ RingBuffer<T>::get_write_vector (RingBuffer<T>::rw_vector *vec)
 
 {
 	unsigned free_cnt;
-	unsigned cnt2;
-	unsigned w, r;
-	
-	w = (int) write_idx;
-	r = (int) read_idx;
-	
-	if (w > r) {
-		free_cnt = ((r - w + size) & size_mask) - 1;
-	} else if (w < r) {
-		free_cnt = (r - w) - 1;
-	} else {
-		free_cnt = size - 1;
-	}
-	
-	cnt2 = w + free_cnt;
+	unsigned w;
+
+	w = idx.producer_idx ();
+	free_cnt = idx.producer_space (size);
+
+	if (w + free_cnt > size && !mirrored ()) {
 
-	if (cnt2 > size) {
-		
 		/* Two part vector: the rest of the buffer after the
-		   current write ptr, plus some from the start of 
+		   current write ptr, plus some from the start of
 		   the buffer.
 		*/
 
 		vec->buf[0] = &buf[w];
 		vec->len[0] = size - w;
 		vec->buf[1] = buf;
-		vec->len[1] = cnt2 & size_mask;
+		vec->len[1] = free_cnt - vec->len[0];
 	} else {
 		vec->buf[0] = &buf[w];
 		vec->len[0] = free_cnt;
@@ -21,8 +21,15 @@
 #include <rubberband/RubberBandStretcher.h>
 #include <unistd.h>
 #include <cassert>
+#include <cerrno>
+#include <cstring>
 #include <pthread.h>
+#include <sched.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <iostream>
+
+using namespace std;
 
 using RubberBand::RubberBandStretcher;
 
@@ -32,9 +39,16 @@ namespace StretchPlayer
 	_running(true),
 	_stretcher_feed_block(512),
 	_cpu_load(0.0),
+	_warned_priority(false),
+	_warned_affinity(false),
 	_time_ratio_param(1.0),
 	_pitch_scale_param(1.0),
-	_reset_param(false)
+	_reset_param(false),
+	_active_param(false),
+	_sched_param_changed(false),
+	_rt_priority_param(0),
+	_cpu_mask_param(0),
+	_lock_memory_param(false)
     {
 	_stretcher.reset(
 	    new RubberBandStretcher( sample_rate,
@@ -48,10 +62,18 @@ namespace StretchPlayer
 
 	_stretcher->setMaxProcessSize(MAXBUF*4);
 
-	_inputs[0].reset( new ringbuffer_t(MAXBUF*4) );
-	_inputs[1].reset( new ringbuffer_t(MAXBUF*4) );
-	_outputs[0].reset( new ringbuffer_t(MAXBUF*4) );
-	_outputs[1].reset( new ringbuffer_t(MAXBUF*4) );
+	// Mirrored, so that every span is contiguous and can be
+	// handed to the stretcher without a copy.
+	_input.reset( new ringbuffer_t(MAXBUF*4, true) );
+	_output.reset( new ringbuffer_t(MAXBUF*4, true) );
+
+	// Only used when the rings couldn't be mirrored and the input
+	// span wraps around the end of the ring.  Sized for the
+	// largest feed block that set_segment_size() allows so that
+	// it never has to be reallocated under the worker thread.
+	_scratch[0].resize( 1L<<14, 0.0f );
+	_scratch[1].resize( 1L<<14, 0.0f );
+	_prefault_buffers();
 
 	_proc_time.insert( _proc_time.end(), 64, 0 );
 	_idle_time.insert( _idle_time.end(), 64, 0 );
@@ -117,12 +139,124 @@ namespace StretchPlayer
 
     void RubberBandServer::go_idle()
     {
-	setPriority(QThread::IdlePriority);
+	QMutexLocker lk(&_param_mutex);
+	_active_param = false;
+	_sched_param_changed = true;
+	_wait_cond.wakeOne();
     }
 
     void RubberBandServer::go_active()
     {
-	setPriority(QThread::TimeCriticalPriority);
+	QMutexLocker lk(&_param_mutex);
+	_active_param = true;
+	_sched_param_changed = true;
+	_wait_cond.wakeOne();
+    }
+
+    void RubberBandServer::set_scheduling(int priority, unsigned long cpu_mask, bool lock_memory)
+    {
+	QMutexLocker lk(&_param_mutex);
+	_rt_priority_param = priority;
+	_cpu_mask_param = cpu_mask;
+	_lock_memory_param = lock_memory;
+	_sched_param_changed = true;
+	_wait_cond.wakeOne();
+    }
+
+    /**
+     * Touch every page of the ring buffers so that the first pass
+     * through them doesn't page-fault.  Only call this when the
+     * worker isn't using them (e.g. right after allocation).
+     */
+    void RubberBandServer::_prefault_buffers()
+    {
+	for( unsigned k = 0 ; k < _input->channels() ; ++k ) {
+	    memset( _input->buffer(k), 0, _input->bufsize() * sizeof(float) );
+	    memset( _output->buffer(k), 0, _output->bufsize() * sizeof(float) );
+	}
+    }
+
+    /**
+     * Copy out the scheduling parameters and clear the changed flag.
+     *
+     * PARAM MUTEX MUST ALREADY BE LOCKED.
+     */
+    RubberBandServer::sched_t RubberBandServer::_take_scheduling()
+    {
+	sched_t sched;
+
+	sched.active = _active_param;
+	sched.rt_priority = _rt_priority_param;
+	sched.cpu_mask = _cpu_mask_param;
+	sched.lock_memory = _active_param && _lock_memory_param;
+	if( sched.lock_memory ) {
+	    // Process-wide, so only needs to be tried once.
+	    _lock_memory_param = false;
+	}
+	_sched_param_changed = false;
+	return sched;
+    }
+
+    /**
+     * Apply the scheduling parameters to the calling thread.
+     *
+     * Must be called from the worker thread WITHOUT the param mutex
+     * held; the audio thread takes it every cycle.
+     */
+    void RubberBandServer::_apply_scheduling(const sched_t& sched)
+    {
+	sched_param sp;
+	int err;
+
+	if( sched.active && (sched.rt_priority > 0) ) {
+	    int prio = sched.rt_priority;
+	    int max = sched_get_priority_max(SCHED_FIFO);
+	    if( prio > max ) prio = max;
+	    sp.sched_priority = prio;
+	    err = pthread_setschedparam( pthread_self(), SCHED_FIFO, &sp );
+	    if(err && !_warned_priority) {
+		_warned_priority = true;
+		cerr << "WARNING: Could not set SCHED_FIFO priority " << prio
+		     << " for the time stretch thread (" << strerror(err) << ")."
+		     << "  Running with normal priority, which may cause"
+		     << " dropouts under load." << endl;
+	    }
+	} else {
+	    sp.sched_priority = 0;
+	    pthread_setschedparam( pthread_self(), SCHED_OTHER, &sp );
+	}
+
+	if( sched.active && sched.cpu_mask ) {
+	    cpu_set_t cpus;
+	    CPU_ZERO(&cpus);
+	    for( unsigned k = 0 ; k < sizeof(sched.cpu_mask) * 8 && k < CPU_SETSIZE ; ++k ) {
+		if( sched.cpu_mask & (1UL << k) )
+		    CPU_SET(k, &cpus);
+	    }
+	    err = pthread_setaffinity_np( pthread_self(), sizeof(cpus), &cpus );
+	    if(err && !_warned_affinity) {
+		_warned_affinity = true;
+		cerr << "WARNING: Could not set the CPU affinity of the time stretch"
+		     << " thread to 0x" << hex << sched.cpu_mask << dec
+		     << " (" << strerror(err) << ").  Running on any CPU." << endl;
+	    }
+	}
+
+	if( sched.lock_memory ) {
+	    if( mlockall(MCL_CURRENT | MCL_FUTURE) ) {
+		err = errno;
+		cerr << "WARNING: Could not lock memory (" << strerror(err) << ")."
+		     << "  Check RLIMIT_MEMLOCK (ulimit -l).  Memory may be"
+		     << " paged out." << endl;
+	    }
+	}
+
+	if( sched.active ) {
+	    // Pre-fault the stack that the processing loop will use.
+	    volatile char stack[1L<<16];
+	    for( unsigned long k = 0 ; k < sizeof(stack) ; k += 1024 )
+		stack[k] = 0;
+	}
     }
 
     void RubberBandServer::set_segment_size(unsigned long nframes)
@@ -152,11 +286,9 @@ namespace StretchPlayer
 
 	reset();
 	_stretcher->setMaxProcessSize(nframes * 4);
-	_inputs[0].reset( new ringbuffer_t(nframes * 4) );
-	_inputs[1].reset( new ringbuffer_t(nframes * 4) );
-	_outputs[0].reset( new ringbuffer_t(nframes * 4) );
-	_outputs[1].reset( new ringbuffer_t(nframes * 4) );
-
+	_input.reset( new ringbuffer_t(nframes * 4, true) );
+	_output.reset( new ringbuffer_t(nframes * 4, true) );
+	_prefault_buffers();
     }
 
     uint32_t RubberBandServer::feed_block_min() const
@@ -178,58 +310,43 @@ namespace StretchPlayer
     {
 	if(_reset_param)
 	    return 0;
-	uint32_t l, r;
-	l = _inputs[0]->write_space();
-	r = _inputs[1]->write_space();
-	return (l < r) ? l : r;
+	return _input->write_space();
     }
 
     uint32_t RubberBandServer::written()
     {
 	if(_reset_param)
 	    return 0;
-	uint32_t l, r;
-	l = _inputs[0]->read_space();
-	r = _inputs[1]->read_space();
-	return (l > r) ? l : r;
+	return _input->read_space();
     }
 
     uint32_t RubberBandServer::write_audio(float* left, float* right, uint32_t count)
     {
 	if(_reset_param)
 	    return 0;
-	unsigned l, r, max = available_write();
-	if( count > max ) count = max;
-	l = _inputs[0]->write(left, count);
-	r = _inputs[1]->write(right, count);
+	float* bufs[2] = { left, right };
+	count = _input->write(bufs, count);
 	_wait_cond.wakeOne();
 	// _have_new_data.wakeAll();
-	assert( l == r );
-	return l;
+	return count;
     }
 
     uint32_t RubberBandServer::available_read()
     {
 	if(_reset_param)
 	    return 0;
-	unsigned l, r;
-	l = _outputs[0]->read_space();
-	r = _outputs[1]->read_space();
-	return (l<r) ? l : r;
+	return _output->read_space();
     }
 
     uint32_t RubberBandServer::read_audio(float* left, float* right, uint32_t count)
     {
 	if(_reset_param)
 	    return 0;
-	unsigned l, r, max = available_read();
-	if( count > max ) count = max;
-	l = _outputs[0]->read(left, count);
-	r = _outputs[1]->read(right, count);
+	float* bufs[2] = { left, right };
+	count = _output->read(bufs, count);
 	_wait_cond.wakeOne();
 	// _room_for_output.wakeAll();
-	assert( l == r );
-	return l;
+	return count;
     }
 
     void RubberBandServer::nudge()
@@ -260,27 +377,84 @@ namespace StretchPlayer
 	_cpu_load = ans;
     }
 
-    void RubberBandServer::run()
+    /**
+     * Feed nget frames from the input rings to the stretcher.
+     *
+     * Where the frames are contiguous in the ring (always, if it is
+     * mirrored), the ring memory is handed directly to the
+     * stretcher.  Otherwise a span that wraps around the end of the
+     * ring is copied to the scratch buffer.
+     */
+    void RubberBandServer::_feed_stretcher(uint32_t nget)
     {
-	uint32_t read_l, read_r, nget;
-	uint32_t write_l, write_r, nput;
-	uint32_t tmp;
-	const unsigned BUFSIZE = (1L<<15);
+	ringbuffer_t::rw_vector vec;
 	float* bufs[2];
-	float left[BUFSIZE], right[BUFSIZE];
+	int k;
+
+	_input->get_read_vector(&vec);
+	assert( vec.len[0] + vec.len[1] >= nget );
+	for( k=0 ; k<2 ; ++k ) {
+	    if( nget == 0 ) {
+		bufs[k] = &_scratch[k][0];
+	    } else if( vec.len[0] >= nget ) {
+		bufs[k] = vec.buf[k][0];
+	    } else {
+		assert( nget <= _scratch[k].size() );
+		memcpy( &_scratch[k][0], vec.buf[k][0], vec.len[0] * sizeof(float) );
+		memcpy( &_scratch[k][vec.len[0]], vec.buf[k][1], (nget - vec.len[0]) * sizeof(float) );
+		bufs[k] = &_scratch[k][0];
+	    }
+	}
+
+	_stretcher->process(bufs, nget, false); // Must call even if nget == 0
+
+	if(nget) {
+	    _input->increment_read_idx(nget);
+	}
+    }
+
+    /**
+     * Retrieve up to nput frames from the stretcher straight into
+     * the output rings.  If the rings aren't mirrored and the free
+     * space wraps around the end of the ring, only the contiguous
+     * part is filled and the caller gets the rest on its next pass.
+     *
+     * \return the number of frames retrieved.
+     */
+    uint32_t RubberBandServer::_drain_stretcher(uint32_t nput)
+    {
+	ringbuffer_t::rw_vector vec;
+	float* bufs[2];
+	uint32_t got;
+
+	_output->get_write_vector(&vec);
+	if(nput > vec.len[0]) nput = vec.len[0];
+	if(nput == 0)
+	    return 0;
+
+	bufs[0] = vec.buf[0][0];
+	bufs[1] = vec.buf[1][0];
+	got = _stretcher->retrieve(bufs, nput);
+	_output->increment_write_idx(got);
+	return got;
+    }
+
+    void RubberBandServer::run()
+    {
+	uint32_t nget, nput;
 	float time_ratio, pitch_scale;
 	bool reset;
+	bool sched_changed;
 	bool proc_output;
 	int cpu_load_pos = 0;
 	timeval a, b, c;
 
-	bufs[0] = left;
-	bufs[1] = right;
-
 	QMutexLocker lock(&_param_mutex);
 	time_ratio = _time_ratio_param;
 	pitch_scale = _pitch_scale_param;
+	sched_t sched = _take_scheduling();
 	lock.unlock();
+	_apply_scheduling(sched);
 
 	size_t samples_required;
 	int samples_available;
@@ -294,20 +468,23 @@ namespace StretchPlayer
 	    reset = _reset_param;
 	    if(reset) {
 		_stretcher->reset();
-		_inputs[0]->reset();
-		_inputs[1]->reset();
-		_outputs[0]->reset();
-		_outputs[1]->reset();
+		_input->reset();
+		_output->reset();
 	    }
 	    _reset_param = false;
+	    sched_changed = _sched_param_changed;
+	    if(sched_changed) {
+		sched = _take_scheduling();
+	    }
 	    lock.unlock();
+	    if(sched_changed) {
+		_apply_scheduling(sched);
+	    }
 	    _stretcher->setTimeRatio(time_ratio);
 	    _stretcher->setPitchScale(pitch_scale);
 
 	    // Get input audio and put them into the stretcher
-	    read_l = _inputs[0]->read_space();
-	    read_r = _inputs[1]->read_space();
-	    nget = (read_l < read_r) ? read_l : read_r;
+	    nget = _input->read_space();
 	    samples_required = _stretcher->getSamplesRequired();
 	    samples_available = _stretcher->available();
 	    samples_available += available_read();
@@ -322,27 +499,17 @@ namespace StretchPlayer
 		    nget = 0;
 		}
 	    }
-	    if(nget) {
-		tmp = _inputs[0]->read(left, nget);
-		assert( tmp == nget );
-		tmp = _inputs[1]->read(right, nget);
-		assert( tmp == nget );
-	    }
-	    _stretcher->process(bufs, nget, false); // Must call even if nget == 0
+	    _feed_stretcher(nget);
 
 	    // Take output audio from stretcher and put on output buffers
 	    proc_output = false;
 	    nput = 1;
 	    while(_stretcher->available() > 0 && nput) {
-		write_l = _outputs[0]->write_space();
-		write_r = _outputs[1]->write_space();
-		nput = (write_l < write_r) ? write_l : write_r;
+		nput = _output->write_space();
 		if(nput) {
 		    proc_output = true;
 		    if(nput > feed_block_max()) nput = feed_block_max();
-		    tmp = _stretcher->retrieve(bufs, nput);
-		    _outputs[0]->write(left, tmp);
-		    _outputs[1]->write(right, tmp);
+		    nput = _drain_stretcher(nput);
 		}
 	    }
 
@@ -351,7 +518,9 @@ namespace StretchPlayer
 	    _proc_time[cpu_load_pos] = (b.tv_sec - a.tv_sec) * 1000000 + b.tv_usec - a.tv_usec;
 	    if( (nget == 0) && (! proc_output) && _stretcher->getSamplesRequired()) {
 		a = b;
+		_wait_mutex.lock();
 		_wait_cond.wait(&_wait_mutex, 100 /* ms */);
+		_wait_mutex.unlock();
 		gettimeofday(&b, 0);
 		_idle_time[cpu_load_pos] = (b.tv_sec - a.tv_sec) * 1000000 + b.tv_usec - a.tv_usec;
 	    } else {
@@ -21,7 +21,7 @@
 
 #include <stdint.h>
 #include <memory>
-#include "RingBuffer.hpp"
+#include "MultiChannelRingBuffer.hpp"
 #include <QMutex>
 #include <QWaitCondition>
 #include <QThread>
@@ -42,7 +42,7 @@ namespace StretchPlayer
     class RubberBandServer : private QThread
     {
     public:
-	typedef Tritium::RingBuffer<float> ringbuffer_t;
+	typedef Tritium::MultiChannelRingBuffer<float, 2> ringbuffer_t;
 
 	RubberBandServer( uint32_t sample_rate );
 	~RubberBandServer();
@@ -61,6 +61,18 @@ namespace StretchPlayer
 	void go_idle();
 	void go_active();
 
+	/**
+	 * Scheduling for the worker thread while it is active.
+	 *
+	 * priority is the SCHED_FIFO priority (0 = normal scheduling),
+	 * cpu_mask is a bitmask of CPUs it may run on (0 = any), and
+	 * lock_memory will mlockall() the whole process.  These are
+	 * applied by the worker thread itself the next time it wakes
+	 * up after go_active() or go_idle().  Failures are logged and
+	 * the thread keeps running without them.
+	 */
+	void set_scheduling(int priority, unsigned long cpu_mask, bool lock_memory);
+
 	void set_segment_size(unsigned long nframes);
 	uint32_t feed_block_min() const;
 	uint32_t feed_block_max() const;
@@ -77,13 +89,25 @@ namespace StretchPlayer
 	virtual void run();
 	void _process();
 	void _update_cpu_load();
+	void _feed_stretcher(uint32_t nget);
+	uint32_t _drain_stretcher(uint32_t nput);
+	struct sched_t {
+	    bool active;
+	    int rt_priority;
+	    unsigned long cpu_mask;
+	    bool lock_memory;
+	};
+	sched_t _take_scheduling();
+	void _apply_scheduling(const sched_t& sched);
+	void _prefault_buffers();
 
     private:
 	bool _running;
 	std::auto_ptr< RubberBand::RubberBandStretcher > _stretcher;
-	std::auto_ptr< ringbuffer_t > _inputs[2];
-	std::auto_ptr< ringbuffer_t > _outputs[2];
+	std::auto_ptr< ringbuffer_t > _input;
+	std::auto_ptr< ringbuffer_t > _output;
 	unsigned long _stretcher_feed_block;
+	std::vector<float> _scratch[2]; // Wrap-around input spans only
 
 	mutable QWaitCondition _wait_cond;
 	mutable QMutex _wait_mutex;
@@ -91,11 +115,18 @@ namespace StretchPlayer
 	std::vector<uint32_t> _proc_time; // usecs
 	std::vector<uint32_t> _idle_time; // usecs
 	float _cpu_load; // [0.0, 1.0]
+	bool _warned_priority; // Worker thread only
+	bool _warned_affinity; // Worker thread only
 
 	mutable QMutex _param_mutex; // Must be locked for these params:
 	float _time_ratio_param;
 	float _pitch_scale_param;
 	bool _reset_param;
+	bool _active_param;
+	bool _sched_param_changed;
+	int _rt_priority_param;
+	unsigned long _cpu_mask_param;
+	bool _lock_memory_param;
     };
 
 } // namespace StretchPlayer
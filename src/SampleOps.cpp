@@ -0,0 +1,242 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "SampleOps.hpp"
+#include <cassert>
+
+namespace StretchPlayer
+{
+    /* SIMD code for optimizing the gain application.
+     *
+     * Below is vectorized (SSE, SIMD) code for applying
+     * the gain.  If you enable >= SSE2 optimization, then
+     * this will calculate 4 floats at a time.  If you do
+     * not, then it will still work.
+     *
+     * This syntax is a GCC extension, but more portable
+     * than writing x86 assembly.
+     */
+
+    typedef float __vf4 __attribute__((vector_size(16)));
+    typedef union {
+	float f[4];
+	__vf4 v;
+    } vf4;
+
+    void apply_gain_to_buffer(float *buf, uint32_t nframes, float gain)
+    {
+	vf4* opt;
+	vf4 gg = {{gain, gain, gain, gain}};
+	unsigned long addr = (unsigned long)buf;
+	uint32_t head, ctr;
+
+	if( addr & 0x3 ) {
+	    // If it's not even 4-byte aligned
+	    // then this is is the un-optimized code.
+	    apply_gain_to_buffer_scalar(buf, nframes, gain);
+	    return;
+	}
+
+	// Plain code up to the first 16-byte boundary
+	head = ((16 - (addr & 0xf)) & 0xf) / sizeof(float);
+	if( head > nframes ) head = nframes;
+	nframes -= head;
+	while(head--) {
+	    (*buf++) *= gain;
+	}
+
+	assert( (((unsigned long)buf)&0xf) == 0 || nframes == 0 );
+	opt = (vf4*) buf;
+	ctr = nframes / 4;
+	while(ctr--) {
+	    opt->v *= gg.v; ++opt;
+	}
+
+	// ...and for whatever is left over.
+	buf = (float*) opt;
+	nframes &= 3;
+	while(nframes--) {
+	    (*buf++) *= gain;
+	}
+    }
+
+    void apply_gain_to_buffer_scalar(float *buf, uint32_t nframes, float gain)
+    {
+	while(nframes--) {
+	    (*buf++) *= gain;
+	}
+    }
+
+    void mix_to_buffer(float *dst,
+		       const float * const *src,
+		       const float *gain,
+		       unsigned nsrc,
+		       uint32_t nframes)
+    {
+	vf4 gg[MIX_MAX_SOURCES];
+	unsigned long addr = (unsigned long)dst;
+	unsigned s;
+	uint32_t k, n4;
+
+	assert( nsrc <= MIX_MAX_SOURCES );
+	for( s=0 ; s<nsrc ; ++s ) {
+	    addr |= (unsigned long)src[s];
+	}
+	if( (nsrc == 0) || (addr & 0xf) ) {
+	    mix_to_buffer_scalar(dst, src, gain, nsrc, nframes);
+	    return;
+	}
+
+	for( s=0 ; s<nsrc ; ++s ) {
+	    gg[s].f[0] = gg[s].f[1] = gg[s].f[2] = gg[s].f[3] = gain[s];
+	}
+
+	n4 = nframes / 4;
+	for( k=0 ; k<n4 ; ++k ) {
+	    __vf4 acc = gg[0].v * ((const __vf4*)src[0])[k];
+	    for( s=1 ; s<nsrc ; ++s ) {
+		acc += gg[s].v * ((const __vf4*)src[s])[k];
+	    }
+	    ((__vf4*)dst)[k] = acc;
+	}
+
+	// ...and for whatever is left over.
+	for( k=n4*4 ; k<nframes ; ++k ) {
+	    float acc = gain[0] * src[0][k];
+	    for( s=1 ; s<nsrc ; ++s ) {
+		acc += gain[s] * src[s][k];
+	    }
+	    dst[k] = acc;
+	}
+    }
+
+    void mix_to_buffer_scalar(float *dst,
+			      const float * const *src,
+			      const float *gain,
+			      unsigned nsrc,
+			      uint32_t nframes)
+    {
+	uint32_t k;
+	unsigned s;
+
+	if( nsrc == 0 ) {
+	    for( k=0 ; k<nframes ; ++k ) dst[k] = 0.0f;
+	    return;
+	}
+	for( k=0 ; k<nframes ; ++k ) {
+	    float acc = gain[0] * src[0][k];
+	    for( s=1 ; s<nsrc ; ++s ) {
+		acc += gain[s] * src[s][k];
+	    }
+	    dst[k] = acc;
+	}
+    }
+
+    void deinterleave_to_stereo(const float *src,
+				unsigned long nframes,
+				int channels,
+				float *left,
+				float *right)
+    {
+	unsigned long k;
+
+	if( channels == 2 ) {
+	    for( k=0 ; k<nframes ; ++k ) {
+		left[k] = src[0];
+		right[k] = src[1];
+		src += 2;
+	    }
+	} else {
+	    int r = (channels > 1) ? 1 : 0;
+	    for( k=0 ; k<nframes ; ++k ) {
+		left[k] = src[0];
+		right[k] = src[r];
+		src += channels;
+	    }
+	}
+    }
+
+    void deinterleave_to_stereo(const int16_t *src,
+				unsigned long nframes,
+				int channels,
+				float *left,
+				float *right)
+    {
+	const float scale = 1.0f / 32768.0f;
+	unsigned long k;
+	int r = (channels > 1) ? 1 : 0;
+
+	for( k=0 ; k<nframes ; ++k ) {
+	    left[k] = float(src[0]) * scale;
+	    right[k] = float(src[r]) * scale;
+	    src += channels;
+	}
+    }
+
+    void deinterleave(const float *src,
+		      unsigned long nframes,
+		      int channels,
+		      float * const *dst)
+    {
+	unsigned long k;
+	int c;
+
+	for( k=0 ; k<nframes ; ++k ) {
+	    for( c=0 ; c<channels ; ++c ) {
+		dst[c][k] = src[c];
+	    }
+	    src += channels;
+	}
+    }
+
+    void deinterleave(const int16_t *src,
+		      unsigned long nframes,
+		      int channels,
+		      float * const *dst)
+    {
+	const float scale = 1.0f / 32768.0f;
+	unsigned long k;
+	int c;
+
+	for( k=0 ; k<nframes ; ++k ) {
+	    for( c=0 ; c<channels ; ++c ) {
+		dst[c][k] = float(src[c]) * scale;
+	    }
+	    src += channels;
+	}
+    }
+
+    void deinterleave(const int32_t *src,
+		      unsigned long nframes,
+		      int channels,
+		      float * const *dst)
+    {
+	const float scale = 1.0f / 2147483648.0f;
+	unsigned long k;
+	int c;
+
+	for( k=0 ; k<nframes ; ++k ) {
+	    for( c=0 ; c<channels ; ++c ) {
+		dst[c][k] = float(src[c]) * scale;
+	    }
+	    src += channels;
+	}
+    }
+
+} // namespace StretchPlayer
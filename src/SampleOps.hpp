@@ -0,0 +1,120 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef SAMPLEOPS_HPP
+#define SAMPLEOPS_HPP
+
+#include <stdint.h>
+
+namespace StretchPlayer
+{
+    /**
+     * \brief Multiply each element in a buffer by a scalar.
+     *
+     * For each element in buf[0..nframes-1], buf[i] *= gain.
+     *
+     * Uses 4-wide vector code for the 16-byte aligned middle of the
+     * buffer, and plain code for the ends (or for the whole buffer
+     * if it isn't even 4-byte aligned).  RT safe.
+     */
+    void apply_gain_to_buffer(float *buf, uint32_t nframes, float gain);
+
+    /**
+     * Plain C version of apply_gain_to_buffer().  Reference for the
+     * benchmarks.
+     */
+    void apply_gain_to_buffer_scalar(float *buf, uint32_t nframes, float gain);
+
+    /// Most sources that mix_to_buffer() takes
+    enum { MIX_MAX_SOURCES = 8 };
+
+    /**
+     * \brief Sum several buffers into one, each with its own gain.
+     *
+     * For each element in dst[0..nframes-1],
+     * dst[i] = gain[0]*src[0][i] + ... + gain[nsrc-1]*src[nsrc-1][i].
+     * dst is overwritten (cleared if nsrc is 0), and may also be
+     * one of the sources.  nsrc must not be over MIX_MAX_SOURCES.
+     *
+     * Makes one pass over the data.  Uses 4-wide vector code when
+     * all of the buffers are 16-byte aligned, and plain code
+     * otherwise.  RT safe.
+     */
+    void mix_to_buffer(float *dst,
+		       const float * const *src,
+		       const float *gain,
+		       unsigned nsrc,
+		       uint32_t nframes);
+
+    /**
+     * Plain C version of mix_to_buffer().  Reference for the
+     * benchmarks.
+     */
+    void mix_to_buffer_scalar(float *dst,
+			      const float * const *src,
+			      const float *gain,
+			      unsigned nsrc,
+			      uint32_t nframes);
+
+    /**
+     * \brief Split interleaved frames into a left and right buffer.
+     *
+     * src holds nframes frames of channels samples.  Channel 0 goes
+     * to left, and channel 1 (or channel 0 again, for mono) goes to
+     * right.  Any other channels are ignored.
+     */
+    void deinterleave_to_stereo(const float *src,
+				unsigned long nframes,
+				int channels,
+				float *left,
+				float *right);
+
+    /**
+     * Same as above, for signed 16-bit samples.  Scaled to [-1.0, 1.0).
+     */
+    void deinterleave_to_stereo(const int16_t *src,
+				unsigned long nframes,
+				int channels,
+				float *left,
+				float *right);
+
+    /**
+     * \brief Split interleaved frames into one buffer per channel.
+     *
+     * src holds nframes frames of channels samples, and dst has
+     * channels buffers of nframes.  Integers are scaled to
+     * [-1.0, 1.0).  RT safe.
+     */
+    void deinterleave(const float *src,
+		      unsigned long nframes,
+		      int channels,
+		      float * const *dst);
+
+    void deinterleave(const int16_t *src,
+		      unsigned long nframes,
+		      int channels,
+		      float * const *dst);
+
+    void deinterleave(const int32_t *src,
+		      unsigned long nframes,
+		      int channels,
+		      float * const *dst);
+
+} // namespace StretchPlayer
+
+#endif // SAMPLEOPS_HPP
@@ -0,0 +1,73 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <stdint.h>
+
+namespace StretchPlayer
+{
+    /**
+     * \brief A value that one thread publishes and others read whole.
+     *
+     * publish() brackets the copy with a sequence count (a
+     * seqlock), and read() copies the value out and tries again if
+     * the count says that it raced with a publish().  The publisher
+     * never waits, and readers never see half of one value and half
+     * of the next.  T must be plain data.
+     *
+     * publish() must only be called by one thread. [RT SAFE]  read()
+     * may be called from any thread.
+     */
+    template <typename T>
+    class Snapshot
+    {
+    public:
+	Snapshot() : _seq(0), _val() {}
+
+	void publish(const T& val) {
+	    ++_seq;
+	    __sync_synchronize();
+	    _val = val;
+	    __sync_synchronize();
+	    ++_seq;
+	}
+
+	T read() const {
+	    T val;
+	    uint32_t seq;
+	    do {
+		while( (seq = _seq) & 1 ) {
+		    // A publish() is in progress
+		}
+		__sync_synchronize();
+		val = _val;
+		__sync_synchronize();
+	    } while( seq != _seq );
+	    return val;
+	}
+
+    private:
+	volatile uint32_t _seq; // Odd while publishing
+	T _val;
+    };
+
+} // namespace StretchPlayer
+
+#endif // SNAPSHOT_HPP
@@ -0,0 +1,212 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+#include "SongLoader.hpp"
+#include "SampleOps.hpp"
+#include <sndfile.h>
+#include <mpg123.h>
+#include <cstring>
+#include <QString>
+
+namespace StretchPlayer
+{
+    static inline void _message(const QString& msg, loader_message_callback_t cb, void *arg)
+    {
+	if(cb) (*cb)(msg, false, arg);
+    }
+
+    static inline void _error(const QString& msg, loader_message_callback_t cb, void *arg)
+    {
+	if(cb) (*cb)(msg, true, arg);
+    }
+
+    bool load_song(const QString& filename,
+		   std::vector<float>& left,
+		   std::vector<float>& right,
+		   float& sample_rate,
+		   loader_message_callback_t cb,
+		   void *cb_arg)
+    {
+	left.clear();
+	right.clear();
+
+	if( load_song_using_libsndfile(filename, left, right, sample_rate, cb, cb_arg) )
+	    return true;
+
+	left.clear();
+	right.clear();
+
+	if( load_song_using_libmpg123(filename, left, right, sample_rate, cb, cb_arg) )
+	    return true;
+
+	left.clear();
+	right.clear();
+	return false;
+    }
+
+    /**
+     * Attempt to load a file via libsndfile
+     *
+     * \return true on success
+     */
+    bool load_song_using_libsndfile(const QString& filename,
+				    std::vector<float>& left,
+				    std::vector<float>& right,
+				    float& sample_rate,
+				    loader_message_callback_t cb,
+				    void *cb_arg)
+    {
+	SNDFILE *sf = 0;
+	SF_INFO sf_info;
+	memset(&sf_info, 0, sizeof(sf_info));
+
+	_message( QString("Opening file..."), cb, cb_arg );
+	sf = sf_open(filename.toLocal8Bit().data(), SFM_READ, &sf_info);
+	if( !sf ) {
+	    _error( QString("Error opening file '%1': %2")
+		    .arg(filename)
+		    .arg( sf_strerror(sf) ), cb, cb_arg );
+	    return false;
+	}
+
+	sample_rate = sf_info.samplerate;
+	left.reserve( sf_info.frames );
+	right.reserve( sf_info.frames );
+
+	if(sf_info.frames == 0) {
+	    _error( QString("Error opening file '%1': File is empty")
+		    .arg(filename), cb, cb_arg );
+	    sf_close(sf);
+	    return false;
+	}
+
+	_message( QString("Reading file..."), cb, cb_arg );
+	const sf_count_t chunk = 4096; // frames
+	std::vector<float> buf(chunk * sf_info.channels, 0.0f);
+	sf_count_t read;
+	size_t pos;
+	while(true) {
+	    read = sf_readf_float(sf, &buf[0], chunk);
+	    if( read < 1 ) break;
+	    pos = left.size();
+	    left.resize( pos + read );
+	    right.resize( pos + read );
+	    /* remaining channels ignored */
+	    deinterleave_to_stereo( &buf[0], read, sf_info.channels, &left[pos], &right[pos] );
+	}
+
+	if( left.size() != sf_info.frames ) {
+	    _error( QString("Warning: not all of the file data was read."), cb, cb_arg );
+	}
+
+	sf_close(sf);
+	return true;
+    }
+
+    /**
+     * Attempt to load an MP3 file via libmpg123
+     *
+     * adapted by Sean Bolton from mpg123_to_wav.c
+     *
+     * \return true on success
+     */
+    bool load_song_using_libmpg123(const QString& filename,
+				   std::vector<float>& left,
+				   std::vector<float>& right,
+				   float& sample_rate,
+				   loader_message_callback_t cb,
+				   void *cb_arg)
+    {
+	mpg123_handle *mh = 0;
+	int err, channels, encoding;
+	long rate;
+
+	_message( QString("Opening file..."), cb, cb_arg );
+	if ((err = mpg123_init()) != MPG123_OK ||
+	    (mh = mpg123_new(0, &err)) == 0 ||
+	    mpg123_open(mh, filename.toLocal8Bit().data()) != MPG123_OK ||
+	    mpg123_getformat(mh, &rate, &channels, &encoding) != MPG123_OK) {
+
+	    _error( QString("Error opening file '%1': %2")
+		    .arg(filename)
+		    .arg(mh == NULL ? mpg123_plain_strerror(err) : mpg123_strerror(mh)),
+		    cb, cb_arg );
+
+	  mpg123error:
+	    mpg123_close(mh);
+	    mpg123_delete(mh);
+	    mpg123_exit();
+	    return false;
+	}
+	if (encoding != MPG123_ENC_SIGNED_16) {
+	    _error( QString("Error: unsupported encoding format."), cb, cb_arg );
+	    goto mpg123error;
+	}
+	/* lock the output format */
+	mpg123_format_none(mh);
+	mpg123_format(mh, rate, channels, encoding);
+
+	off_t length = mpg123_length(mh);
+	if (length == MPG123_ERR || length == 0) {
+	    _error( QString("Error: file is empty or length unknown."), cb, cb_arg );
+	    goto mpg123error;
+	}
+
+	sample_rate = rate;
+	left.reserve( length );
+	right.reserve( length );
+
+	_message( QString("Reading file..."), cb, cb_arg );
+	std::vector<int16_t> buffer(4096, 0);
+	size_t read = 0, pos;
+
+	while (1) {
+	    err = mpg123_read(mh, (unsigned char*)&buffer[0], buffer.size() * sizeof(int16_t), &read);
+	    if (err != MPG123_OK && err != MPG123_DONE)
+		break;
+	    if (read > 0) {
+		/* mpg123 always hands back whole frames */
+		read /= sizeof(int16_t) * channels;
+		pos = left.size();
+		left.resize( pos + read );
+		right.resize( pos + read );
+		/* remaining channels ignored */
+		deinterleave_to_stereo( &buffer[0], read, channels, &left[pos], &right[pos] );
+	    }
+	    if (err == MPG123_DONE)
+		break;
+	};
+
+	if (err == MPG123_NEED_MORE) {
+	    _error( QString("Warning: premature end of MP3 stream"), cb, cb_arg );
+	    /* allow user to play what we did manage to read */
+	} else if (err != MPG123_DONE) {
+	    _error( QString("Error decoding file: %1.")
+		    .arg(err == MPG123_ERR ? mpg123_strerror(mh) : mpg123_plain_strerror(err)),
+		    cb, cb_arg );
+	    goto mpg123error;
+	}
+
+	mpg123_close(mh);
+	mpg123_delete(mh);
+	mpg123_exit();
+	return true;
+    }
+
+} // namespace StretchPlayer
@@ -0,0 +1,72 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef SONGLOADER_HPP
+#define SONGLOADER_HPP
+
+#include <vector>
+
+class QString;
+
+namespace StretchPlayer
+{
+    /**
+     * Callback for status and error messages while loading.
+     *
+     * is_error is true for errors and warnings, false for plain
+     * status messages.
+     */
+    typedef void (*loader_message_callback_t)(const QString& msg, bool is_error, void *arg);
+
+    /**
+     * \brief Decode an audio file into planar stereo buffers.
+     *
+     * Tries libsndfile first, then libmpg123.  left and right are
+     * cleared first, and on success hold the same number of frames.
+     * Mono files are copied to both channels, and channels beyond
+     * the second are ignored.
+     *
+     * These are used by the Engine and by the offline tools, so they
+     * must not depend on the audio system or the GUI.  Not RT safe.
+     *
+     * \return true on success
+     */
+    bool load_song(const QString& filename,
+		   std::vector<float>& left,
+		   std::vector<float>& right,
+		   float& sample_rate,
+		   loader_message_callback_t cb = 0,
+		   void *cb_arg = 0);
+
+    bool load_song_using_libsndfile(const QString& filename,
+				    std::vector<float>& left,
+				    std::vector<float>& right,
+				    float& sample_rate,
+				    loader_message_callback_t cb = 0,
+				    void *cb_arg = 0);
+
+    bool load_song_using_libmpg123(const QString& filename,
+				   std::vector<float>& left,
+				   std::vector<float>& right,
+				   float& sample_rate,
+				   loader_message_callback_t cb = 0,
+				   void *cb_arg = 0);
+
+} // namespace StretchPlayer
+
+#endif // SONGLOADER_HPP
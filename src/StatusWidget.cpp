@@ -33,6 +33,7 @@
 #include <QSpinBox>
 #include <QFileDialog>
 #include <QPainter>
+#include <QPaintEvent>
 #include <QBitmap>
 
 namespace StretchPlayer
@@ -42,8 +43,14 @@ namespace StretchPlayer
 	: QWidget(parent),
 	  _sizes(sizes)
     {
+	_time.font = &_large_font;
+	_speed.font = &_small_font;
+	_pitch.font = &_small_font;
+	_cpu.font = &_small_font;
+	_volume.font = &_small_font;
+
 	// Using REVERSE colors of parent.
-	_update_palette();
+	update_palette();
 
 	_position = new Widgets::ThinSlider(this);
 	_position->setMinimum(0);
@@ -73,36 +80,52 @@ namespace StretchPlayer
     {
 	int min = (int)(time/60.0);
 	float sec = time - min*60.0;
-	_time = QString("%1:%2")
-	    .arg(int(min), 2, 10, QChar('0'))
-	    .arg(double(sec), 4, 'f', 1, QChar('0'));
+	_set_field( _time, QString("%1:%2")
+		    .arg(int(min), 2, 10, QChar('0'))
+		    .arg(double(sec), 4, 'f', 1, QChar('0')) );
     }
 
     void StatusWidget::speed(float val)
     {
 	val *= 100.0;
-	_speed = QString("SPEED: %1%")
-	    .arg(val, 3, 'f', 0);
+	_set_field( _speed, QString("SPEED: %1%")
+		    .arg(val, 3, 'f', 0) );
     }
 
     void StatusWidget::pitch(int p)
     {
-	_pitch = QString("PITCH: %1")
-	    .arg(int(p));
+	_set_field( _pitch, QString("PITCH: %1")
+		    .arg(int(p)) );
     }
 
     void StatusWidget::volume(float g)
     {
 	g *= 100.0;
-	_volume = QString("VOL: %1%")
-	    .arg(g, 3, 'f', 0, ' ');
+	_set_field( _volume, QString("VOL: %1%")
+		    .arg(g, 3, 'f', 0, ' ') );
     }
 
     void StatusWidget::cpu(float c)
     {
 	c *= 100.0;
-	_cpu = QString("CPU: %1%")
+	_cpu_text = QString("CPU: %1%")
 	    .arg(c, 3, 'f', 0, ' ');
+	_set_field( _cpu, _cpu_text + _xruns_text );
+    }
+
+    void StatusWidget::xruns(unsigned long n)
+    {
+	if( n ) {
+	    _xruns_text = QString(" XRUN: %1/min").arg(n);
+	} else {
+	    _xruns_text = QString();
+	}
+	_set_field( _cpu, _cpu_text + _xruns_text );
+    }
+
+    void StatusWidget::set_frame_rate(unsigned hz)
+    {
+	_message->set_frame_rate(hz);
     }
 
     void StatusWidget::message(QString msg)
@@ -173,16 +196,105 @@ namespace StretchPlayer
 	_message_font = _small_font;
 	_message_font.setStretch(100);
 	_message->set_font(_message_font);
+
+	_time.zone = _time_zone;
+	QRect stat = _stats_zone;
+	stat.setHeight( stat.height() / 4 );
+	_speed.zone = stat;
+	stat.moveTo( stat.x(), stat.bottom() );
+	_pitch.zone = stat;
+	stat.moveTo( stat.x(), stat.bottom() );
+	_cpu.zone = stat;
+	stat.moveTo( stat.x(), stat.bottom() );
+	_volume.zone = stat;
+
+	// The text may not fit the new fonts (see _set_field())
+	_fit_font(_large_font, _time.text, _time_zone.width());
+	_fit_font(_small_font, _speed.text, _stats_zone.width());
+	_prepare_field(_time);
+	_prepare_field(_speed);
+	_prepare_field(_pitch);
+	_prepare_field(_cpu);
+	_prepare_field(_volume);
+
+	_bg_cache = QPixmap();
     }
 
-    void StatusWidget::paintEvent(QPaintEvent * /*event*/)
+    /**
+     * Change one field.  Nothing happens if the text is the same.
+     * Otherwise it is laid out again and just its zone is
+     * repainted, unless the font had to be narrowed to fit it, in
+     * which case every field in that font is.
+     */
+    void StatusWidget::_set_field(field_t& f, const QString& text)
     {
-	// Using REVERSE colors of parent.
-	_update_palette();
+	if( text == f.text )
+	    return;
+	f.text = text;
 
-	QPainter painter(this);
+	// Audit the font sizes.  Only change them if there is a problem.
+	bool narrowed = false;
+	if( &f == &_time ) {
+	    narrowed = _fit_font(_large_font, text, _time_zone.width());
+	} else if( &f == &_speed ) {
+	    narrowed = _fit_font(_small_font, text, _stats_zone.width());
+	}
+
+	if( narrowed ) {
+	    field_t *all[] = { &_time, &_speed, &_pitch, &_cpu, &_volume };
+	    for( unsigned k=0 ; k < sizeof(all)/sizeof(all[0]) ; ++k ) {
+		if( all[k]->font == f.font ) {
+		    _prepare_field(*all[k]);
+		    update(all[k]->zone);
+		}
+	    }
+	} else {
+	    _prepare_field(f);
+	    update(f.zone);
+	}
+    }
+
+    void StatusWidget::_prepare_field(field_t& f)
+    {
+#if QT_VERSION >= 0x040700
+	f.layout.setTextFormat(Qt::PlainText);
+	f.layout.setText(f.text);
+	f.layout.prepare(QTransform(), *f.font);
+#else
+	(void)f;
+#endif
+    }
+
+    /**
+     * Narrow font (never widen it) so that text fits in width.
+     * Returns true if it changed.
+     */
+    bool StatusWidget::_fit_font(QFont& font, const QString& text, int width)
+    {
+	QFontMetrics m( font );
+	int twid = m.width(text);
+	int stretch;
+
+	if( twid <= 0 )
+	    return false;
+	stretch = 100.0 * width / twid;
+	if(stretch < font.stretch() && stretch > 10 ) {
+	    font.setStretch(stretch);
+	    return true;
+	}
+	return false;
+    }
+
+    /**
+     * The rounded background, drawn once per size and palette.
+     */
+    void StatusWidget::_render_background()
+    {
+	_bg_cache = QPixmap( size() );
+	_bg_cache.fill( Qt::transparent );
+
+	QPainter painter(&_bg_cache);
 	painter.setRenderHints(QPainter::Antialiasing);
-	painter.setBackgroundMode(Qt::TransparentMode);
 
 	QBrush brush( palette().color(QPalette::Active, QPalette::Window ) );
 	QPen pen( palette().color(QPalette::Active, QPalette::Dark) );
@@ -192,54 +304,47 @@ namespace StretchPlayer
 	painter.setBrush(brush);
 	painter.setPen(pen);
 	painter.drawRoundedRect( _bg_zone, radius, radius );
+    }
 
-        // Change pen color to draw text.
-	pen.setColor( palette().color(QPalette::Active, QPalette::WindowText) );
-	painter.setPen(pen);
-	brush.setColor( palette().color(QPalette::Active, QPalette::WindowText) );
-	painter.setBrush(brush);
-
-	// Audit the font sizes.  Only change them if there is a problem.
-	QFontMetrics large_m( _large_font );
-	QFontMetrics small_m( _small_font );
+    void StatusWidget::paintEvent(QPaintEvent *event)
+    {
+	const QRect& dirty = event->rect();
 
-	int stretch;
-	int twid;
-	twid = large_m.width(_time);
-	if( twid > 0 ) {
-	    stretch = 100.0 * _time_zone.width() / large_m.width(_time);
-	    if(stretch < _large_font.stretch() && stretch > 10 ) {
-		_large_font.setStretch(stretch);
-	    }
-	}
-	twid = small_m.width(_speed);
-	if( twid > 0 ) {
-	    stretch = 100.0 * _stats_zone.width() / small_m.width(_speed);
-	    if(stretch < _small_font.stretch() && stretch > 10 ) {
-		_small_font.setStretch(stretch);
-	    }
+	if( _bg_cache.size() != size() ) {
+	    _render_background();
 	}
 
-	painter.setFont(_large_font);
-	painter.drawText(_time_zone, _time);
-
-	painter.setFont(_small_font);
-	painter.setRenderHints(QPainter::TextAntialiasing, false);
-	QRect stat = _stats_zone;
-	stat.setHeight( stat.height() / 4 );
-	painter.drawText(stat, _speed);
-	stat.moveTo( stat.x(), stat.bottom() );
-	painter.drawText(stat, _pitch);
-	stat.moveTo( stat.x(), stat.bottom() );
-	painter.drawText(stat, _cpu);
-	stat.moveTo( stat.x(), stat.bottom() );
-	painter.drawText(stat, _volume);
+	QPainter painter(this);
+	painter.setBackgroundMode(Qt::TransparentMode);
+	painter.drawPixmap(dirty, _bg_cache, dirty);
+
+	painter.setPen( palette().color(QPalette::Active, QPalette::WindowText) );
+
+	field_t *all[] = { &_time, &_speed, &_pitch, &_cpu, &_volume };
+	for( unsigned k=0 ; k < sizeof(all)/sizeof(all[0]) ; ++k ) {
+	    const field_t& f = *all[k];
+	    if( f.text.isEmpty() || ! f.zone.intersects(dirty) )
+		continue;
+	    painter.setFont(*f.font);
+	    painter.setRenderHint(QPainter::TextAntialiasing, (f.font == &_large_font));
+#if QT_VERSION >= 0x040700
+	    painter.drawStaticText(f.zone.topLeft(), f.layout);
+#else
+	    painter.drawText(f.zone, f.text);
+#endif
+	}
+    }
 
-	//painter.setFont(_message_font);
-	//painter.drawText(_message_zone, _message);
+    void StatusWidget::changeEvent(QEvent *event)
+    {
+	QWidget::changeEvent(event);
+	if( event->type() == QEvent::PaletteChange ) {
+	    _bg_cache = QPixmap();
+	    update();
+	}
     }
 
-    void StatusWidget::_update_palette()
+    void StatusWidget::update_palette()
     {
 	QPalette p(parentWidget()->palette());
 
@@ -23,6 +23,10 @@
 #include <memory>
 #include <QString>
 #include <QTimer>
+#include <QPixmap>
+#if QT_VERSION >= 0x040700
+#include <QStaticText>
+#endif
 
 class QPushButton;
 class QLabel;
@@ -50,6 +54,17 @@ public:
     StatusWidget(QWidget *parent, PlayerSizes *sizes);
     ~StatusWidget();
 
+    /**
+     * Take the colors from the parent again (reversed).  Call it
+     * when the parent's palette changes.
+     */
+    void update_palette();
+
+    /**
+     * Display refreshes per second, for scrolling the message.
+     */
+    void set_frame_rate(unsigned hz);
+
 public slots:
     void position(float);
     void time(float);
@@ -57,6 +72,7 @@ public slots:
     void pitch(int);
     void volume(float);
     void cpu(float);
+    void xruns(unsigned long); // In the last minute
     void message(QString);
     void song_name(QString);
 
@@ -69,14 +85,36 @@ private slots:
 private:
     virtual void resizeEvent(QResizeEvent *event);
     virtual void paintEvent(QPaintEvent *event);
-    void _update_palette();
+    virtual void changeEvent(QEvent *event);
+
+    /* One line of text and where it goes.  The layout is only
+     * redone when the text or font changes, and only its zone is
+     * repainted.
+     */
+    struct field_t {
+	QString text;
+	QRect zone;
+	const QFont *font;
+#if QT_VERSION >= 0x040700
+	QStaticText layout;
+#endif
+    };
+
+    void _set_field(field_t& f, const QString& text);
+    void _prepare_field(field_t& f);
+    bool _fit_font(QFont& font, const QString& text, int width);
+    void _render_background();
 
 private:
-    QString _time;
-    QString _speed;
-    QString _pitch;
-    QString _volume;
-    QString _cpu;
+    field_t _time;
+    field_t _speed;
+    field_t _pitch;
+    field_t _cpu; // CPU and xruns
+    field_t _volume;
+    QString _cpu_text;
+    QString _xruns_text;
+
+    QPixmap _bg_cache; // Rounded background, made on demand
 
     QFont _large_font;
     QFont _small_font;
@@ -0,0 +1,81 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+#ifndef XRUNLOG_HPP
+#define XRUNLOG_HPP
+
+#include <stdint.h>
+
+namespace StretchPlayer
+{
+    /**
+     * \brief Xrun counter that remembers when the last few happened.
+     *
+     * Times are in seconds, on whatever clock the driver likes, as
+     * long as it uses the same one for add() and within().
+     *
+     * add() must only be called by one thread (the audio thread).
+     * [RT SAFE]  The other methods may be called from any thread,
+     * and may miss an xrun that is being added at the same time.
+     */
+    class XrunLog
+    {
+    public:
+	XrunLog() { reset(); }
+
+	void reset() {
+	    _count = 0;
+	    for( unsigned k = 0 ; k < SIZE ; ++k ) _times[k] = 0.0;
+	}
+
+	void add(double now) {
+	    _times[_count % SIZE] = now;
+	    __sync_synchronize();
+	    ++_count;
+	}
+
+	/// Total since the last reset()
+	uint32_t count() const {
+	    return _count;
+	}
+
+	/// How many happened in the secs before now (at most SIZE)
+	uint32_t within(double now, double secs) const {
+	    uint32_t n = _count, k, found = 0;
+	    for( k = n ; (k > 0) && (n - k < SIZE) ; --k ) {
+		if( _times[(k - 1) % SIZE] < now - secs ) break;
+		++found;
+	    }
+	    return found;
+	}
+
+	/// Time of the latest xrun, or 0.0 if none
+	double last() const {
+	    uint32_t n = _count;
+	    return n ? _times[(n - 1) % SIZE] : 0.0;
+	}
+
+    private:
+	enum { SIZE = 64 };
+	volatile uint32_t _count;
+	volatile double _times[SIZE];
+    };
+
+} // namespace StretchPlayer
+
+#endif // XRUNLOG_HPP
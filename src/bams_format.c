@@ -26,6 +26,7 @@
 #include <endian.h>
 #include <assert.h>
 #include <string.h>
+#include <math.h>
 
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 /* ok */
@@ -208,10 +209,10 @@ bams_copy_u16le_floatle(
 	assert(src_stride == 1);
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 	sample_move_d16_sS((char*)dst, src, count, dst_stride * sizeof(bams_sample_u16be_t), 0);
-	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16le_t), dst_stride, 0);
+	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16le_t), dst_stride, count);
 #else
 	sample_move_d16_sSs((char*)dst, src, count, dst_stride * sizeof(bams_sample_u16le_t), 0);
-	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16le_t), dst_stride, 0);
+	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16le_t), dst_stride, count);
 	bams_byte_reorder_in_place(dst, sizeof(bams_sample_s16le_t), dst_stride, count);
 #endif
 }
@@ -227,11 +228,11 @@ bams_copy_u16be_floatle(
 	assert(src_stride == 1);
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 	sample_move_d16_sS((char*)dst, src, count, dst_stride * sizeof(bams_sample_u16be_t), 0);
-	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16be_t), dst_stride, 0);
+	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16be_t), dst_stride, count);
 	bams_byte_reorder_in_place((char*)dst, sizeof(bams_sample_s16be_t), dst_stride, count);
 #else
 	sample_move_d16_sSs((char*)dst, src, count, dst_stride * sizeof(bams_sample_u16be_t), 0);
-	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16be_t), dst_stride, 0);
+	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16be_t), dst_stride, count);
 #endif
 }
 
@@ -246,10 +247,10 @@ bams_copy_u16le_floatbe(
 	assert(src_stride == 1);
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 	sample_move_d16_sSs((char*)dst, src, count, dst_stride * sizeof(bams_sample_u16le_t), 0);
-	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16le_t), dst_stride, 0);
+	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16le_t), dst_stride, count);
 #else
 	sample_move_d16_sS((char*)dst, src, count, dst_stride * sizeof(bams_sample_u16le_t), 0);
-	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16le_t), dst_stride, 0);
+	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16le_t), dst_stride, count);
 	bams_byte_reorder_in_place(dst, sizeof(bams_sample_s16le_t), dst_stride, count);
 #endif
 }
@@ -265,11 +266,788 @@ bams_copy_u16be_floatbe(
 	assert(src_stride == 1);
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 	sample_move_d16_sSs((char*)dst, src, count, dst_stride * sizeof(bams_sample_u16be_t), 0);
-	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16be_t), dst_stride, 0);
+	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16be_t), dst_stride, count);
 	bams_byte_reorder_in_place((char*)dst, sizeof(bams_sample_s16be_t), dst_stride, count);
 #else
 	sample_move_d16_sS((char*)dst, src, count, dst_stride * sizeof(bams_sample_u16be_t), 0);
-	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16be_t), dst_stride, 0);
+	bams_convert_int_to_uint(dst, sizeof(bams_sample_u16be_t), dst_stride, count);
+#endif
+}
+
+/*
+ * Run-time format selection and the interleaving converters
+ *
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#if defined(__SSE2__)
+#define BAMS_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+#if defined(__clang__) || (__GNUC__ > 4) || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+/* Built with target("avx2") and only called if the CPU has it. */
+#define BAMS_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+/* The kernels below take the format and dither as arguments, and are
+ * only ever called with constants.  Forcing them inline makes a copy
+ * of each one for every (format, dither) that has all of the format
+ * tests folded away.
+ */
+#if defined(__GNUC__)
+#define BAMS_INLINE static inline __attribute__((always_inline))
+#else
+#define BAMS_INLINE static inline
+#endif
+
+#define BAMS_S16_SCALING 32767.0f
+#define BAMS_S24_SCALING 8388607.0f
+
+static const int bams_format_size[BAMS_FORMAT_COUNT] = {
+	2, 2, 2, 2,	/* S16LE S16BE U16LE U16BE */
+	3, 3, 4, 4,	/* S24LE3 S24BE3 S24LE4 S24BE4 */
+	4, 4,		/* S32LE S32BE */
+	4, 4		/* FLOATLE FLOATBE */
+};
+
+int
+bams_format_bytes(bams_format_t fmt)
+{
+	assert(fmt < BAMS_FORMAT_COUNT);
+	return bams_format_size[fmt];
+}
+
+BAMS_INLINE int
+bams_format_is_16(bams_format_t fmt)
+{
+	return fmt == BAMS_S16LE || fmt == BAMS_S16BE
+		|| fmt == BAMS_U16LE || fmt == BAMS_U16BE;
+}
+
+BAMS_INLINE int
+bams_format_is_float(bams_format_t fmt)
+{
+	return fmt == BAMS_FLOATLE || fmt == BAMS_FLOATBE;
+}
+
+/* Big-endian on the wire (i.e. the SIMD code has to swap)
+ */
+BAMS_INLINE int
+bams_format_is_be(bams_format_t fmt)
+{
+	return fmt == BAMS_S16BE || fmt == BAMS_U16BE
+		|| fmt == BAMS_S24BE3 || fmt == BAMS_S24BE4
+		|| fmt == BAMS_S32BE || fmt == BAMS_FLOATBE;
+}
+
+/* Plain C conversion of one sample.  These are the reference for the
+ * SIMD code, which must match them bit for bit.
+ */
+BAMS_INLINE int32_t
+bams_float_to_s16(float s)
+{
+	if(s <= -1.0f) return -32767;
+	if(s >= 1.0f) return 32767;
+	return lrintf(s * BAMS_S16_SCALING);
+}
+
+BAMS_INLINE int32_t
+bams_float_to_s24(float s)
+{
+	if(s <= -1.0f) return -8388607;
+	if(s >= 1.0f) return 8388607;
+	return lrintf(s * BAMS_S24_SCALING);
+}
+
+/* With dither, clip to one LSB inside full scale so that the noise
+ * can't push it over.  (Clipping between the multiply and the add
+ * also keeps the compiler from fusing them, which would round
+ * differently from the SIMD code.)
+ */
+BAMS_INLINE int32_t
+bams_float_to_int_dither(float s, float scale, float noise)
+{
+	float v = s * scale;
+	if(v < 1.0f - scale) v = 1.0f - scale;
+	if(v > scale - 1.0f) v = scale - 1.0f;
+	return lrintf(v + noise);
+}
+
+BAMS_INLINE uint32_t
+bams_float_bits(float s)
+{
+	union { float f; uint32_t u; } x;
+	x.f = s;
+	return x.u;
+}
+
+/* TPDF dither
+ *
+ * The noise for each sample is the difference of two uniform values
+ * in [-0.5, 0.5) LSB: the current one and the one before it from the
+ * same generator.  That gives a triangular distribution over +/- 1
+ * LSB (what makes the error independent of the signal) that is
+ * tilted toward high frequencies, where it is least audible.
+ *
+ * Frame k of a call uses generator (k % 8) of its channel, so that 4
+ * or 8 frames can be done at once by the SIMD code.
+ */
+#define BAMS_LCG_A 1664525u
+#define BAMS_LCG_C 1013904223u
+#define BAMS_U32_TO_UNIT (1.0f / 4294967296.0f) /* exact, so it can't be fused either */
+
+void
+bams_dither_init(bams_dither_t *d, uint32_t seed)
+{
+	int c, j;
+
+	for(c = 0 ; c < 2 ; ++c) {
+		for(j = 0 ; j < 8 ; ++j) {
+			seed = seed * BAMS_LCG_A + BAMS_LCG_C;
+			d->seed[c][j] = seed;
+			d->prev[c][j] = 0.0f;
+		}
+	}
+}
+
+BAMS_INLINE float
+bams_dither_noise(bams_dither_t *d, int ch, int lane)
+{
+	uint32_t s = d->seed[ch][lane] * BAMS_LCG_A + BAMS_LCG_C;
+	float u = (float)(int32_t)s * BAMS_U32_TO_UNIT;
+	float n = u - d->prev[ch][lane];
+
+	d->seed[ch][lane] = s;
+	d->prev[ch][lane] = u;
+	return n;
+}
+
+/* Writing a byte at a time makes these independent of the host byte
+ * order and alignment.
+ */
+#define BAMS_PUT16LE(d, v) do { (d)[0] = (uint8_t)(v); (d)[1] = (uint8_t)((v) >> 8); } while(0)
+#define BAMS_PUT16BE(d, v) do { (d)[1] = (uint8_t)(v); (d)[0] = (uint8_t)((v) >> 8); } while(0)
+#define BAMS_PUT24LE(d, v) do { (d)[0] = (uint8_t)(v); (d)[1] = (uint8_t)((v) >> 8);	\
+		(d)[2] = (uint8_t)((v) >> 16); } while(0)
+#define BAMS_PUT24BE(d, v) do { (d)[2] = (uint8_t)(v); (d)[1] = (uint8_t)((v) >> 8);	\
+		(d)[0] = (uint8_t)((v) >> 16); } while(0)
+#define BAMS_PUT32LE(d, v) do { BAMS_PUT24LE(d, v); (d)[3] = (uint8_t)((v) >> 24); } while(0)
+#define BAMS_PUT32BE(d, v) do { BAMS_PUT24BE((d) + 1, v); (d)[0] = (uint8_t)((v) >> 24); } while(0)
+
+/* Store v, which is already converted to 16 bits, 24 bits, or float
+ * bits, as fmt.
+ */
+BAMS_INLINE void
+bams_put_value(bams_format_t fmt, uint8_t *d, uint32_t v)
+{
+	switch(fmt) {
+	case BAMS_S16LE: BAMS_PUT16LE(d, v); break;
+	case BAMS_S16BE: BAMS_PUT16BE(d, v); break;
+	case BAMS_U16LE: v ^= 0x8000; BAMS_PUT16LE(d, v); break;
+	case BAMS_U16BE: v ^= 0x8000; BAMS_PUT16BE(d, v); break;
+	case BAMS_S24LE3: BAMS_PUT24LE(d, v); break;
+	case BAMS_S24BE3: BAMS_PUT24BE(d, v); break;
+	case BAMS_S24LE4: BAMS_PUT32LE(d, v); break;
+	case BAMS_S24BE4: BAMS_PUT32BE(d, v); break;
+	case BAMS_S32LE: v <<= 8; BAMS_PUT32LE(d, v); break;
+	case BAMS_S32BE: v <<= 8; BAMS_PUT32BE(d, v); break;
+	case BAMS_FLOATLE: BAMS_PUT32LE(d, v); break;
+	case BAMS_FLOATBE: BAMS_PUT32BE(d, v); break;
+	default: assert(0);
+	}
+}
+
+BAMS_INLINE void
+bams_put_sample(bams_format_t fmt, uint8_t *d, float s)
+{
+	uint32_t v;
+
+	if(bams_format_is_float(fmt))
+		v = bams_float_bits(s);
+	else if(bams_format_is_16(fmt))
+		v = bams_float_to_s16(s);
+	else
+		v = bams_float_to_s24(s);
+	bams_put_value(fmt, d, v);
+}
+
+/* Float formats aren't dithered.
+ */
+BAMS_INLINE void
+bams_put_dithered(bams_format_t fmt, uint8_t *d, float s, float noise)
+{
+	uint32_t v;
+
+	if(bams_format_is_float(fmt))
+		v = bams_float_bits(s);
+	else if(bams_format_is_16(fmt))
+		v = bams_float_to_int_dither(s, BAMS_S16_SCALING, noise);
+	else
+		v = bams_float_to_int_dither(s, BAMS_S24_SCALING, noise);
+	bams_put_value(fmt, d, v);
+}
+
+/* One case per format, so that the format is a constant inside each
+ * LOOP.
+ */
+#define BAMS_FORMAT_CASES(LOOP)				\
+	case BAMS_S16LE: LOOP(BAMS_S16LE); break;	\
+	case BAMS_S16BE: LOOP(BAMS_S16BE); break;	\
+	case BAMS_U16LE: LOOP(BAMS_U16LE); break;	\
+	case BAMS_U16BE: LOOP(BAMS_U16BE); break;	\
+	case BAMS_S24LE3: LOOP(BAMS_S24LE3); break;	\
+	case BAMS_S24BE3: LOOP(BAMS_S24BE3); break;	\
+	case BAMS_S24LE4: LOOP(BAMS_S24LE4); break;	\
+	case BAMS_S24BE4: LOOP(BAMS_S24BE4); break;	\
+	case BAMS_S32LE: LOOP(BAMS_S32LE); break;	\
+	case BAMS_S32BE: LOOP(BAMS_S32BE); break;	\
+	case BAMS_FLOATLE: LOOP(BAMS_FLOATLE); break;	\
+	case BAMS_FLOATBE: LOOP(BAMS_FLOATBE); break;	\
+	default: assert(0)
+
+static void
+bams_copy_scalar(bams_format_t fmt, uint8_t *d, int dst_stride,
+		 const float *src, unsigned long count)
+{
+	const int step = dst_stride * bams_format_size[fmt];
+
+#define BAMS_COPY_LOOP(F)					\
+	while(count--) {					\
+		bams_put_sample(F, d, *src++);			\
+		d += step;					\
+	}
+
+	switch(fmt) {
+		BAMS_FORMAT_CASES(BAMS_COPY_LOOP);
+	}
+#undef BAMS_COPY_LOOP
+}
+
+/* Frames k..count-1.  d, left and right point to frame 0.
+ */
+BAMS_INLINE void
+bams_interleave_c(bams_format_t fmt, int dither, uint8_t *d,
+		  const float *left, const float *right,
+		  unsigned long k, unsigned long count,
+		  bams_dither_t *state)
+{
+	const int size = bams_format_size[fmt];
+
+	d += 2 * size * k;
+	for( ; k < count ; ++k) {
+		if(dither && !bams_format_is_float(fmt)) {
+			bams_put_dithered(fmt, d, left[k], bams_dither_noise(state, 0, k & 7));
+			bams_put_dithered(fmt, d + size, right[k], bams_dither_noise(state, 1, k & 7));
+		} else {
+			bams_put_sample(fmt, d, left[k]);
+			bams_put_sample(fmt, d + size, right[k]);
+		}
+		d += 2 * size;
+	}
+}
+
+/* Byte-swap count floats from src into dst
+ */
+static void
+bams_swap_floats(float *dst, const float *src, unsigned long count)
+{
+	memcpy(dst, src, count * sizeof(float));
+	bams_byte_reorder_in_place(dst, sizeof(float), 1, count);
+}
+
+#if defined(BAMS_HAVE_SSE2)
+
+BAMS_INLINE __m128i
+bams_sse2_cvt(const float *src, __m128 scale)
+{
+	__m128 x = _mm_loadu_ps(src);
+	/* max() first, so that NaN comes out as -1.0 */
+	x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+	return _mm_cvtps_epi32(_mm_mul_ps(x, scale));
+}
+
+/* SSE2 has no 32-bit multiply (low half).  Do the even and odd lanes
+ * with the 32x32->64 multiply and put them back together.
+ */
+BAMS_INLINE __m128i
+bams_sse2_mullo(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, 0x08),
+				  _mm_shuffle_epi32(odd, 0x08));
+}
+
+/* Four lanes of bams_dither_noise()
+ */
+BAMS_INLINE __m128
+bams_sse2_noise(uint32_t *seed, float *prev)
+{
+	__m128i s = _mm_loadu_si128((__m128i*)seed);
+	__m128 u, n;
+
+	s = _mm_add_epi32(bams_sse2_mullo(s, _mm_set1_epi32(BAMS_LCG_A)),
+			  _mm_set1_epi32(BAMS_LCG_C));
+	u = _mm_mul_ps(_mm_cvtepi32_ps(s), _mm_set1_ps(BAMS_U32_TO_UNIT));
+	n = _mm_sub_ps(u, _mm_loadu_ps(prev));
+	_mm_storeu_si128((__m128i*)seed, s);
+	_mm_storeu_ps(prev, u);
+	return n;
+}
+
+/* bams_float_to_int_dither(), four at a time
+ */
+BAMS_INLINE __m128i
+bams_sse2_cvt_dither(const float *src, __m128 scale, __m128 noise)
+{
+	const __m128 top = _mm_sub_ps(scale, _mm_set1_ps(1.0f));
+	__m128 x = _mm_mul_ps(_mm_loadu_ps(src), scale);
+	x = _mm_min_ps(_mm_max_ps(x, _mm_sub_ps(_mm_setzero_ps(), top)), top);
+	return _mm_cvtps_epi32(_mm_add_ps(x, noise));
+}
+
+BAMS_INLINE __m128i
+bams_sse2_bswap16(__m128i x)
+{
+	return _mm_or_si128(_mm_slli_epi16(x, 8), _mm_srli_epi16(x, 8));
+}
+
+BAMS_INLINE __m128i
+bams_sse2_bswap32(__m128i x)
+{
+	x = bams_sse2_bswap16(x);
+	x = _mm_shufflelo_epi16(x, 0xB1);
+	return _mm_shufflehi_epi16(x, 0xB1);
+}
+
+/* Four frames per pass.
+ *
+ * Returns the number of frames done.  The rest are left for
+ * bams_interleave_c().
+ */
+BAMS_INLINE unsigned long
+bams_interleave_sse2(bams_format_t fmt, int dither, uint8_t *d,
+		     const float *left, const float *right,
+		     unsigned long count, bams_dither_t *state)
+{
+	const int swap = bams_format_is_be(fmt);
+	const __m128 scale = _mm_set1_ps(bams_format_is_16(fmt)
+					 ? BAMS_S16_SCALING : BAMS_S24_SCALING);
+	__m128i l, r, a, b;
+	__m128 lf, rf;
+	unsigned long k;
+	int32_t tmp[8];
+	int j;
+
+	for(k = 0 ; k + 4 <= count ; k += 4) {
+		if(bams_format_is_float(fmt)) {
+			lf = _mm_loadu_ps(left + k);
+			rf = _mm_loadu_ps(right + k);
+			l = _mm_castps_si128(lf);
+			r = _mm_castps_si128(rf);
+		} else if(dither) {
+			l = bams_sse2_cvt_dither(left + k, scale,
+						 bams_sse2_noise(&state->seed[0][k & 7],
+								 &state->prev[0][k & 7]));
+			r = bams_sse2_cvt_dither(right + k, scale,
+						 bams_sse2_noise(&state->seed[1][k & 7],
+								 &state->prev[1][k & 7]));
+		} else {
+			l = bams_sse2_cvt(left + k, scale);
+			r = bams_sse2_cvt(right + k, scale);
+		}
+
+		if(bams_format_is_16(fmt)) {
+			a = _mm_packs_epi32(_mm_unpacklo_epi32(l, r),
+					    _mm_unpackhi_epi32(l, r));
+			if(fmt == BAMS_U16LE || fmt == BAMS_U16BE)
+				a = _mm_xor_si128(a, _mm_set1_epi16((short)0x8000));
+			if(swap)
+				a = bams_sse2_bswap16(a);
+			_mm_storeu_si128((__m128i*)d, a);
+			d += 16;
+		} else if(fmt == BAMS_S24LE3 || fmt == BAMS_S24BE3) {
+			/* SSE2 can't pack 3-byte samples.  Convert
+			 * with SIMD and pack with plain code.
+			 */
+			_mm_storeu_si128((__m128i*)tmp, _mm_unpacklo_epi32(l, r));
+			_mm_storeu_si128((__m128i*)(tmp + 4), _mm_unpackhi_epi32(l, r));
+			for(j = 0 ; j < 8 ; ++j) {
+				bams_put_value(fmt, d, tmp[j]);
+				d += 3;
+			}
+		} else {
+			if(fmt == BAMS_S32LE || fmt == BAMS_S32BE) {
+				l = _mm_slli_epi32(l, 8);
+				r = _mm_slli_epi32(r, 8);
+			}
+			a = _mm_unpacklo_epi32(l, r);
+			b = _mm_unpackhi_epi32(l, r);
+			if(swap) {
+				a = bams_sse2_bswap32(a);
+				b = bams_sse2_bswap32(b);
+			}
+			_mm_storeu_si128((__m128i*)d, a);
+			_mm_storeu_si128((__m128i*)(d + 16), b);
+			d += 32;
+		}
+	}
+	return k;
+}
+
+#endif /* BAMS_HAVE_SSE2 */
+
+#if defined(BAMS_HAVE_AVX2)
+
+#define BAMS_AVX2 __attribute__((target("avx2")))
+
+BAMS_INLINE BAMS_AVX2 __m256i
+bams_avx2_cvt(const float *src, __m256 scale)
+{
+	__m256 x = _mm256_loadu_ps(src);
+	/* max() first, so that NaN comes out as -1.0 */
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+	return _mm256_cvtps_epi32(_mm256_mul_ps(x, scale));
+}
+
+BAMS_INLINE BAMS_AVX2 __m256
+bams_avx2_noise(uint32_t *seed, float *prev)
+{
+	__m256i s = _mm256_loadu_si256((__m256i*)seed);
+	__m256 u, n;
+
+	s = _mm256_add_epi32(_mm256_mullo_epi32(s, _mm256_set1_epi32(BAMS_LCG_A)),
+			     _mm256_set1_epi32(BAMS_LCG_C));
+	u = _mm256_mul_ps(_mm256_cvtepi32_ps(s), _mm256_set1_ps(BAMS_U32_TO_UNIT));
+	n = _mm256_sub_ps(u, _mm256_loadu_ps(prev));
+	_mm256_storeu_si256((__m256i*)seed, s);
+	_mm256_storeu_ps(prev, u);
+	return n;
+}
+
+BAMS_INLINE BAMS_AVX2 __m256i
+bams_avx2_cvt_dither(const float *src, __m256 scale, __m256 noise)
+{
+	const __m256 top = _mm256_sub_ps(scale, _mm256_set1_ps(1.0f));
+	__m256 x = _mm256_mul_ps(_mm256_loadu_ps(src), scale);
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_sub_ps(_mm256_setzero_ps(), top)), top);
+	return _mm256_cvtps_epi32(_mm256_add_ps(x, noise));
+}
+
+/* Eight frames per pass.  Same contract as bams_interleave_sse2().
+ *
+ * The unpack instructions work within 128-bit lanes, so
+ * unpacklo/unpackhi of L and R give frames {0,1,4,5} and {2,3,6,7}.
+ * Packing to 16 bits puts those back in order for free; the wider
+ * formats need a lane permute.
+ */
+BAMS_INLINE BAMS_AVX2 unsigned long
+bams_interleave_avx2(bams_format_t fmt, int dither, uint8_t *d,
+		     const float *left, const float *right,
+		     unsigned long count, bams_dither_t *state)
+{
+	const int swap = bams_format_is_be(fmt);
+	const int packed24 = (fmt == BAMS_S24LE3 || fmt == BAMS_S24BE3);
+	const __m256 scale = _mm256_set1_ps(bams_format_is_16(fmt)
+					    ? BAMS_S16_SCALING : BAMS_S24_SCALING);
+	const __m256i bswap32 = _mm256_setr_epi8(
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+		3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+	const __m256i pack24le = _mm256_setr_epi8(
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+		0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+	const __m256i pack24be = _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	__m256i l, r, u0, u1, a, b;
+	unsigned long k;
+
+	/* For 3-byte samples, each 16-byte store has 12 good bytes
+	 * and the next store covers the other 4.  The last one of a
+	 * pass writes 4 bytes past its frames, so stop while there is
+	 * at least one more frame to come.
+	 */
+	for(k = 0 ; packed24 ? (k + 8 < count) : (k + 8 <= count) ; k += 8) {
+		if(bams_format_is_float(fmt)) {
+			l = _mm256_castps_si256(_mm256_loadu_ps(left + k));
+			r = _mm256_castps_si256(_mm256_loadu_ps(right + k));
+		} else if(dither) {
+			l = bams_avx2_cvt_dither(left + k, scale,
+						 bams_avx2_noise(state->seed[0], state->prev[0]));
+			r = bams_avx2_cvt_dither(right + k, scale,
+						 bams_avx2_noise(state->seed[1], state->prev[1]));
+		} else {
+			l = bams_avx2_cvt(left + k, scale);
+			r = bams_avx2_cvt(right + k, scale);
+		}
+
+		u0 = _mm256_unpacklo_epi32(l, r);
+		u1 = _mm256_unpackhi_epi32(l, r);
+
+		if(bams_format_is_16(fmt)) {
+			a = _mm256_packs_epi32(u0, u1);
+			if(fmt == BAMS_U16LE || fmt == BAMS_U16BE)
+				a = _mm256_xor_si256(a, _mm256_set1_epi16((short)0x8000));
+			if(swap)
+				a = _mm256_or_si256(_mm256_slli_epi16(a, 8),
+						    _mm256_srli_epi16(a, 8));
+			_mm256_storeu_si256((__m256i*)d, a);
+			d += 32;
+			continue;
+		}
+
+		if(fmt == BAMS_S32LE || fmt == BAMS_S32BE) {
+			u0 = _mm256_slli_epi32(u0, 8);
+			u1 = _mm256_slli_epi32(u1, 8);
+		}
+		a = _mm256_permute2x128_si256(u0, u1, 0x20);
+		b = _mm256_permute2x128_si256(u0, u1, 0x31);
+
+		if(packed24) {
+			a = _mm256_shuffle_epi8(a, swap ? pack24be : pack24le);
+			b = _mm256_shuffle_epi8(b, swap ? pack24be : pack24le);
+			_mm_storeu_si128((__m128i*)d, _mm256_castsi256_si128(a));
+			_mm_storeu_si128((__m128i*)(d + 12), _mm256_extracti128_si256(a, 1));
+			_mm_storeu_si128((__m128i*)(d + 24), _mm256_castsi256_si128(b));
+			_mm_storeu_si128((__m128i*)(d + 36), _mm256_extracti128_si256(b, 1));
+			d += 48;
+		} else {
+			if(swap) {
+				a = _mm256_shuffle_epi8(a, bswap32);
+				b = _mm256_shuffle_epi8(b, bswap32);
+			}
+			_mm256_storeu_si256((__m256i*)d, a);
+			_mm256_storeu_si256((__m256i*)(d + 32), b);
+			d += 64;
+		}
+	}
+	return k;
+}
+
+#endif /* BAMS_HAVE_AVX2 */
+
+/* The specialized interleavers: one for each SIMD level, format and
+ * dither setting.
+ */
+#define BAMS_FOR_EACH_FORMAT(X, D)					\
+	X(S16LE, D) X(S16BE, D) X(U16LE, D) X(U16BE, D)			\
+	X(S24LE3, D) X(S24BE3, D) X(S24LE4, D) X(S24BE4, D)		\
+	X(S32LE, D) X(S32BE, D) X(FLOATLE, D) X(FLOATBE, D)
+
+#define BAMS_DEFINE_C(F, D)						\
+	static void							\
+	bams_il_c_ ## F ## _ ## D(void *dst, const float *left,		\
+				  const float *right, unsigned long count, \
+				  bams_dither_t *dither)		\
+	{								\
+		bams_interleave_c(BAMS_ ## F, D, (uint8_t*)dst,		\
+				  left, right, 0, count, dither);	\
+	}
+#define BAMS_ENTRY_C(F, D) bams_il_c_ ## F ## _ ## D,
+
+BAMS_FOR_EACH_FORMAT(BAMS_DEFINE_C, 0)
+BAMS_FOR_EACH_FORMAT(BAMS_DEFINE_C, 1)
+
+static const bams_interleave_t bams_il_c[2][BAMS_FORMAT_COUNT] = {
+	{ BAMS_FOR_EACH_FORMAT(BAMS_ENTRY_C, 0) },
+	{ BAMS_FOR_EACH_FORMAT(BAMS_ENTRY_C, 1) }
+};
+
+#if defined(BAMS_HAVE_SSE2)
+#define BAMS_DEFINE_SSE2(F, D)						\
+	static void							\
+	bams_il_sse2_ ## F ## _ ## D(void *dst, const float *left,	\
+				     const float *right, unsigned long count, \
+				     bams_dither_t *dither)		\
+	{								\
+		unsigned long k;					\
+		k = bams_interleave_sse2(BAMS_ ## F, D, (uint8_t*)dst,	\
+					 left, right, count, dither);	\
+		bams_interleave_c(BAMS_ ## F, D, (uint8_t*)dst,		\
+				  left, right, k, count, dither);	\
+	}
+#define BAMS_ENTRY_SSE2(F, D) bams_il_sse2_ ## F ## _ ## D,
+
+BAMS_FOR_EACH_FORMAT(BAMS_DEFINE_SSE2, 0)
+BAMS_FOR_EACH_FORMAT(BAMS_DEFINE_SSE2, 1)
+
+static const bams_interleave_t bams_il_sse2[2][BAMS_FORMAT_COUNT] = {
+	{ BAMS_FOR_EACH_FORMAT(BAMS_ENTRY_SSE2, 0) },
+	{ BAMS_FOR_EACH_FORMAT(BAMS_ENTRY_SSE2, 1) }
+};
+#endif
+
+#if defined(BAMS_HAVE_AVX2)
+#define BAMS_DEFINE_AVX2(F, D)						\
+	static BAMS_AVX2 void						\
+	bams_il_avx2_ ## F ## _ ## D(void *dst, const float *left,	\
+				     const float *right, unsigned long count, \
+				     bams_dither_t *dither)		\
+	{								\
+		unsigned long k;					\
+		k = bams_interleave_avx2(BAMS_ ## F, D, (uint8_t*)dst,	\
+					 left, right, count, dither);	\
+		bams_interleave_c(BAMS_ ## F, D, (uint8_t*)dst,		\
+				  left, right, k, count, dither);	\
+	}
+#define BAMS_ENTRY_AVX2(F, D) bams_il_avx2_ ## F ## _ ## D,
+
+BAMS_FOR_EACH_FORMAT(BAMS_DEFINE_AVX2, 0)
+BAMS_FOR_EACH_FORMAT(BAMS_DEFINE_AVX2, 1)
+
+static const bams_interleave_t bams_il_avx2[2][BAMS_FORMAT_COUNT] = {
+	{ BAMS_FOR_EACH_FORMAT(BAMS_ENTRY_AVX2, 0) },
+	{ BAMS_FOR_EACH_FORMAT(BAMS_ENTRY_AVX2, 1) }
+};
+#endif
+
+static int bams_simd_cpu = -1;	/* Best the CPU can do */
+static int bams_simd_use = -1;	/* What we're using */
+
+static int
+bams_simd_detect(void)
+{
+	int level = BAMS_SIMD_NONE;
+
+#if defined(BAMS_HAVE_SSE2)
+	level = BAMS_SIMD_SSE2;
+#endif
+#if defined(BAMS_HAVE_AVX2)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+		level = BAMS_SIMD_AVX2;
+#endif
+	return level;
+}
+
+int
+bams_simd_level(void)
+{
+	if(bams_simd_use < 0)
+		return bams_set_simd_level(BAMS_SIMD_AVX2);
+	return bams_simd_use;
+}
+
+int
+bams_set_simd_level(int level)
+{
+	if(bams_simd_cpu < 0)
+		bams_simd_cpu = bams_simd_detect();
+	if(level > bams_simd_cpu)
+		level = bams_simd_cpu;
+	if(level < BAMS_SIMD_NONE)
+		level = BAMS_SIMD_NONE;
+	bams_simd_use = level;
+	return level;
+}
+
+bams_interleave_t
+bams_interleaver(bams_format_t fmt, int dither)
+{
+	const int d = (dither && !bams_format_is_float(fmt)) ? 1 : 0;
+
+	assert(fmt < BAMS_FORMAT_COUNT);
+	switch(bams_simd_level()) {
+#if defined(BAMS_HAVE_AVX2)
+	case BAMS_SIMD_AVX2:
+		return bams_il_avx2[d][fmt];
+#endif
+#if defined(BAMS_HAVE_SSE2)
+	case BAMS_SIMD_SSE2:
+		return bams_il_sse2[d][fmt];
+#endif
+	default:
+		return bams_il_c[d][fmt];
+	}
+}
+
+/* Non-native float source: swap a block at a time onto the stack.
+ */
+static void
+bams_interleave_swapped(bams_format_t fmt, uint8_t *d,
+			const float *left, const float *right,
+			unsigned long count)
+{
+	bams_interleave_t fn = bams_interleaver(fmt, 0);
+	float l[256], r[256];
+	unsigned long n;
+
+	while(count) {
+		n = (count < 256) ? count : 256;
+		bams_swap_floats(l, left, n);
+		bams_swap_floats(r, right, n);
+		fn(d, l, r, n, 0);
+		d += 2 * n * bams_format_size[fmt];
+		left += n;
+		right += n;
+		count -= n;
+	}
+}
+
+static void
+bams_copy_swapped(bams_format_t fmt, uint8_t *d, int dst_stride,
+		  const float *src, unsigned long count)
+{
+	float s[256];
+	unsigned long n;
+
+	while(count) {
+		n = (count < 256) ? count : 256;
+		bams_swap_floats(s, src, n);
+		bams_copy_scalar(fmt, d, dst_stride, s, n);
+		d += n * dst_stride * bams_format_size[fmt];
+		src += n;
+		count -= n;
+	}
+}
+
+void
+bams_copy_floatle(bams_format_t fmt, void *dst, int dst_stride,
+		  bams_sample_floatle_t *src, unsigned long count)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	bams_copy_scalar(fmt, (uint8_t*)dst, dst_stride, src, count);
+#else
+	bams_copy_swapped(fmt, (uint8_t*)dst, dst_stride, src, count);
+#endif
+}
+
+void
+bams_copy_floatbe(bams_format_t fmt, void *dst, int dst_stride,
+		  bams_sample_floatbe_t *src, unsigned long count)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	bams_copy_swapped(fmt, (uint8_t*)dst, dst_stride, src, count);
+#else
+	bams_copy_scalar(fmt, (uint8_t*)dst, dst_stride, src, count);
+#endif
+}
+
+void
+bams_interleave_floatle(bams_format_t fmt, void *dst,
+			bams_sample_floatle_t *left,
+			bams_sample_floatle_t *right,
+			unsigned long count)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	bams_interleaver(fmt, 0)(dst, left, right, count, 0);
+#else
+	bams_interleave_swapped(fmt, (uint8_t*)dst, left, right, count);
+#endif
+}
+
+void
+bams_interleave_floatbe(bams_format_t fmt, void *dst,
+			bams_sample_floatbe_t *left,
+			bams_sample_floatbe_t *right,
+			unsigned long count)
+{
+#if __BYTE_ORDER == __LITTLE_ENDIAN
+	bams_interleave_swapped(fmt, (uint8_t*)dst, left, right, count);
+#else
+	bams_interleaver(fmt, 0)(dst, left, right, count, 0);
 #endif
 }
 
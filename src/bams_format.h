@@ -78,9 +78,12 @@ typedef  int16_t bams_sample_s16le_t;
 typedef  int16_t bams_sample_s16be_t;
 typedef  uint16_t bams_sample_u16le_t;
 typedef  uint16_t bams_sample_u16be_t;
+/* 3-byte samples have no C type.  Pointers are to the first byte,
+ * and strides are still counted in samples.
+ */
+typedef  uint8_t bams_sample_s24le3_t;
+typedef  uint8_t bams_sample_s24be3_t;
 /*
-typedef  bams_sample_s24le3_t;
-typedef  bams_sample_s24be3_t;
 typedef  bams_sample_u24le3_t;
 typedef  bams_sample_u24be3_t;
 */
@@ -121,6 +124,106 @@ BAMS_COPY(u16be, floatle);
 BAMS_COPY(u16le, floatbe);
 BAMS_COPY(u16be, floatbe);
 
+/* Run-time format selection
+ *
+ * For drivers that don't know the device format until they open it.
+ * The bams_format_t says what the destination is.  The source is
+ * always float (floatle or floatbe, as named).  Integer formats are
+ * clipped to [-1.0, 1.0] and rounded; S32 carries 24 significant bits
+ * (like JACK).  S24LE4/S24BE4 are 24 bits, low-justified and
+ * sign-extended in 4 bytes (ALSA's S24_LE/S24_BE).
+ */
+typedef enum {
+	BAMS_S16LE = 0,
+	BAMS_S16BE,
+	BAMS_U16LE,
+	BAMS_U16BE,
+	BAMS_S24LE3,
+	BAMS_S24BE3,
+	BAMS_S24LE4,
+	BAMS_S24BE4,
+	BAMS_S32LE,
+	BAMS_S32BE,
+	BAMS_FLOATLE,
+	BAMS_FLOATBE,
+	BAMS_FORMAT_COUNT
+} bams_format_t;
+
+/* Bytes per sample of fmt
+ */
+int
+bams_format_bytes(bams_format_t fmt);
+
+/* Like bams_copy_*(), one channel into dst, dst_stride samples apart.
+ */
+void
+bams_copy_floatle(bams_format_t fmt, void *dst, int dst_stride,
+		  bams_sample_floatle_t *src, unsigned long count);
+void
+bams_copy_floatbe(bams_format_t fmt, void *dst, int dst_stride,
+		  bams_sample_floatbe_t *src, unsigned long count);
+
+/* Two channels into a 2-channel interleaved dst (LRLRLR...), in one
+ * pass.  No alignment requirements.  Uses SSE2 or AVX2 if the CPU
+ * has it (see bams_set_simd_level()) and the source is native-endian.
+ */
+void
+bams_interleave_floatle(bams_format_t fmt, void *dst,
+			bams_sample_floatle_t *left,
+			bams_sample_floatle_t *right,
+			unsigned long count);
+void
+bams_interleave_floatbe(bams_format_t fmt, void *dst,
+			bams_sample_floatbe_t *left,
+			bams_sample_floatbe_t *right,
+			unsigned long count);
+
+/* Dither state for bams_interleaver().  Each channel has 8 noise
+ * generators that are used in turn, so that SIMD code can run them
+ * side by side and still match the plain C code.
+ */
+typedef struct {
+	uint32_t seed[2][8];
+	float prev[2][8];
+} bams_dither_t;
+
+void
+bams_dither_init(bams_dither_t *d, uint32_t seed);
+
+/* A converter specialized for one destination format, dither on or
+ * off, and the SIMD level at the time it was looked up.  The source
+ * is native-endian float.  For drivers: look it up once, then call it
+ * every period with no further checks.
+ *
+ * With dither, integer formats get high-passed TPDF noise of +/- 1
+ * LSB (dither must point to a bams_dither_t that only this stream
+ * uses).  Without, dither may be NULL.  Float formats are never
+ * dithered.
+ */
+typedef void (*bams_interleave_t)(void *dst,
+				  const float *left,
+				  const float *right,
+				  unsigned long count,
+				  bams_dither_t *dither);
+
+bams_interleave_t
+bams_interleaver(bams_format_t fmt, int dither);
+
+/* SIMD code paths for the interleavers.  The default is the best
+ * that the CPU supports.  bams_set_simd_level() may ask for less (for
+ * testing against the plain C code), and returns the level that will
+ * be used.  All paths give bit-identical results.
+ */
+#define BAMS_SIMD_NONE 0
+#define BAMS_SIMD_SSE2 1
+#define BAMS_SIMD_AVX2 2
+
+int
+bams_simd_level(void);
+
+int
+bams_set_simd_level(int level);
+
 /* UTILITY FUNCTIONS
  *
  * size is in bytes, not bits.
@@ -0,0 +1,562 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/**
+ * stretchplayer-bench: microbenchmarks for the DSP and I/O primitives.
+ *
+ * Every kernel is run for each buffer size and each alignment of its
+ * buffers, and the best of several repetitions is reported in JSON
+ * (ns/frame and GB/s), so that runs from different commits can be
+ * compared with a script.  With --verify, kernels that have a
+ * reference implementation are checked against it first.
+ *
+ * A "frame" is one sample of one channel, except for kernels that
+ * work on stereo frames (interleave, deinterleave, the stereo ring
+ * buffer).
+ */
+
+#include "config.h"
+
+#include "SampleOps.hpp"
+#include "RingBuffer.hpp"
+#include "MultiChannelRingBuffer.hpp"
+#include "bams_format.h"
+extern "C" {
+#include "jack_memops.h"
+}
+
+#include <getopt.h>
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <string>
+
+namespace StretchPlayer
+{
+namespace Bench
+{
+    static const char usage_line[] =
+	"usage: stretchplayer-bench [options]";
+
+    static const char options_doc[] =
+	"  -o --output=FILE      write the JSON results to FILE (default: stdout)\n"
+	"  -f --filter=TEXT      only run kernels whose name contains TEXT\n"
+	"  -r --repeat=N         repetitions per case, best is reported (default: 5)\n"
+	"  -Q --quick            less work per case (noisier, for smoke tests)\n"
+	"  -v --verify           check kernels against their reference first\n"
+	"  -l --list             list the kernels and exit\n"
+	"  -q --quiet            no progress on stderr\n"
+	"  -h --help             show help/usage and exit\n";
+
+    static const struct option longopts[] = {
+	{"output", 1, 0, 'o'},
+	{"filter", 1, 0, 'f'},
+	{"repeat", 1, 0, 'r'},
+	{"quick", 0, 0, 'Q'},
+	{"verify", 0, 0, 'v'},
+	{"list", 0, 0, 'l'},
+	{"quiet", 0, 0, 'q'},
+	{"help", 0, 0, 'h'},
+	{0, 0, 0, 0}
+    };
+
+    static const char optstring[] = "o:f:r:Qvlqh";
+
+    static const unsigned sizes[] = { 64, 256, 1024, 4096, 16384 };
+    static const unsigned alignments[] = { 0, 4, 8, 12 }; // bytes past 64
+    static const unsigned MAX_FRAMES = 16384;
+    static const unsigned MAX_CHANNELS = 2;
+    static const char *simd_names[] = { "none", "sse2", "avx2" };
+
+    static double now()
+    {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
+    }
+
+    /**
+     * Scratch memory for one case.  src, dst and s16 are offset
+     * from a 64-byte boundary by the alignment under test.  s16 is
+     * src as 16-bit ints, for the kernels that read ints.
+     */
+    struct Buffers
+    {
+	Buffers() : frames(0), gain(2.0f), ring(0), mring(0) {
+	    src_mem.resize(MAX_FRAMES * MAX_CHANNELS * sizeof(float) + 128);
+	    hot_mem.resize(MAX_FRAMES * MAX_CHANNELS * sizeof(float) + 128);
+	    dst_mem.resize(MAX_FRAMES * MAX_CHANNELS * sizeof(float) + 128);
+	    ref_mem.resize(MAX_FRAMES * MAX_CHANNELS * sizeof(float) + 128);
+	    s16_mem.resize(MAX_FRAMES * MAX_CHANNELS * sizeof(int16_t) + 128);
+	    memset(&dither, 0, sizeof(dither));
+	}
+
+	void setup(unsigned frames_, unsigned align) {
+	    frames = frames_;
+	    src = (float*) (_aligned(&src_mem[0]) + align);
+	    dst = _aligned(&dst_mem[0]) + align;
+	    ref = _aligned(&ref_mem[0]) + align;
+	    hot = (float*) (_aligned(&hot_mem[0]) + align);
+	    for( unsigned k = 0 ; k < frames * MAX_CHANNELS ; ++k ) {
+		src[k] = 0.9f * sinf(float(k) * 0.01f);
+		hot[k] = 1.5f * src[k];
+	    }
+	    memset(dst, 0, frames * MAX_CHANNELS * sizeof(float));
+	    s16 = (int16_t*) (_aligned(&s16_mem[0]) + align);
+	    for( unsigned k = 0 ; k < frames * MAX_CHANNELS ; ++k )
+		s16[k] = int16_t(src[k] * 32767.0f);
+	    memset(ref, 0, frames * MAX_CHANNELS * sizeof(float));
+	    gain = 2.0f;
+	    bams_dither_init(&tpdf, 1);
+	}
+
+	static char* _aligned(char *p) {
+	    return (char*) ( ((unsigned long)p + 63) & ~63UL );
+	}
+
+	unsigned frames;
+	float *src;
+	float *hot; // src * 1.5, so that converters have to clip
+	char *dst;
+	char *ref;
+	int16_t *s16;
+	float gain;
+	dither_state_t dither;
+	bams_dither_t tpdf;
+	Tritium::RingBuffer<float> *ring;
+	Tritium::MultiChannelRingBuffer<float, 2> *mring;
+
+	std::vector<char> src_mem, hot_mem, dst_mem, ref_mem, s16_mem;
+    };
+
+    typedef void (*kernel_t)(Buffers& b);
+
+    struct Kernel
+    {
+	const char *name;
+	const char *variant;
+	unsigned channels; // of the result, for --verify
+	double bytes_per_frame; // payload read + written
+	kernel_t run;
+	kernel_t reference; // Writes the expected result to b.ref (or 0)
+	kernel_t compare_out; // Copies the kernel's result to b.dst (or 0 if it already is)
+    };
+
+    /*
+     * apply_gain_to_buffer
+     *
+     * Alternates between 2.0 and 0.5 so that the data stays exact
+     * and never goes denormal.
+     */
+    static void k_gain_vector(Buffers& b)
+    {
+	apply_gain_to_buffer(b.src, b.frames, b.gain);
+	b.gain = 1.0f / b.gain;
+    }
+
+    static void k_gain_scalar(Buffers& b)
+    {
+	apply_gain_to_buffer_scalar(b.src, b.frames, b.gain);
+	b.gain = 1.0f / b.gain;
+    }
+
+    static void r_gain(Buffers& b)
+    {
+	float *out = (float*) b.ref;
+	for( unsigned k = 0 ; k < b.frames ; ++k )
+	    out[k] = b.src[k] * 2.0f;
+    }
+
+    static void c_gain(Buffers& b)
+    {
+	memcpy(b.dst, b.src, b.frames * sizeof(float));
+    }
+
+    /*
+     * mix_to_buffer: left and right into one output (a cue or mono
+     * send).  The gains are powers of two so that the result is
+     * exact either way.
+     */
+    static void k_mix_vector(Buffers& b)
+    {
+	const float *src[2] = { b.src, b.src + b.frames };
+	const float gain[2] = { 0.5f, 0.25f };
+	mix_to_buffer((float*) b.dst, src, gain, 2, b.frames);
+    }
+
+    static void k_mix_scalar(Buffers& b)
+    {
+	const float *src[2] = { b.src, b.src + b.frames };
+	const float gain[2] = { 0.5f, 0.25f };
+	mix_to_buffer_scalar((float*) b.dst, src, gain, 2, b.frames);
+    }
+
+    static void r_mix(Buffers& b)
+    {
+	float *out = (float*) b.ref;
+	for( unsigned k = 0 ; k < b.frames ; ++k )
+	    out[k] = 0.5f * b.src[k] + 0.25f * b.src[b.frames + k];
+    }
+
+    /*
+     * bams_copy_*: one channel into an interleaved stereo device buffer
+     */
+    static void k_bams_s16le(Buffers& b)
+    {
+	bams_copy_s16le_floatle((bams_sample_s16le_t*) b.dst, 2, b.src, 1, b.frames);
+    }
+
+    static void k_bams_s16be(Buffers& b)
+    {
+	bams_copy_s16be_floatle((bams_sample_s16be_t*) b.dst, 2, b.src, 1, b.frames);
+    }
+
+    static void k_bams_u16le(Buffers& b)
+    {
+	bams_copy_u16le_floatle((bams_sample_u16le_t*) b.dst, 2, b.src, 1, b.frames);
+    }
+
+    /*
+     * bams_interleave_*: both channels into an interleaved stereo
+     * device buffer, with each SIMD level (capped at what the CPU
+     * has; see "simd" in the output).  Plain C is the reference.
+     * With DITHER, the noise must match the reference's bit for
+     * bit, so the reference runs on a copy of the dither state.
+     */
+    template <bams_format_t F, int LEVEL, int DITHER>
+    static void k_interleave(Buffers& b)
+    {
+	bams_set_simd_level(LEVEL);
+	bams_interleaver(F, DITHER)(b.dst, b.hot, b.hot + b.frames, b.frames, &b.tpdf);
+    }
+
+    template <bams_format_t F, int DITHER>
+    static void r_interleave(Buffers& b)
+    {
+	int level = bams_simd_level();
+	bams_dither_t tpdf = b.tpdf;
+	bams_set_simd_level(BAMS_SIMD_NONE);
+	bams_interleaver(F, DITHER)(b.ref, b.hot, b.hot + b.frames, b.frames, &tpdf);
+	bams_set_simd_level(level);
+    }
+
+    /*
+     * jack_memops sample_move_*: one channel, interleaved stereo
+     */
+    static void k_move_d16(Buffers& b)
+    {
+	sample_move_d16_sS(b.dst, b.src, b.frames, 4, &b.dither);
+    }
+
+    static void k_move_d16_rect(Buffers& b)
+    {
+	sample_move_dither_rect_d16_sS(b.dst, b.src, b.frames, 4, &b.dither);
+    }
+
+    static void k_move_d16_tri(Buffers& b)
+    {
+	sample_move_dither_tri_d16_sS(b.dst, b.src, b.frames, 4, &b.dither);
+    }
+
+    static void k_move_d16_shaped(Buffers& b)
+    {
+	sample_move_dither_shaped_d16_sS(b.dst, b.src, b.frames, 4, &b.dither);
+    }
+
+    static void k_move_d24(Buffers& b)
+    {
+	sample_move_d24_sS(b.dst, b.src, b.frames, 6, &b.dither);
+    }
+
+    static void k_move_d32u24(Buffers& b)
+    {
+	sample_move_d32u24_sS(b.dst, b.src, b.frames, 8, &b.dither);
+    }
+
+    static void k_move_dS_s16(Buffers& b)
+    {
+	sample_move_dS_s16((float*) b.dst, (char*) b.s16, b.frames, 4);
+    }
+
+    /*
+     * Loader deinterleave loops (stereo frames)
+     */
+    static void k_deint_float(Buffers& b)
+    {
+	float *out = (float*) b.dst;
+	deinterleave_to_stereo(b.src, b.frames, 2, out, out + b.frames);
+    }
+
+    static void r_deint_float(Buffers& b)
+    {
+	float *out = (float*) b.ref;
+	for( unsigned k = 0 ; k < b.frames ; ++k ) {
+	    out[k] = b.src[2*k];
+	    out[b.frames + k] = b.src[2*k + 1];
+	}
+    }
+
+    static void k_deint_s16(Buffers& b)
+    {
+	float *out = (float*) b.dst;
+	deinterleave_to_stereo(b.s16, b.frames, 2, out, out + b.frames);
+    }
+
+    /*
+     * Ring buffers: write a block and read it back (single thread,
+     * so this is the copy and index cost only).  See also
+     * ringbuffer-bench for the two-thread case.
+     */
+    static void k_ring(Buffers& b)
+    {
+	b.ring->write(b.src, b.frames);
+	b.ring->read((float*) b.dst, b.frames);
+    }
+
+    static void k_mring(Buffers& b)
+    {
+	float *in[2] = { b.src, b.src + b.frames };
+	float *out[2] = { (float*) b.dst, (float*) b.dst + b.frames };
+	b.mring->write(in, b.frames);
+	b.mring->read(out, b.frames);
+    }
+
+    static void r_copy_mono(Buffers& b)
+    {
+	memcpy(b.ref, b.src, b.frames * sizeof(float));
+    }
+
+    static void r_copy_stereo(Buffers& b)
+    {
+	memcpy(b.ref, b.src, 2 * b.frames * sizeof(float));
+    }
+
+    static const Kernel kernels[] = {
+	{ "apply_gain_to_buffer", "vector", 1, 8, k_gain_vector, r_gain, c_gain },
+	{ "apply_gain_to_buffer", "scalar", 1, 8, k_gain_scalar, r_gain, c_gain },
+	{ "mix_to_buffer", "vector", 1, 12, k_mix_vector, r_mix, 0 },
+	{ "mix_to_buffer", "scalar", 1, 12, k_mix_scalar, r_mix, 0 },
+	{ "bams_copy_s16le_floatle", "scalar", 1, 6, k_bams_s16le, 0, 0 },
+	{ "bams_copy_s16be_floatle", "scalar", 1, 6, k_bams_s16be, 0, 0 },
+	{ "bams_copy_u16le_floatle", "scalar", 1, 6, k_bams_u16le, 0, 0 },
+#define INTERLEAVE_KERNELS(name, fmt, bytes, dither)			\
+	{ name, "avx2", 2, 8 + 2 * bytes, k_interleave<fmt, BAMS_SIMD_AVX2, dither>, r_interleave<fmt, dither>, 0 }, \
+	{ name, "sse2", 2, 8 + 2 * bytes, k_interleave<fmt, BAMS_SIMD_SSE2, dither>, r_interleave<fmt, dither>, 0 }, \
+	{ name, "scalar", 2, 8 + 2 * bytes, k_interleave<fmt, BAMS_SIMD_NONE, dither>, r_interleave<fmt, dither>, 0 }
+	INTERLEAVE_KERNELS("bams_interleave_s16le", BAMS_S16LE, 2, 0),
+	INTERLEAVE_KERNELS("bams_interleave_u16be", BAMS_U16BE, 2, 0),
+	INTERLEAVE_KERNELS("bams_interleave_s24le3", BAMS_S24LE3, 3, 0),
+	INTERLEAVE_KERNELS("bams_interleave_s24be3", BAMS_S24BE3, 3, 0),
+	INTERLEAVE_KERNELS("bams_interleave_s24le4", BAMS_S24LE4, 4, 0),
+	INTERLEAVE_KERNELS("bams_interleave_s32le", BAMS_S32LE, 4, 0),
+	INTERLEAVE_KERNELS("bams_interleave_s32be", BAMS_S32BE, 4, 0),
+	INTERLEAVE_KERNELS("bams_interleave_floatle", BAMS_FLOATLE, 4, 0),
+	INTERLEAVE_KERNELS("bams_interleave_s16le_dither", BAMS_S16LE, 2, 1),
+	INTERLEAVE_KERNELS("bams_interleave_s24le3_dither", BAMS_S24LE3, 3, 1),
+	INTERLEAVE_KERNELS("bams_interleave_s32le_dither", BAMS_S32LE, 4, 1),
+#undef INTERLEAVE_KERNELS
+	{ "sample_move_d16_sS", "scalar", 1, 6, k_move_d16, 0, 0 },
+	{ "sample_move_dither_rect_d16_sS", "scalar", 1, 6, k_move_d16_rect, 0, 0 },
+	{ "sample_move_dither_tri_d16_sS", "scalar", 1, 6, k_move_d16_tri, 0, 0 },
+	{ "sample_move_dither_shaped_d16_sS", "scalar", 1, 6, k_move_d16_shaped, 0, 0 },
+	{ "sample_move_d24_sS", "scalar", 1, 7, k_move_d24, 0, 0 },
+	{ "sample_move_d32u24_sS", "scalar", 1, 8, k_move_d32u24, 0, 0 },
+	{ "sample_move_dS_s16", "scalar", 1, 6, k_move_dS_s16, 0, 0 },
+	{ "deinterleave_to_stereo_float", "scalar", 2, 16, k_deint_float, r_deint_float, 0 },
+	{ "deinterleave_to_stereo_s16", "scalar", 2, 12, k_deint_s16, 0, 0 },
+	{ "RingBuffer", "plain", 1, 8, k_ring, r_copy_mono, 0 },
+	{ "RingBuffer", "mirrored", 1, 8, k_ring, r_copy_mono, 0 },
+	{ "MultiChannelRingBuffer2", "plain", 2, 16, k_mring, r_copy_stereo, 0 },
+	{ "MultiChannelRingBuffer2", "mirrored", 2, 16, k_mring, r_copy_stereo, 0 },
+    };
+
+    static const unsigned n_kernels = sizeof(kernels) / sizeof(kernels[0]);
+
+    /**
+     * Per-kernel setup beyond the plain buffers.
+     */
+    static void prepare(const Kernel& k, Buffers& b)
+    {
+	bool mirrored = (strcmp(k.variant, "mirrored") == 0);
+	if( k.run == k_ring ) {
+	    b.ring = new Tritium::RingBuffer<float>(2 * MAX_FRAMES, mirrored);
+	    // Start mid-buffer so that the plain ring has to wrap.
+	    b.ring->set(MAX_FRAMES + 7, MAX_FRAMES + 7);
+	}
+	if( k.run == k_mring ) {
+	    b.mring = new Tritium::MultiChannelRingBuffer<float, 2>(2 * MAX_FRAMES, mirrored);
+	}
+    }
+
+    static void unprepare(Buffers& b)
+    {
+	delete b.ring;
+	delete b.mring;
+	b.ring = 0;
+	b.mring = 0;
+    }
+
+    static bool verify(const Kernel& k, Buffers& b, unsigned frames, unsigned align)
+    {
+	b.setup(frames, align);
+	prepare(k, b);
+	k.reference(b);
+	k.run(b);
+	if(k.compare_out) k.compare_out(b);
+	bool ok = (memcmp(b.dst, b.ref, frames * k.channels * sizeof(float)) == 0);
+	unprepare(b);
+	return ok;
+    }
+
+    /**
+     * \return best ns/frame over repeat runs.
+     */
+    static double measure(const Kernel& k, Buffers& b,
+			  unsigned frames, unsigned align,
+			  unsigned long work, unsigned repeat)
+    {
+	unsigned long iters = work / frames;
+	double best = 1e30, t;
+	if( iters < 1 ) iters = 1;
+
+	b.setup(frames, align);
+	prepare(k, b);
+	k.run(b); // warm up caches, page in the buffers
+	for( unsigned r = 0 ; r < repeat ; ++r ) {
+	    t = now();
+	    for( unsigned long i = 0 ; i < iters ; ++i )
+		k.run(b);
+	    t = now() - t;
+	    if( t < best ) best = t;
+	}
+	unprepare(b);
+	return best * 1e9 / double(iters) / double(frames);
+    }
+
+    static int main(int argc, char* argv[])
+    {
+	const char *out_file = 0;
+	std::string filter;
+	unsigned repeat = 5;
+	unsigned long work = 1UL << 22; // frames per repetition
+	bool do_verify = false, list = false, quiet = false;
+	bool help = false, bad = false;
+	int c;
+
+	while( (c = getopt_long(argc, argv, optstring, longopts, 0)) != -1 ) {
+	    switch(c) {
+	    case 'o': out_file = optarg; break;
+	    case 'f': filter = optarg; break;
+	    case 'r': repeat = atoi(optarg); if(repeat < 1) bad = true; break;
+	    case 'Q': work = 1UL << 17; break;
+	    case 'v': do_verify = true; break;
+	    case 'l': list = true; break;
+	    case 'q': quiet = true; break;
+	    case 'h': help = true; break;
+	    default: bad = true;
+	    }
+	}
+
+	if( help || bad ) {
+	    fprintf(stderr, "%s\n%s\n", usage_line, options_doc);
+	    return bad ? -1 : 0;
+	}
+
+	unsigned k, s, a;
+	if( list ) {
+	    for( k = 0 ; k < n_kernels ; ++k )
+		printf("%s %s\n", kernels[k].name, kernels[k].variant);
+	    return 0;
+	}
+
+	Buffers b;
+	int failures = 0;
+
+	if( do_verify ) {
+	    for( k = 0 ; k < n_kernels ; ++k ) {
+		const Kernel& kern = kernels[k];
+		if( !kern.reference ) continue;
+		if( !filter.empty() && !strstr(kern.name, filter.c_str()) ) continue;
+		for( s = 0 ; s < sizeof(sizes)/sizeof(sizes[0]) ; ++s ) {
+		    // Odd sizes too, to catch head/tail handling
+		    unsigned sz[2] = { sizes[s], sizes[s] - 3 };
+		    for( unsigned z = 0 ; z < 2 ; ++z ) {
+			for( a = 0 ; a < sizeof(alignments)/sizeof(alignments[0]) ; ++a ) {
+			    if( !verify(kern, b, sz[z], alignments[a]) ) {
+				fprintf(stderr, "VERIFY FAILED: %s/%s frames=%u align=%u\n",
+					kern.name, kern.variant, sz[z], alignments[a]);
+				++failures;
+			    }
+			}
+		    }
+		}
+	    }
+	    if( !quiet )
+		fprintf(stderr, "verify: %d failure(s)\n", failures);
+	}
+
+	FILE *out = stdout;
+	if( out_file ) {
+	    out = fopen(out_file, "w");
+	    if( !out ) {
+		perror(out_file);
+		return -1;
+	    }
+	}
+
+	fprintf(out, "{\n  \"benchmark\": \"stretchplayer-bench\",\n");
+	fprintf(out, "  \"version\": \"%s\",\n", STRETCHPLAYER_VERSION);
+	fprintf(out, "  \"simd\": \"%s\",\n", simd_names[bams_set_simd_level(BAMS_SIMD_AVX2)]);
+	fprintf(out, "  \"verify_failures\": %d,\n", failures);
+	fprintf(out, "  \"results\": [");
+
+	bool first = true;
+	for( k = 0 ; k < n_kernels ; ++k ) {
+	    const Kernel& kern = kernels[k];
+	    if( !filter.empty() && !strstr(kern.name, filter.c_str()) ) continue;
+	    if( !quiet ) fprintf(stderr, "%s/%s...\n", kern.name, kern.variant);
+	    for( s = 0 ; s < sizeof(sizes)/sizeof(sizes[0]) ; ++s ) {
+		for( a = 0 ; a < sizeof(alignments)/sizeof(alignments[0]) ; ++a ) {
+		    double ns = measure(kern, b, sizes[s], alignments[a], work, repeat);
+		    fprintf(out, "%s\n    {\"kernel\": \"%s\", \"variant\": \"%s\", "
+			    "\"frames\": %u, \"align\": %u, "
+			    "\"ns_per_frame\": %.4f, \"gb_per_s\": %.3f}",
+			    first ? "" : ",",
+			    kern.name, kern.variant, sizes[s], alignments[a],
+			    ns, kern.bytes_per_frame / ns);
+		    first = false;
+		}
+	    }
+	}
+	fprintf(out, "\n  ]\n}\n");
+
+	if( out != stdout ) fclose(out);
+	return failures ? 1 : 0;
+    }
+
+} // namespace Bench
+} // namespace StretchPlayer
+
+int main(int argc, char* argv[])
+{
+    return StretchPlayer::Bench::main(argc, argv);
+}
@@ -0,0 +1,234 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/**
+ * ringbuffer-bench: compare Tritium::RingBuffer (plain and mirrored)
+ * against the old QAtomicInt implementation.
+ *
+ * Throughput: one thread writes a counting sequence through the ring
+ * in blocks, another reads it back and checks it.
+ *
+ * Latency: two rings and two threads bounce a single sample back and
+ * forth.  Reported as the one-way time (half the round trip).
+ *
+ * Both threads spin (yielding when the ring is full/empty), so run it
+ * on an otherwise idle machine with at least two cores.
+ */
+
+#include "RingBuffer.hpp"
+#include "LegacyRingBuffer.hpp"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+    const unsigned RING_SIZE = 16384;
+
+    double now()
+    {
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return double(tv.tv_sec) + double(tv.tv_usec) / 1000000.0;
+    }
+
+    struct MirroredRingBuffer : public Tritium::RingBuffer<float>
+    {
+	MirroredRingBuffer(unsigned sz) : Tritium::RingBuffer<float>(sz, true) {}
+    };
+
+    template<class RB>
+    struct Throughput
+    {
+	Throughput(unsigned block_, unsigned long total_) :
+	    ring(new RB(RING_SIZE)),
+	    block(block_),
+	    total(total_),
+	    errors(0)
+	    {}
+	~Throughput() { delete ring; }
+
+	RB *ring;
+	unsigned block;
+	unsigned long total;
+	unsigned long errors;
+
+	static void* producer(void *arg)
+	    {
+		Throughput *t = static_cast<Throughput*>(arg);
+		std::vector<float> buf(t->block);
+		unsigned long sent = 0, k;
+		unsigned n, want;
+
+		while( sent < t->total ) {
+		    want = t->block;
+		    if( t->total - sent < want ) want = t->total - sent;
+		    for( k = 0 ; k < want ; ++k )
+			buf[k] = float( (sent + k) & 0xFFFFFF );
+		    n = 0;
+		    while( n < want ) {
+			n += t->ring->write(&buf[n], want - n);
+			if( n < want ) sched_yield();
+		    }
+		    sent += want;
+		}
+		return 0;
+	    }
+
+	static void* consumer(void *arg)
+	    {
+		Throughput *t = static_cast<Throughput*>(arg);
+		std::vector<float> buf(t->block);
+		unsigned long got = 0, k;
+		unsigned n;
+
+		while( got < t->total ) {
+		    n = t->ring->read(&buf[0], t->block);
+		    if( n == 0 ) sched_yield();
+		    for( k = 0 ; k < n ; ++k ) {
+			if( buf[k] != float( (got + k) & 0xFFFFFF ) )
+			    ++t->errors;
+		    }
+		    got += n;
+		}
+		return 0;
+	    }
+    };
+
+    template<class RB>
+    struct PingPong
+    {
+	PingPong(unsigned long trips_) :
+	    ping(new RB(RING_SIZE)),
+	    pong(new RB(RING_SIZE)),
+	    trips(trips_)
+	    {}
+	~PingPong() { delete ping; delete pong; }
+
+	// Separate allocations, so that the test doesn't measure
+	// false sharing between the two rings.
+	RB *ping;
+	RB *pong;
+	unsigned long trips;
+
+	static void* server(void *arg)
+	    {
+		PingPong *t = static_cast<PingPong*>(arg);
+		float x;
+		for( unsigned long k = 0 ; k < t->trips ; ++k ) {
+		    while( t->ping->read(&x, 1) == 0 ) sched_yield();
+		    while( t->pong->write(&x, 1) == 0 ) sched_yield();
+		}
+		return 0;
+	    }
+
+	void client()
+	    {
+		float x = 0.0f;
+		for( unsigned long k = 0 ; k < trips ; ++k ) {
+		    while( ping->write(&x, 1) == 0 ) sched_yield();
+		    while( pong->read(&x, 1) == 0 ) sched_yield();
+		}
+	    }
+    };
+
+    template<class RB>
+    double run_throughput(unsigned block, unsigned long total, unsigned long& errors)
+    {
+	Throughput<RB> *t = new Throughput<RB>(block, total);
+	pthread_t prod, cons;
+	double start, elapsed;
+
+	start = now();
+	pthread_create(&cons, 0, Throughput<RB>::consumer, t);
+	pthread_create(&prod, 0, Throughput<RB>::producer, t);
+	pthread_join(prod, 0);
+	pthread_join(cons, 0);
+	elapsed = now() - start;
+
+	errors = t->errors;
+	delete t;
+	return elapsed;
+    }
+
+    template<class RB>
+    double run_latency(unsigned long trips)
+    {
+	PingPong<RB> *t = new PingPong<RB>(trips);
+	pthread_t srv;
+	double start, elapsed;
+
+	pthread_create(&srv, 0, PingPong<RB>::server, t);
+	start = now();
+	t->client();
+	elapsed = now() - start;
+	pthread_join(srv, 0);
+
+	delete t;
+	return elapsed;
+    }
+
+    template<class RB>
+    bool bench(const char *name, unsigned long total, unsigned long trips)
+    {
+	static const unsigned blocks[] = { 64, 256, 1024, 4096 };
+	unsigned long errors;
+	bool ok = true;
+	double secs;
+
+	for( unsigned k = 0 ; k < sizeof(blocks)/sizeof(blocks[0]) ; ++k ) {
+	    secs = run_throughput<RB>(blocks[k], total, errors);
+	    printf("%-8s throughput  block %5u  %8.1f Msamples/s  %6.2f GB/s%s\n",
+		   name, blocks[k],
+		   double(total) / secs / 1e6,
+		   double(total) * sizeof(float) / secs / 1e9,
+		   errors ? "  DATA ERRORS" : "");
+	    if(errors) ok = false;
+	}
+
+	secs = run_latency<RB>(trips);
+	printf("%-8s latency     one-way %8.1f ns\n",
+	       name, secs / double(trips) / 2.0 * 1e9);
+	return ok;
+    }
+
+} // anonymous namespace
+
+int main(int argc, char* argv[])
+{
+    unsigned long total = 1UL << 26;
+    unsigned long trips = 1UL << 20;
+
+    if( argc > 1 ) total = strtoul(argv[1], 0, 0);
+    if( argc > 2 ) trips = strtoul(argv[2], 0, 0);
+    if( total == 0 || trips == 0 ) {
+	fprintf(stderr, "usage: ringbuffer-bench [samples [round_trips]]\n");
+	return -1;
+    }
+
+    bool ok = true;
+    ok = bench< Tritium::Legacy::RingBuffer<float> >("legacy", total, trips) && ok;
+    ok = bench< Tritium::RingBuffer<float> >("current", total, trips) && ok;
+    ok = bench< MirroredRingBuffer >("mirrored", total, trips) && ok;
+    return ok ? 0 : 1;
+}
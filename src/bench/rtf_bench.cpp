@@ -0,0 +1,513 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/**
+ * stretchplayer-rtf-bench: can this machine keep up?
+ *
+ * Runs the real Engine and RubberBandServer against a simulated
+ * audio driver whose clock ticks at real-time pace, for every
+ * combination of speed, pitch and segment (period) size given.  For
+ * each one it reports:
+ *
+ *   rtf         CPU time used by the whole process (audio callback,
+ *               stretcher thread and any threads RubberBand starts)
+ *               divided by the audio time played.  Must stay well
+ *               below 1.0 on a machine that also runs a GUI.
+ *   worst_us    longest single process callback.
+ *   late        callbacks that finished after their deadline.
+ *   underruns   cycles where the stretcher didn't have a full
+ *               segment ready (Engine::get_underruns()).
+ *   load        mean/max of Engine::get_cpu_load().
+ *
+ * Results go to stdout (or --output) as JSON, and a table goes to
+ * stderr.  Without an audio file, a generated test signal is used.
+ */
+
+#include "config.h"
+
+#include "Engine.hpp"
+#include "AudioSystem.hpp"
+
+#include <QString>
+#include <QStringList>
+
+#include <sndfile.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+
+namespace StretchPlayer
+{
+namespace RtfBench
+{
+    static const char usage_line[] =
+	"usage: stretchplayer-rtf-bench [options] [audio_file]";
+
+    static const char options_doc[] =
+	"  -s --speed=LIST       comma-separated speeds (default: 0.25,0.5,0.75,1.0,1.25)\n"
+	"  -p --pitch=LIST       comma-separated pitch shifts (default: -12,-7,0,7,12)\n"
+	"  -b --segment=LIST     comma-separated segment sizes in frames\n"
+	"                        (default: 64,128,256,512,1024,2048)\n"
+	"  -r --rate=HZ          output sample rate (default: 48000)\n"
+	"  -d --duration=SECS    audio measured per combination (default: 5)\n"
+	"  -w --warmup=SECS      audio played before measuring (default: 1)\n"
+	"  -o --output=FILE      write the JSON results to FILE (default: stdout)\n"
+	"  -q --quiet            no table on stderr\n"
+	"  -h --help             show help/usage and exit\n";
+
+    static const struct option longopts[] = {
+	{"speed", 1, 0, 's'},
+	{"pitch", 1, 0, 'p'},
+	{"segment", 1, 0, 'b'},
+	{"rate", 1, 0, 'r'},
+	{"duration", 1, 0, 'd'},
+	{"warmup", 1, 0, 'w'},
+	{"output", 1, 0, 'o'},
+	{"quiet", 0, 0, 'q'},
+	{"help", 0, 0, 'h'},
+	{0, 0, 0, 0}
+    };
+
+    static const char optstring[] = "s:p:b:r:d:w:o:qh";
+
+    static double now()
+    {
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
+    }
+
+    static double cpu_time()
+    {
+	timespec ts;
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+	return double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
+    }
+
+    static void sleep_until(double t)
+    {
+	timespec ts;
+	ts.tv_sec = time_t(t);
+	ts.tv_nsec = long((t - double(ts.tv_sec)) * 1e9);
+	while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) ) {
+	    // EINTR: go back to sleep
+	}
+    }
+
+    /**
+     * \brief An AudioSystem with no device behind it.
+     *
+     * The process callback is only called from cycle(), and the
+     * caller decides when that happens.
+     */
+    class ClockAudioSystem : public AudioSystem
+    {
+    public:
+	ClockAudioSystem(uint32_t sample_rate, uint32_t nframes) :
+	    _sample_rate(sample_rate),
+	    _nframes(nframes),
+	    _active(false),
+	    _frame(0),
+	    _load(0.0f),
+	    _cb(0),
+	    _cb_arg(0)
+	    {}
+	virtual ~ClockAudioSystem() {}
+
+	virtual int init(QString* /*app_name*/, Configuration* /*config*/, QString* /*err_msg*/) {
+	    _buf[0].assign(_nframes, 0.0f);
+	    _buf[1].assign(_nframes, 0.0f);
+	    return 0;
+	}
+	virtual void cleanup() {}
+	virtual int set_process_callback(process_callback_t cb, void* arg, QString* /*err_msg*/) {
+	    _cb = cb;
+	    _cb_arg = arg;
+	    return 0;
+	}
+	virtual int set_segment_size_callback(segment_size_callback_t, void*, QString*) {
+	    return 0; // The segment size never changes
+	}
+	virtual int activate(QString* /*err_msg*/) { _active = true; return 0; }
+	virtual int deactivate(QString* /*err_msg*/) { _active = false; return 0; }
+	virtual uint32_t output_count() { return 2; }
+	virtual uint32_t input_count() { return 0; }
+	virtual uint32_t input_delay() { return 0; }
+	virtual sample_t* output_buffer(int index) {
+	    return (index == 0 || index == 1) ? &_buf[index][0] : 0;
+	}
+	virtual uint32_t output_buffer_size(int index) {
+	    return (index == 0 || index == 1) ? _nframes : 0;
+	}
+	virtual uint32_t sample_rate() { return _sample_rate; }
+	virtual float dsp_load() { return _load; }
+	virtual uint32_t time_stamp() { return _frame; }
+	virtual uint32_t segment_start_time_stamp() { return _frame; }
+	virtual uint32_t current_segment_size() { return _nframes; }
+	virtual int realtime_priority() { return -1; }
+	virtual bool freewheeling() { return false; }
+	virtual int set_rewind_callback(rewind_callback_t, void*, QString*) { return 0; }
+	virtual void request_rewind() {}
+	virtual uint32_t buffered_frames() { return 0; }
+	virtual uint32_t output_delay() { return 0; }
+	virtual uint32_t xrun_count() { return 0; } // See Result::underruns
+	virtual uint32_t xruns_last_minute() { return 0; }
+	virtual int set_latency_callback(latency_callback_t, void*, QString*) { return 0; }
+	virtual void latency_changed() {}
+	virtual bool transport_query(bool*, uint32_t*) { return false; }
+	virtual void transport_start() {}
+	virtual void transport_stop() {}
+	virtual void transport_locate(uint32_t) {}
+
+	double period() const { return double(_nframes) / double(_sample_rate); }
+
+	/**
+	 * Run one process cycle.
+	 *
+	 * \return how long the callback took, in seconds.
+	 */
+	double cycle() {
+	    double start = now(), elapsed;
+	    if( _active && _cb ) {
+		sample_t *outs[2] = { &_buf[0][0], &_buf[1][0] };
+		cycle_t c;
+		c.nframes = _nframes;
+		c.outputs = 2;
+		c.out = outs;
+		c.inputs = 0;
+		c.in = 0;
+		_cb(c, _cb_arg);
+	    }
+	    elapsed = now() - start;
+	    _load = float(elapsed / period());
+	    _frame += _nframes;
+	    return elapsed;
+	}
+
+    private:
+	uint32_t _sample_rate;
+	uint32_t _nframes;
+	bool _active;
+	uint32_t _frame;
+	float _load;
+	process_callback_t _cb;
+	void *_cb_arg;
+	std::vector<float> _buf[2];
+    };
+
+    struct Result
+    {
+	double rtf;
+	double worst_us;
+	unsigned long cycles;
+	unsigned long late;
+	unsigned long underruns;
+	double load_mean;
+	double load_max;
+	bool ended;
+    };
+
+    /**
+     * Play n_cycles segments at real-time pace.  Callbacks that
+     * finish after their deadline are counted in r.late, and the
+     * clock skips ahead (like a driver xrun) if it falls a whole
+     * period behind.
+     */
+    static void run_cycles(Engine& engine,
+			   ClockAudioSystem& sys,
+			   unsigned long n_cycles,
+			   Result *r)
+    {
+	double period = sys.period();
+	double deadline = now();
+	double dt, load;
+
+	for( unsigned long k = 0 ; k < n_cycles ; ++k ) {
+	    deadline += period;
+	    dt = sys.cycle();
+	    if( r ) {
+		++r->cycles;
+		if( dt * 1e6 > r->worst_us ) r->worst_us = dt * 1e6;
+		load = engine.get_cpu_load();
+		r->load_mean += load;
+		if( load > r->load_max ) r->load_max = load;
+	    }
+	    if( now() > deadline ) {
+		if( r ) ++r->late;
+		if( now() > deadline + period )
+		    deadline = now();
+	    } else {
+		sleep_until(deadline);
+	    }
+	}
+    }
+
+    static Result measure(Engine& engine,
+			  ClockAudioSystem& sys,
+			  double speed,
+			  int pitch,
+			  double warmup,
+			  double duration)
+    {
+	Result r;
+	double cpu_start, audio_secs;
+	unsigned long underruns_start;
+	unsigned long n_warmup = (unsigned long)(warmup / sys.period()) + 1;
+	unsigned long n_cycles = (unsigned long)(duration / sys.period()) + 1;
+
+	r.rtf = 0.0;
+	r.worst_us = 0.0;
+	r.cycles = 0;
+	r.late = 0;
+	r.underruns = 0;
+	r.load_mean = 0.0;
+	r.load_max = 0.0;
+	r.ended = false;
+
+	engine.set_stretch(speed);
+	engine.set_pitch(pitch);
+	engine.locate(0.0);
+	engine.play();
+	run_cycles(engine, sys, n_warmup, 0);
+
+	underruns_start = engine.get_underruns();
+	cpu_start = cpu_time();
+	run_cycles(engine, sys, n_cycles, &r);
+	audio_secs = double(r.cycles) * sys.period();
+
+	r.rtf = (cpu_time() - cpu_start) / audio_secs;
+	r.underruns = engine.get_underruns() - underruns_start;
+	r.load_mean /= double(r.cycles);
+	r.ended = ! engine.playing();
+
+	engine.stop();
+	run_cycles(engine, sys, 2, 0);
+	return r;
+    }
+
+    /**
+     * Write a stereo test signal to filename: a few detuned
+     * partials with vibrato, plus a noise burst every half second so
+     * that the stretcher has transients to deal with.
+     */
+    static bool write_test_song(const char *filename, double secs)
+    {
+	const int rate = 44100;
+	const unsigned long nframes = (unsigned long)(secs * rate);
+	const unsigned long block = 4096;
+	std::vector<float> buf(block * 2);
+	unsigned long k, f, n;
+	unsigned noise = 12345;
+	double t, env, x, y;
+	SF_INFO info;
+	SNDFILE *sf;
+
+	info.frames = 0;
+	info.samplerate = rate;
+	info.channels = 2;
+	info.format = SF_FORMAT_WAV | SF_FORMAT_FLOAT;
+	info.sections = 0;
+	info.seekable = 0;
+	sf = sf_open(filename, SFM_WRITE, &info);
+	if( !sf ) return false;
+
+	for( f = 0 ; f < nframes ; f += n ) {
+	    n = (nframes - f < block) ? (nframes - f) : block;
+	    for( k = 0 ; k < n ; ++k ) {
+		t = double(f + k) / rate;
+		x = 0.3 * sin(2.0 * M_PI * 220.0 * t + 3.0 * sin(2.0 * M_PI * 5.0 * t))
+		    + 0.15 * sin(2.0 * M_PI * 331.0 * t)
+		    + 0.1 * sin(2.0 * M_PI * 1447.0 * t);
+		y = 0.3 * sin(2.0 * M_PI * 221.5 * t)
+		    + 0.15 * sin(2.0 * M_PI * 440.0 * t + 2.0 * sin(2.0 * M_PI * 3.0 * t))
+		    + 0.1 * sin(2.0 * M_PI * 2011.0 * t);
+		env = exp( -40.0 * fmod(t, 0.5) );
+		noise = noise * 1103515245u + 12345u;
+		x += 0.3 * env * (double(noise >> 16) / 32768.0 - 1.0);
+		y += 0.3 * env * (double(noise & 0xFFFF) / 32768.0 - 1.0);
+		buf[2*k] = float(x);
+		buf[2*k + 1] = float(y);
+	    }
+	    if( sf_writef_float(sf, &buf[0], n) != sf_count_t(n) ) {
+		sf_close(sf);
+		return false;
+	    }
+	}
+	sf_close(sf);
+	return true;
+    }
+
+    static bool parse_list(const char *arg, std::vector<double>& vals)
+    {
+	QStringList items = QString(arg).split(',', QString::SkipEmptyParts);
+	bool ok;
+	vals.clear();
+	for( int k = 0 ; k < items.size() ; ++k ) {
+	    double v = items[k].trimmed().toDouble(&ok);
+	    if( !ok ) return false;
+	    vals.push_back(v);
+	}
+	return ! vals.empty();
+    }
+
+    static int main(int argc, char* argv[])
+    {
+	std::vector<double> speeds, pitches, segments;
+	const char *out_file = 0;
+	uint32_t rate = 48000;
+	double duration = 5.0, warmup = 1.0;
+	bool quiet = false, help = false, bad = false;
+	int c;
+
+	parse_list("0.25,0.5,0.75,1.0,1.25", speeds);
+	parse_list("-12,-7,0,7,12", pitches);
+	parse_list("64,128,256,512,1024,2048", segments);
+
+	while( (c = getopt_long(argc, argv, optstring, longopts, 0)) != -1 ) {
+	    switch(c) {
+	    case 's': if( ! parse_list(optarg, speeds) ) bad = true; break;
+	    case 'p': if( ! parse_list(optarg, pitches) ) bad = true; break;
+	    case 'b': if( ! parse_list(optarg, segments) ) bad = true; break;
+	    case 'r': rate = atoi(optarg); if(rate < 8000) bad = true; break;
+	    case 'd': duration = atof(optarg); if(duration <= 0.0) bad = true; break;
+	    case 'w': warmup = atof(optarg); if(warmup < 0.0) bad = true; break;
+	    case 'o': out_file = optarg; break;
+	    case 'q': quiet = true; break;
+	    case 'h': help = true; break;
+	    default: bad = true;
+	    }
+	}
+	if( argc - optind > 1 ) bad = true;
+
+	if( help || bad ) {
+	    fprintf(stderr, "%s\n%s\n", usage_line, options_doc);
+	    return bad ? -1 : 0;
+	}
+
+	char tmp_name[] = "/tmp/stretchplayer-rtf-XXXXXX";
+	QString song;
+	if( optind < argc ) {
+	    song = QString::fromLocal8Bit(argv[optind]);
+	} else {
+	    int fd = mkstemp(tmp_name);
+	    if( fd < 0 ) {
+		perror(tmp_name);
+		return -1;
+	    }
+	    close(fd);
+	    // Long enough for warmup + duration at the fastest speed
+	    if( ! write_test_song(tmp_name, 1.5 * (warmup + duration) + 10.0) ) {
+		fprintf(stderr, "ERROR: could not write the test signal to %s\n", tmp_name);
+		unlink(tmp_name);
+		return -1;
+	    }
+	    song = QString::fromLocal8Bit(tmp_name);
+	}
+
+	FILE *out = stdout;
+	if( out_file ) {
+	    out = fopen(out_file, "w");
+	    if( !out ) {
+		perror(out_file);
+		return -1;
+	    }
+	}
+
+	fprintf(out, "{\n  \"benchmark\": \"stretchplayer-rtf-bench\",\n");
+	fprintf(out, "  \"version\": \"%s\",\n", STRETCHPLAYER_VERSION);
+	fprintf(out, "  \"sample_rate\": %u,\n", rate);
+	fprintf(out, "  \"duration\": %.3f,\n", duration);
+	fprintf(out, "  \"results\": [");
+	if( !quiet ) {
+	    fprintf(stderr, "%8s %6s %6s %8s %10s %6s %9s %6s %6s\n",
+		    "segment", "speed", "pitch", "rtf", "worst_us",
+		    "late", "underruns", "load", "max");
+	}
+
+	int failures = 0;
+	bool first = true;
+	for( unsigned b = 0 ; b < segments.size() ; ++b ) {
+	    uint32_t nframes = uint32_t(segments[b]);
+	    ClockAudioSystem *sys = new ClockAudioSystem(rate, nframes);
+	    std::auto_ptr<Engine> engine;
+	    try {
+		engine.reset( new Engine(sys) );
+	    } catch (std::exception& e) {
+		fprintf(stderr, "ERROR: %s\n", e.what());
+		failures = -1;
+		break;
+	    }
+	    if( engine->load_song(song).isNull() ) {
+		fprintf(stderr, "ERROR: could not load %s\n", song.toLocal8Bit().data());
+		failures = -1;
+		break;
+	    }
+
+	    for( unsigned s = 0 ; s < speeds.size() ; ++s ) {
+		for( unsigned p = 0 ; p < pitches.size() ; ++p ) {
+		    int pitch = int(::lrint(pitches[p]));
+		    Result r = measure(*engine, *sys, speeds[s], pitch, warmup, duration);
+		    bool ok = (r.underruns == 0) && (r.rtf < 1.0) && !r.ended;
+		    if( !ok ) ++failures;
+
+		    fprintf(out, "%s\n    {\"segment\": %u, \"speed\": %.3f, \"pitch\": %d, "
+			    "\"rtf\": %.4f, \"worst_us\": %.1f, \"period_us\": %.1f, "
+			    "\"cycles\": %lu, \"late\": %lu, \"underruns\": %lu, "
+			    "\"load_mean\": %.4f, \"load_max\": %.4f, "
+			    "\"ended_early\": %s, \"ok\": %s}",
+			    first ? "" : ",",
+			    nframes, speeds[s], pitch,
+			    r.rtf, r.worst_us, sys->period() * 1e6,
+			    r.cycles, r.late, r.underruns,
+			    r.load_mean, r.load_max,
+			    r.ended ? "true" : "false",
+			    ok ? "true" : "false");
+		    fflush(out);
+		    first = false;
+
+		    if( !quiet ) {
+			fprintf(stderr, "%8u %6.2f %+6d %8.4f %10.1f %6lu %9lu %6.3f %6.3f%s\n",
+				nframes, speeds[s], pitch, r.rtf, r.worst_us,
+				r.late, r.underruns, r.load_mean, r.load_max,
+				ok ? "" : (r.ended ? "  ENDED EARLY" : "  NOT SUSTAINABLE"));
+		    }
+		}
+	    }
+	}
+	fprintf(out, "\n  ]\n}\n");
+
+	if( out != stdout ) fclose(out);
+	if( optind >= argc ) unlink(tmp_name);
+	if( failures < 0 ) return -1;
+	return failures ? 1 : 0;
+    }
+
+} // namespace RtfBench
+} // namespace StretchPlayer
+
+int main(int argc, char* argv[])
+{
+    return StretchPlayer::RtfBench::main(argc, argv);
+}
@@ -0,0 +1,429 @@
+/*
+ * Copyright(c) 2011 by Gabriel M. Beddingfield <gabriel@teuton.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY, without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/**
+ * stretchplayer-render: batch render songs at several speeds and
+ * pitches without a GUI or an audio driver.
+ */
+
+#include "config.h"
+
+#include "SongLoader.hpp"
+#include "Exporter.hpp"
+
+#include <QString>
+#include <QStringList>
+#include <QFileInfo>
+#include <QDir>
+#include <QMutex>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+
+#include <getopt.h>
+#include <sys/time.h>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <iostream>
+
+using namespace std;
+
+namespace StretchPlayer
+{
+namespace Render
+{
+    static const char usage_line[] =
+	"usage: stretchplayer-render [options] audio_file [audio_file ...]";
+
+    static const char copyright_blurb[] =
+	"StretchPlayer version " STRETCHPLAYER_VERSION ", Copyright 2010 Gabriel M. Beddingfield\n"
+	"StretchPlayer comes with ABSOLUTELY NO WARRANTY;\n"
+	"This is free software, and you are welcome to redistribute it\n"
+	"under terms of the GNU Public License (ver. 2 or later)\n";
+
+    static const char options_doc[] =
+	"  -s --speed=LIST       comma-separated speeds, 1.0 = normal (default: 1.0)\n"
+	"                        in steps of 0.01, no repeats\n"
+	"  -p --pitch=LIST       comma-separated pitch shifts in whole semitones,\n"
+	"                        no repeats (default: 0)\n"
+	"  -o --output-dir=DIR   directory for rendered files (default: .)\n"
+	"  -f --format=EXT       wav, flac, aiff, or ogg (default: wav)\n"
+	"  -j --jobs=N           songs/settings to render at once (default: auto)\n"
+	"  -t --threads=N        worker threads per job (default: auto)\n"
+	"  -q --quiet            suppress most output to console\n"
+	"  -h --help             show help/usage and exit\n";
+
+    static const struct option longopts[] = {
+	{"speed", 1, 0, 's'},
+	{"pitch", 1, 0, 'p'},
+	{"output-dir", 1, 0, 'o'},
+	{"format", 1, 0, 'f'},
+	{"jobs", 1, 0, 'j'},
+	{"threads", 1, 0, 't'},
+	{"quiet", 0, 0, 'q'},
+	{"help", 0, 0, 'h'},
+	{0, 0, 0, 0}
+    };
+
+    static const char optstring[] = "s:p:o:f:j:t:qh";
+
+    static QMutex console_lock;
+
+    // Songs are decoded one at a time.  load_song() brackets each
+    // MP3 decode with libmpg123's init/exit, which are global and
+    // not thread safe.
+    static QMutex decode_lock;
+
+    static double now()
+    {
+	timeval tv;
+	gettimeofday(&tv, 0);
+	return double(tv.tv_sec) + double(tv.tv_usec) / 1000000.0;
+    }
+
+    /**
+     * A decoded song, shared by all the jobs that render it.  It is
+     * decoded by the first job that needs it and freed by the last
+     * one to finish.
+     */
+    struct Song
+    {
+	Song() : loaded(false), failed(false), users(0), sample_rate(0) {}
+
+	QString filename;
+	QMutex lock;
+	bool loaded;
+	bool failed;
+	int users;
+	std::vector<float> left;
+	std::vector<float> right;
+	float sample_rate;
+	QString err;
+    };
+
+    static void loader_callback(const QString& msg, bool is_error, void *arg)
+    {
+	Song *song = static_cast<Song*>(arg);
+	if(is_error) {
+	    song->err = msg;
+	}
+    }
+
+    class RenderJob : public QRunnable
+    {
+    public:
+	RenderJob(Song *song,
+		  float speed,
+		  int pitch,
+		  const QString& out_file,
+		  unsigned threads,
+		  bool quiet) :
+	    _song(song),
+	    _speed(speed),
+	    _pitch(pitch),
+	    _out_file(out_file),
+	    _threads(threads),
+	    _quiet(quiet),
+	    _failed(false)
+	    {
+		setAutoDelete(false);
+	    }
+
+	virtual void run();
+
+	bool failed() const { return _failed; }
+
+    private:
+	bool _acquire();
+	void _release();
+
+	Song *_song;
+	float _speed;
+	int _pitch;
+	QString _out_file;
+	unsigned _threads;
+	bool _quiet;
+	bool _failed;
+    };
+
+    bool RenderJob::_acquire()
+    {
+	QMutexLocker lk(&_song->lock);
+	if( ! _song->loaded ) {
+	    QMutexLocker dlk(&decode_lock);
+	    _song->failed = ! load_song( _song->filename,
+					 _song->left,
+					 _song->right,
+					 _song->sample_rate,
+					 loader_callback,
+					 _song );
+	    if( !_song->failed && _song->left.empty() ) {
+		_song->failed = true;
+		_song->err = "The song has no audio in it.";
+	    }
+	    _song->loaded = true;
+	}
+	return ! _song->failed;
+    }
+
+    void RenderJob::_release()
+    {
+	QMutexLocker lk(&_song->lock);
+	--_song->users;
+	if( _song->users == 0 ) {
+	    std::vector<float>().swap(_song->left);
+	    std::vector<float>().swap(_song->right);
+	}
+    }
+
+    void RenderJob::run()
+    {
+	QString err;
+	QString desc = QString("%1 speed %2% pitch %3%4")
+	    .arg( QFileInfo(_song->filename).fileName() )
+	    .arg( double(_speed) * 100.0, 0, 'f', 0 )
+	    .arg( (_pitch >= 0) ? "+" : "" )
+	    .arg( _pitch );
+
+	if( ! _acquire() ) {
+	    _failed = true;
+	    err = _song->err;
+	} else {
+	    Exporter exporter( &_song->left[0],
+			       &_song->right[0],
+			       _song->left.size(),
+			       _song->sample_rate );
+	    exporter.time_ratio( 1.0 / _speed );
+	    exporter.pitch_scale( ::pow(2.0, double(_pitch)/12.0) );
+	    exporter.threads( _threads );
+
+	    double start = now();
+	    if( exporter.render(_out_file, &err) ) {
+		_failed = true;
+	    }
+	    double elapsed = now() - start;
+
+	    if( !_failed && !_quiet ) {
+		double secs = double(exporter.frames_written()) / _song->sample_rate;
+		QMutexLocker lk(&console_lock);
+		cout << desc.toLocal8Bit().data() << ": "
+		     << secs << " s of audio in "
+		     << elapsed << " s ("
+		     << ((elapsed > 0.0) ? secs / elapsed : 0.0)
+		     << " audio-s/wall-s) -> "
+		     << _out_file.toLocal8Bit().data()
+		     << endl;
+	    }
+	}
+	_release();
+
+	if( _failed ) {
+	    QMutexLocker lk(&console_lock);
+	    cerr << "ERROR: " << desc.toLocal8Bit().data()
+		 << ": " << err.toLocal8Bit().data() << endl;
+	}
+    }
+
+    static bool parse_list(const char *arg, std::vector<double>& vals)
+    {
+	QStringList items = QString(arg).split(',', QString::SkipEmptyParts);
+	bool ok;
+	vals.clear();
+	for( int k = 0 ; k < items.size() ; ++k ) {
+	    double v = items[k].trimmed().toDouble(&ok);
+	    if( !ok ) return false;
+	    vals.push_back(v);
+	}
+	return ! vals.empty();
+    }
+
+    /**
+     * Checks that every value is a whole number of steps, and that no
+     * two are the same.  These are what go in the file names, so
+     * anything else would render something other than what the
+     * name says or overwrite another render.
+     */
+    static bool distinct_steps(const std::vector<double>& vals, double steps_per_unit)
+    {
+	std::vector<long> seen;
+	for( size_t k = 0 ; k < vals.size() ; ++k ) {
+	    double v = vals[k] * steps_per_unit;
+	    long n = ::lrint(v);
+	    if( ::fabs(v - double(n)) > 1e-6 ) return false;
+	    for( size_t j = 0 ; j < seen.size() ; ++j ) {
+		if( seen[j] == n ) return false;
+	    }
+	    seen.push_back(n);
+	}
+	return true;
+    }
+
+    static QString output_name(const QString& dir,
+			       const QString& filename,
+			       double speed,
+			       int pitch,
+			       const QString& ext)
+    {
+	QString name = QString("%1_speed%2_pitch%3%4.%5")
+	    .arg( QFileInfo(filename).completeBaseName() )
+	    .arg( int(::lrint(speed * 100.0)), 3, 10, QChar('0') )
+	    .arg( (pitch >= 0) ? "+" : "" )
+	    .arg( pitch )
+	    .arg( ext );
+	return QDir(dir).filePath(name);
+    }
+
+    static int main(int argc, char* argv[])
+    {
+	std::vector<double> speeds(1, 1.0), pitches(1, 0.0);
+	QString out_dir("."), ext("wav");
+	int jobs = 0, threads = 0;
+	bool quiet = false, help = false, bad = false;
+	int c;
+
+	while( (c = getopt_long(argc, argv, optstring, longopts, 0)) != -1 ) {
+	    switch(c) {
+	    case 's':
+		if( ! parse_list(optarg, speeds) ) bad = true;
+		break;
+	    case 'p':
+		if( ! parse_list(optarg, pitches) ) bad = true;
+		break;
+	    case 'o':
+		out_dir = QString::fromLocal8Bit(optarg);
+		break;
+	    case 'f':
+		ext = QString(optarg).toLower();
+		if( ext != "wav" && ext != "flac" && ext != "aiff" && ext != "ogg" ) bad = true;
+		break;
+	    case 'j':
+		jobs = atoi(optarg);
+		break;
+	    case 't':
+		threads = atoi(optarg);
+		break;
+	    case 'q':
+		quiet = true;
+		break;
+	    case 'h':
+		help = true;
+		break;
+	    default:
+		bad = true;
+	    }
+	}
+
+	size_t k, s, p;
+	for( k = 0 ; k < speeds.size() ; ++k ) {
+	    if( speeds[k] <= 0.0 || speeds[k] > 4.0 ) bad = true;
+	}
+	for( k = 0 ; k < pitches.size() ; ++k ) {
+	    if( pitches[k] < -12.0 || pitches[k] > 12.0 ) bad = true;
+	}
+	if( ! distinct_steps(speeds, 100.0) ) bad = true;
+	if( ! distinct_steps(pitches, 1.0) ) bad = true;
+	if( optind >= argc ) bad = true;
+
+	if( help || bad ) {
+	    cout << copyright_blurb << endl;
+	    cout << usage_line << endl;
+	    cout << options_doc << endl;
+	    return bad ? -1 : 0;
+	}
+
+	if( !quiet ) {
+	    cout << copyright_blurb << endl;
+	}
+
+	std::vector<Song*> songs;
+	std::vector<RenderJob*> queue;
+	for( ; optind < argc ; ++optind ) {
+	    Song *song = new Song;
+	    song->filename = QString::fromLocal8Bit(argv[optind]);
+	    song->users = speeds.size() * pitches.size();
+	    songs.push_back(song);
+	}
+
+	// Schedule many jobs with a few threads each, rather than a
+	// few jobs with many threads.  Whole-file jobs scale better
+	// than segments.
+	int cores = QThread::idealThreadCount();
+	if( cores <= 0 ) cores = 1;
+	int njobs = songs.size() * speeds.size() * pitches.size();
+	if( jobs <= 0 ) jobs = (njobs < cores) ? njobs : cores;
+	if( threads <= 0 ) threads = (cores / jobs > 0) ? (cores / jobs) : 1;
+
+	for( k = 0 ; k < songs.size() ; ++k ) {
+	    for( s = 0 ; s < speeds.size() ; ++s ) {
+		for( p = 0 ; p < pitches.size() ; ++p ) {
+		    int pitch = ::lrint(pitches[p]);
+		    queue.push_back( new RenderJob( songs[k],
+						    speeds[s],
+						    pitch,
+						    output_name( out_dir,
+								 songs[k]->filename,
+								 speeds[s],
+								 pitch,
+								 ext ),
+						    threads,
+						    quiet ) );
+		}
+	    }
+	}
+
+	if( !quiet ) {
+	    cout << "Rendering " << njobs << " job(s), "
+		 << jobs << " at a time with "
+		 << threads << " thread(s) each." << endl;
+	}
+
+	QThreadPool pool;
+	pool.setMaxThreadCount(jobs);
+	double start = now();
+	for( k = 0 ; k < queue.size() ; ++k ) {
+	    pool.start(queue[k]);
+	}
+	pool.waitForDone();
+	double elapsed = now() - start;
+
+	int failures = 0;
+	for( k = 0 ; k < queue.size() ; ++k ) {
+	    if( queue[k]->failed() ) ++failures;
+	    delete queue[k];
+	}
+	for( k = 0 ; k < songs.size() ; ++k ) {
+	    delete songs[k];
+	}
+
+	if( !quiet ) {
+	    cout << "Finished " << (njobs - failures) << " of " << njobs
+		 << " job(s) in " << elapsed << " s." << endl;
+	}
+
+	return failures ? 1 : 0;
+    }
+
+} // namespace Render
+} // namespace StretchPlayer
+
+int main(int argc, char* argv[])
+{
+    return StretchPlayer::Render::main(argc, argv);
+}